@@ -0,0 +1,524 @@
+#include <intervaltree.hpp>
+#include <concurrentintervalmap.hpp>
+#include <lsmintervalindex.hpp>
+#include <frozenintervalindex.hpp>
+#include <persistentintervaltree.hpp>
+#include <wideintervaltree.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <malloc.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/* Benchmarks every tree operation over several interval distributions and prints one JSON object
+ * per line: engine, workload, size, op, ops, ns_per_op, allocs_per_op and peak_rss_kb. Peak RSS is
+ * the process high-water mark at the time the record is printed, so run a single size and engine
+ * per process when comparing memory.
+ *
+ *    benchintervaltree [--sizes=1e3,1e5] [--engines=shared,arena] [--workloads=uniform,nested]
+ *                      [--ops=insert,overlapping_interval] [--queries=10000] [--seed=1]
+ */
+
+#if defined(_MSC_VER)
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+static std::atomic<std::uint64_t> allocations(0);
+
+/* Every replacement operator below, aligned or not, goes through these two. They stay out of line
+ * so the compiler never sees an inlined operator new meet a free() and warn about the pairing.
+ */
+static BENCH_NOINLINE void *counted_allocate(std::size_t size, std::size_t alignment) {
+   allocations.fetch_add(1, std::memory_order_relaxed);
+
+   if (size == 0) { size = 1; }
+
+   void *pointer;
+
+   if (alignment <= alignof(std::max_align_t)) { pointer = std::malloc(size); }
+   else
+   {
+#if defined(_WIN32)
+      pointer = _aligned_malloc(size, alignment);
+#else
+      pointer = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+   }
+
+   if (pointer == nullptr) { throw std::bad_alloc(); }
+
+   return pointer;
+}
+
+static BENCH_NOINLINE void counted_free(void *pointer, std::size_t alignment) noexcept {
+#if defined(_WIN32)
+   if (alignment > alignof(std::max_align_t)) { _aligned_free(pointer); return; }
+#else
+   static_cast<void>(alignment);
+#endif
+
+   std::free(pointer);
+}
+
+void *operator new(std::size_t size) { return counted_allocate(size, 0); }
+void *operator new[](std::size_t size) { return counted_allocate(size, 0); }
+void *operator new(std::size_t size, std::align_val_t alignment) { return counted_allocate(size, static_cast<std::size_t>(alignment)); }
+void *operator new[](std::size_t size, std::align_val_t alignment) { return counted_allocate(size, static_cast<std::size_t>(alignment)); }
+void operator delete(void *pointer) noexcept { counted_free(pointer, 0); }
+void operator delete[](void *pointer) noexcept { counted_free(pointer, 0); }
+void operator delete(void *pointer, std::size_t) noexcept { counted_free(pointer, 0); }
+void operator delete[](void *pointer, std::size_t) noexcept { counted_free(pointer, 0); }
+void operator delete(void *pointer, std::align_val_t alignment) noexcept { counted_free(pointer, static_cast<std::size_t>(alignment)); }
+void operator delete[](void *pointer, std::align_val_t alignment) noexcept { counted_free(pointer, static_cast<std::size_t>(alignment)); }
+void operator delete(void *pointer, std::size_t, std::align_val_t alignment) noexcept { counted_free(pointer, static_cast<std::size_t>(alignment)); }
+void operator delete[](void *pointer, std::size_t, std::align_val_t alignment) noexcept { counted_free(pointer, static_cast<std::size_t>(alignment)); }
+
+using namespace intervaltree;
+
+using BoundType = std::uint64_t;
+using IntervalType = Interval<BoundType>;
+
+static std::size_t peak_rss_kb() {
+#if defined(_WIN32)
+   PROCESS_MEMORY_COUNTERS counters;
+
+   if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) { return 0; }
+
+   return static_cast<std::size_t>(counters.PeakWorkingSetSize / 1024);
+#else
+   struct rusage usage;
+
+   if (getrusage(RUSAGE_SELF, &usage) != 0) { return 0; }
+#if defined(__APPLE__)
+   return static_cast<std::size_t>(usage.ru_maxrss / 1024);
+#else
+   return static_cast<std::size_t>(usage.ru_maxrss);
+#endif
+#endif
+}
+
+struct Options
+{
+   std::vector<std::size_t> sizes = {1000, 10000, 100000};
+   std::vector<std::string> engines = {"shared", "arena", "heap", "wide", "persistent", "frozen", "compact", "concurrent", "lsm"};
+   std::vector<std::string> workloads = {"uniform", "clustered", "nested", "overlap", "disjoint"};
+   std::vector<std::string> ops;
+   std::size_t queries = 10000;
+   std::uint64_t seed = 1;
+
+   bool wants(const std::string &op) const {
+      return this->ops.empty() || std::find(this->ops.begin(), this->ops.end(), op) != this->ops.end();
+   }
+};
+
+struct Context
+{
+   const Options &options;
+   const char *engine;
+   const char *workload;
+   std::size_t size;
+};
+
+static std::vector<std::string> split(const std::string &list) {
+   std::vector<std::string> result;
+   std::size_t start = 0;
+
+   while (start <= list.size())
+   {
+      auto comma = list.find(',', start);
+      if (comma == std::string::npos) { comma = list.size(); }
+      if (comma > start) { result.push_back(list.substr(start, comma - start)); }
+
+      start = comma + 1;
+   }
+
+   return result;
+}
+
+// Times fn, which performs `ops` operations, and prints the record.
+template <typename Function>
+static void measure(const Context &context, const char *op, std::size_t ops, Function &&fn) {
+   if (!context.options.wants(op)) { return; }
+
+   auto allocated = allocations.load();
+   auto start = std::chrono::steady_clock::now();
+
+   fn();
+
+   auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+   auto count = static_cast<double>(std::max<std::size_t>(ops, 1));
+
+   std::printf("{\"engine\":\"%s\",\"workload\":\"%s\",\"size\":%zu,\"op\":\"%s\",\"ops\":%zu,"
+               "\"ns_per_op\":%.1f,\"allocs_per_op\":%.3f,\"peak_rss_kb\":%zu}\n",
+               context.engine, context.workload, context.size, op, ops,
+               elapsed / count, static_cast<double>(allocations.load() - allocated) / count, peak_rss_kb());
+   std::fflush(stdout);
+}
+
+static std::vector<IntervalType> generate(const std::string &workload, std::size_t size, std::mt19937_64 &rng) {
+   std::vector<IntervalType> result;
+   auto domain = static_cast<BoundType>(size) * 1000;
+   auto uniform = [&rng](BoundType low, BoundType high) { return std::uniform_int_distribution<BoundType>(low, high)(rng); };
+
+   result.reserve(size);
+
+   if (workload == "uniform")
+   {
+      for (std::size_t i = 0; i < size; ++i)
+      {
+         auto low = uniform(0, domain);
+         result.emplace_back(low, low + uniform(1, 1000));
+      }
+   }
+   else if (workload == "clustered")
+   {
+      std::vector<BoundType> centers(64);
+      std::normal_distribution<double> spread(0.0, 5000.0);
+
+      for (auto &center : centers)
+         center = uniform(domain / 4, domain);
+
+      for (std::size_t i = 0; i < size; ++i)
+      {
+         auto offset = static_cast<std::int64_t>(spread(rng));
+         auto low = static_cast<BoundType>(static_cast<std::int64_t>(centers[i % centers.size()]) + offset);
+
+         result.emplace_back(low, low + uniform(1, 1000));
+      }
+   }
+   else if (workload == "nested")
+   {
+      // mapped images: each 16MiB region holds eight regions nested a page apart, like the memory-region test
+      for (std::size_t i = 0; i < size; ++i)
+      {
+         auto base = static_cast<BoundType>(i / 8) << 24;
+         auto level = static_cast<BoundType>(i % 8) * 0x1000;
+
+         result.emplace_back(base + level, base + (BoundType(1) << 24) - level);
+      }
+
+      std::shuffle(result.begin(), result.end(), rng);
+   }
+   else if (workload == "overlap")
+   {
+      for (std::size_t i = 0; i < size; ++i)
+      {
+         auto low = uniform(0, domain);
+         result.emplace_back(low, low + uniform(domain / 100, domain / 10));
+      }
+   }
+   else if (workload == "disjoint")
+   {
+      for (std::size_t i = 0; i < size; ++i)
+      {
+         auto low = static_cast<BoundType>(i) * 1000;
+         result.emplace_back(low, low + uniform(1, 999));
+      }
+
+      std::shuffle(result.begin(), result.end(), rng);
+   }
+   else
+   {
+      std::fprintf(stderr, "unknown workload: %s\n", workload.c_str());
+      std::exit(1);
+   }
+
+   return result;
+}
+
+struct Queries
+{
+   std::vector<BoundType> points;
+   std::vector<IntervalType> intervals;
+};
+
+static Queries make_queries(const std::vector<IntervalType> &keys, std::size_t count, std::mt19937_64 &rng) {
+   Queries queries;
+   BoundType high = 1;
+
+   for (auto &key : keys)
+      high = std::max(high, key.high);
+
+   std::uniform_int_distribution<BoundType> point(0, high);
+   std::uniform_int_distribution<std::size_t> pick(0, keys.empty() ? 0 : keys.size() - 1);
+
+   for (std::size_t i = 0; i < count; ++i)
+   {
+      queries.points.push_back(point(rng));
+
+      // query intervals are keys of the same workload, so their hit counts follow its shape
+      if (!keys.empty()) { queries.intervals.push_back(keys[pick(rng)]); }
+   }
+
+   return queries;
+}
+
+template <typename Tree>
+static void bench_queries(const Context &context, const Tree &tree, const Queries &queries) {
+   std::size_t hits = 0;
+
+   measure(context, "containing_point", queries.points.size(), [&]() {
+      for (auto point : queries.points)
+         hits += tree.containing_point(point).size();
+   });
+
+   measure(context, "containing_interval", queries.intervals.size(), [&]() {
+      for (auto &interval : queries.intervals)
+         hits += tree.containing_interval(interval).size();
+   });
+
+   measure(context, "overlapping_interval", queries.intervals.size(), [&]() {
+      for (auto &interval : queries.intervals)
+         hits += tree.overlapping_interval(interval).size();
+   });
+
+   measure(context, "contained_by_interval", queries.intervals.size(), [&]() {
+      for (auto &interval : queries.intervals)
+         hits += tree.contained_by_interval(interval).size();
+   });
+
+   measure(context, "for_each_overlapping_interval", queries.intervals.size(), [&]() {
+      for (auto &interval : queries.intervals)
+         tree.for_each_overlapping_interval(interval, [&hits](auto &&...) { ++hits; });
+   });
+
+   // keeps the query loops from being optimized away
+   if (hits == std::size_t(-1)) { std::printf("\n"); }
+}
+
+// Persistent trees are queried through a snapshot, as their readers would.
+template <typename Tree>
+static const Tree &queryable(const Tree &tree) { return tree; }
+
+static PersistentIntervalTree<IntervalType>::Snapshot queryable(const PersistentIntervalTree<IntervalType> &tree) { return tree.snapshot(); }
+
+template <typename Tree>
+static void bench_updates(const Context &context, const std::vector<IntervalType> &keys, const Queries &queries) {
+   {
+      Tree tree;
+
+      measure(context, "insert", keys.size(), [&]() {
+         for (auto &key : keys)
+            tree.insert(key);
+      });
+
+      bench_queries(context, queryable(tree), queries);
+
+      measure(context, "remove", keys.size(), [&]() {
+         for (auto &key : keys)
+            if (tree.contains(key)) { tree.remove(key); }
+      });
+   }
+
+   measure(context, "bulk_build", keys.size(), [&]() { Tree tree{std::vector<IntervalType>(keys)}; });
+}
+
+template <typename Storage>
+static void bench_tree(const Context &context, const std::vector<IntervalType> &keys, const Queries &queries) {
+   using TreeType = IntervalTree<IntervalType, Storage>;
+   using MapType = IntervalMap<IntervalType, std::size_t, Storage>;
+
+   bench_updates<TreeType>(context, keys, queries);
+
+   TreeType tree{std::vector<IntervalType>(keys)};
+
+   measure(context, "bulk_build_parallel", keys.size(), [&]() { TreeType built(std::vector<IntervalType>(keys), BulkOrder::Unsorted, Parallel()); });
+
+   measure(context, "deoverlap", 1, [&]() { tree.deoverlap(); });
+   measure(context, "deoverlap_parallel", 1, [&]() { tree.deoverlap(Parallel()); });
+
+   auto overlap_count = std::min(keys.size(), context.options.queries);
+
+   measure(context, "insert_overlap", overlap_count, [&]() {
+      TreeType merged;
+
+      for (std::size_t i = 0; i < overlap_count; ++i)
+         merged.insert_overlap(keys[i]);
+   });
+
+   MapType map;
+
+   measure(context, "map_subscript_insert", keys.size(), [&]() {
+      for (std::size_t i = 0; i < keys.size(); ++i)
+         map[keys[i]] = i;
+   });
+
+   measure(context, "map_subscript_lookup", keys.size(), [&]() {
+      for (auto &key : keys)
+         ++map[key];
+   });
+}
+
+// Runs fn(thread) on every hardware thread at once, as one measured operation per key.
+template <typename Function>
+static void measure_threads(const Context &context, const char *op, std::size_t ops, std::size_t threads, Function &&fn) {
+   measure(context, op, ops, [&]() {
+      std::vector<std::thread> pool;
+
+      for (std::size_t thread = 0; thread < threads; ++thread)
+         pool.emplace_back(fn, thread);
+
+      for (auto &thread : pool)
+         thread.join();
+   });
+}
+
+// Inserts from every hardware thread into range shards, and into one arena map behind a mutex.
+static void bench_concurrent(const Context &context, const std::vector<IntervalType> &keys, const Queries &queries) {
+   using ShardedType = ConcurrentIntervalMap<IntervalType, std::size_t>;
+
+   auto threads = Parallel().count();
+   auto high = BoundType(0);
+
+   for (auto &key : keys)
+      high = std::max(high, key.low);
+
+   ShardedType sharded(ShardedType::even_bounds(8 * threads, 0, high + 1));
+
+   measure_threads(context, "insert", keys.size(), threads, [&](std::size_t thread) {
+      for (auto index = thread; index < keys.size(); index += threads)
+         sharded.insert(keys[index], index);
+   });
+
+   measure(context, "overlapping_interval", queries.intervals.size(), [&]() {
+      for (auto &interval : queries.intervals)
+         sharded.overlapping_interval(interval);
+   });
+
+   measure(context, "rebalance", 1, [&]() { sharded.rebalance(); });
+
+   IntervalMap<IntervalType, std::size_t, ArenaStorage> locked;
+   std::mutex lock;
+
+   measure_threads(context, "insert_global_mutex", keys.size(), threads, [&](std::size_t thread) {
+      for (auto index = thread; index < keys.size(); index += threads)
+      {
+         std::lock_guard<std::mutex> guard(lock);
+         locked.insert(keys[index], index);
+      }
+   });
+}
+
+// Queries are measured with writes still buffered and spread over runs, then after compact().
+static void bench_lsm(const Context &context, const std::vector<IntervalType> &keys, const Queries &queries) {
+   LsmIntervalIndex<IntervalType> index;
+
+   measure(context, "insert", keys.size(), [&]() {
+      for (auto &key : keys)
+         index.insert(key);
+   });
+
+   measure(context, "overlapping_interval_uncompacted", queries.intervals.size(), [&]() {
+      for (auto &interval : queries.intervals)
+         index.overlapping_interval(interval);
+   });
+
+   measure(context, "compact", 1, [&]() { index.compact(); });
+
+   bench_queries(context, index, queries);
+
+   measure(context, "remove", keys.size(), [&]() {
+      for (auto &key : keys)
+         index.remove(key);
+
+      index.compact();
+   });
+}
+
+static void run(const Options &options, const std::string &engine, const std::string &workload, std::size_t size) {
+   std::mt19937_64 rng(options.seed);
+   auto keys = generate(workload, size, rng);
+   auto queries = make_queries(keys, options.queries, rng);
+   Context context{options, engine.c_str(), workload.c_str(), size};
+
+   if (engine == "shared") { bench_tree<SharedStorage>(context, keys, queries); }
+   else if (engine == "arena") { bench_tree<ArenaStorage>(context, keys, queries); }
+   else if (engine == "heap") { bench_tree<HeapStorage>(context, keys, queries); }
+   else if (engine == "concurrent") { bench_concurrent(context, keys, queries); }
+   else if (engine == "lsm") { bench_lsm(context, keys, queries); }
+   else if (engine == "wide") { bench_updates<WideIntervalTree<IntervalType>>(context, keys, queries); }
+   else if (engine == "persistent") { bench_updates<PersistentIntervalTree<IntervalType>>(context, keys, queries); }
+   else if (engine == "frozen")
+   {
+      measure(context, "bulk_build", keys.size(), [&]() { FrozenIntervalIndex<IntervalType> index(keys); });
+
+      FrozenIntervalIndex<IntervalType> index(keys);
+      bench_queries(context, index, queries);
+   }
+   else if (engine == "compact")
+   {
+      using IndexType = FrozenIntervalIndex<IntervalType, void, CompactKeys>;
+
+      measure(context, "bulk_build", keys.size(), [&]() { IndexType index(keys); });
+
+      IndexType index(keys);
+      bench_queries(context, index, queries);
+   }
+   else
+   {
+      std::fprintf(stderr, "unknown engine: %s\n", engine.c_str());
+      std::exit(1);
+   }
+}
+
+int
+main
+(int argc, char *argv[])
+{
+   Options options;
+
+   for (int i = 1; i < argc; ++i)
+   {
+      std::string arg = argv[i];
+      auto equals = arg.find('=');
+      auto name = arg.substr(0, equals);
+      auto value = (equals == std::string::npos) ? std::string() : arg.substr(equals + 1);
+
+      if (name == "--sizes")
+      {
+         options.sizes.clear();
+
+         for (auto &size : split(value))
+            options.sizes.push_back(static_cast<std::size_t>(std::stod(size)));
+      }
+      else if (name == "--engines") { options.engines = split(value); }
+      else if (name == "--workloads") { options.workloads = split(value); }
+      else if (name == "--ops") { options.ops = split(value); }
+      else if (name == "--queries") { options.queries = static_cast<std::size_t>(std::stod(value)); }
+      else if (name == "--seed") { options.seed = std::stoull(value); }
+      else
+      {
+         std::fprintf(stderr, "usage: %s [--sizes=1e3,1e5] [--engines=shared,arena,heap,wide,persistent,frozen,compact,concurrent,lsm] "
+                              "[--workloads=uniform,clustered,nested,overlap,disjoint] [--ops=...] [--queries=N] [--seed=N]\n", argv[0]);
+         return 1;
+      }
+   }
+
+   for (auto size : options.sizes)
+      for (auto &workload : options.workloads)
+         for (auto &engine : options.engines)
+            run(options, engine, workload, size);
+
+   return 0;
+}
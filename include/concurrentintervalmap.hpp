@@ -0,0 +1,485 @@
+#ifndef __CONCURRENTINTERVALMAP_H
+#define __CONCURRENTINTERVALMAP_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <intervaltree.hpp>
+
+namespace intervaltree
+{
+   namespace exception {
+      class BadShardBounds : public std::exception
+      {
+      public:
+         const char *what() const noexcept { return "Shard bounds must be sorted and number one fewer than the shards."; }
+      };
+   }
+
+   /* An IntervalMap split into range shards by interval low, each shard an arena map behind its
+    * own reader-writer lock, so writers on different shards never touch a shared cache line or
+    * allocator. A write locks only the shard owning key.low. An interval that runs past its
+    * shard's bound still lives in that one shard. Each shard publishes its reach, the highest
+    * bound it holds, and a query locks only the shards its range covers plus any earlier shard
+    * whose reach extends into it.
+    *
+    * Queries spanning shards lock one shard at a time, so they see each shard at a consistent
+    * point but not all shards at the same instant. Visitors run under the shard lock and must
+    * not call back into the map. rebalance() moves the shard bounds with the tree split and join
+    * operations, so Storage must be ArenaStorage or HeapStorage.
+    */
+   template <typename IntervalType, typename Value, typename Storage=ArenaStorage>
+   class ConcurrentIntervalMap
+   {
+   public:
+      using BoundType = typename IntervalType::ValueType;
+      using MapType = IntervalMap<IntervalType, Value, Storage>;
+      using ValueType = typename MapType::ValueType;
+      using SetType = std::set<IntervalType, typename IntervalType::Compare>;
+
+   protected:
+      // Padded to a cache line so that writers on neighbouring shards do not false-share.
+      struct alignas(64) Shard
+      {
+         mutable std::shared_mutex lock;
+         std::atomic<BoundType> low;
+         std::atomic<BoundType> reach;
+         MapType map;
+
+         explicit Shard(const BoundType &low) : low(low), reach(std::numeric_limits<BoundType>::lowest()) {}
+
+         // Call with the shard locked exclusively after every change.
+         void refresh() {
+            auto root = this->map.root_node();
+            this->reach.store((root != nullptr) ? root->max() : std::numeric_limits<BoundType>::lowest());
+         }
+      };
+
+      std::vector<std::unique_ptr<Shard>> _shards;
+      // Shared by queries that span shards, exclusive for rebalance().
+      mutable std::shared_mutex _directory;
+
+      // The last shard starting at or before low. Bounds only move under every shard lock, so
+      // the answer is rechecked once the shard is locked.
+      std::size_t route(const BoundType &low) const {
+         std::size_t first = 0;
+         std::size_t last = this->_shards.size();
+
+         while (last - first > 1)
+         {
+            auto middle = first + (last - first) / 2;
+
+            if (!(low < this->_shards[middle]->low.load())) { first = middle; }
+            else { last = middle; }
+         }
+
+         return first;
+      }
+
+      inline bool owns(std::size_t index, const BoundType &low) const {
+         return !(low < this->_shards[index]->low.load())
+            && (index + 1 == this->_shards.size() || low < this->_shards[index + 1]->low.load());
+      }
+
+      // Runs fn(shard) under the lock of the shard owning key.
+      template <typename Lock, typename Function>
+      auto with_shard(const IntervalType &key, Function fn) const {
+         for (;;)
+         {
+            auto index = this->route(key.low);
+            auto &shard = *this->_shards[index];
+            Lock guard(shard.lock);
+
+            if (this->owns(index, key.low)) { return fn(shard); }
+         }
+      }
+
+      // Runs fn(shard) on every shard query may match, in key order, until fn returns false.
+      template <typename Lock, typename Query, typename Function>
+      bool fan_out(const Query &query, Function fn) const {
+         std::shared_lock<std::shared_mutex> directory(this->_directory);
+
+         for (auto &shard : this->_shards)
+         {
+            auto low = shard->low.load();
+
+            if (!query.may_match_after(IntervalType(low, low))) { break; }
+            if (!query.may_match_below(shard->reach.load())) { continue; }
+
+            Lock guard(shard->lock);
+
+            if (!fn(*shard)) { return false; }
+         }
+
+         return true;
+      }
+
+      /* overlapping_interval() returns every key when interval reaches from the lowest low held by
+       * any shard to the highest reach. Shards change underneath, so like any query spanning shards
+       * this sees each shard at its own point.
+       */
+      bool spanned_by(const IntervalType &interval) const {
+         std::shared_lock<std::shared_mutex> directory(this->_directory);
+         std::optional<BoundType> lowest;
+         auto highest = std::numeric_limits<BoundType>::lowest();
+
+         for (auto &shard : this->_shards)
+         {
+            if (!lowest)
+            {
+               std::shared_lock<std::shared_mutex> guard(shard->lock);
+               auto root = shard->map.root_node();
+
+               if (root != nullptr) { lowest = root->min_low(); }
+            }
+
+            if (highest < shard->reach.load()) { highest = shard->reach.load(); }
+         }
+
+         return lowest && detail::spans_keys(interval, *lowest, highest);
+      }
+
+      // Whether a shard's own overlap calls would take the whole-tree rule for interval.
+      static bool shard_spanned(const MapType &map, const IntervalType &interval) {
+         auto root = map.root_node();
+         return root != nullptr && detail::spans_keys(interval, root->min_low(), root->max());
+      }
+
+      // A shard's overlap visit, held to plain overlap: the whole-tree rule is the map's to decide.
+      template <typename Visitor>
+      static bool visit_overlapping(const MapType &map, const IntervalType &interval, Visitor &visitor) {
+         auto overlapping = [&](const ValueType &value) { return !value.first.overlaps(interval) || detail::invoke_visitor(visitor, value); };
+         return map.for_each_overlapping_interval(interval, overlapping);
+      }
+
+      template <typename Query, typename Visit>
+      SetType collect(const Query &query, Visit visit) const {
+         auto result = SetType();
+         auto insert = [&result](const ValueType &value) { result.insert(value.first); };
+
+         this->fan_out<std::shared_lock<std::shared_mutex>>(query, [&](Shard &shard) { return visit(shard.map, insert); });
+
+         return result;
+      }
+
+      // Cuts all, which holds every value, back into the shards at bounds.
+      void redistribute(MapType &all, const std::vector<BoundType> &bounds) {
+         for (auto index = this->_shards.size() - 1; index > 0; --index)
+         {
+            auto &shard = *this->_shards[index];
+
+            shard.low.store(bounds[index - 1]);
+            all.split(IntervalType(bounds[index - 1], bounds[index - 1]), shard.map);
+            shard.refresh();
+         }
+
+         this->_shards.front()->map.join(std::move(all));
+         this->_shards.front()->refresh();
+      }
+
+      template <typename Function>
+      void rebalance_with(Function bounds_of) {
+         std::unique_lock<std::shared_mutex> directory(this->_directory);
+         std::vector<std::unique_lock<std::shared_mutex>> guards;
+         MapType all;
+
+         for (auto &shard : this->_shards)
+            guards.emplace_back(shard->lock);
+
+         for (auto &shard : this->_shards)
+            all.join(std::move(shard->map));
+
+         this->redistribute(all, bounds_of(all));
+      }
+
+   public:
+      // bounds[i] is where shard i + 1 begins; the first shard takes everything below bounds[0].
+      explicit ConcurrentIntervalMap(const std::vector<BoundType> &bounds) {
+         if (!std::is_sorted(bounds.begin(), bounds.end())) { throw exception::BadShardBounds(); }
+
+         this->_shards.push_back(std::make_unique<Shard>(std::numeric_limits<BoundType>::lowest()));
+
+         for (auto &bound : bounds)
+            this->_shards.push_back(std::make_unique<Shard>(bound));
+      }
+
+      // Starts with shards equal slices of [low, high); rebalance() can move them once data arrives.
+      ConcurrentIntervalMap(std::size_t shards, const BoundType &low, const BoundType &high)
+         : ConcurrentIntervalMap(even_bounds(shards, low, high)) {}
+
+      ConcurrentIntervalMap(const ConcurrentIntervalMap &other) = delete;
+      ConcurrentIntervalMap &operator=(const ConcurrentIntervalMap &other) = delete;
+
+      static std::vector<BoundType> even_bounds(std::size_t shards, const BoundType &low, const BoundType &high) {
+         std::vector<BoundType> bounds;
+
+         for (std::size_t index = 1; index < shards; ++index)
+         {
+            if constexpr (std::is_integral<BoundType>::value) { bounds.push_back(low + static_cast<BoundType>((high - low) / shards * index)); }
+            else { bounds.push_back(low + (high - low) * static_cast<BoundType>(index) / static_cast<BoundType>(shards)); }
+         }
+
+         return bounds;
+      }
+
+      inline std::size_t shard_count() const { return this->_shards.size(); }
+
+      // Where each shard after the first begins.
+      std::vector<BoundType> bounds() const {
+         std::shared_lock<std::shared_mutex> directory(this->_directory);
+         std::vector<BoundType> result;
+
+         for (std::size_t index = 1; index < this->_shards.size(); ++index)
+            result.push_back(this->_shards[index]->low.load());
+
+         return result;
+      }
+
+      // Per-shard sizes, for deciding when to rebalance().
+      std::vector<std::size_t> shard_sizes() const {
+         std::vector<std::size_t> result;
+
+         for (auto &shard : this->_shards)
+         {
+            std::shared_lock<std::shared_mutex> guard(shard->lock);
+            result.push_back(shard->map.size());
+         }
+
+         return result;
+      }
+
+      std::size_t size() const {
+         auto sizes = this->shard_sizes();
+         std::size_t total = 0;
+
+         for (auto size : sizes)
+            total += size;
+
+         return total;
+      }
+
+      inline bool empty() const { return this->size() == 0; }
+
+      // Returns whether key was added; an existing value is left alone.
+      bool insert(const IntervalType &key, const Value &value) {
+         return this->with_shard<std::unique_lock<std::shared_mutex>>(key, [&](Shard &shard) {
+            auto inserted = shard.map.try_emplace(key, value).second;
+            if (inserted) { shard.refresh(); }
+
+            return inserted;
+         });
+      }
+
+      bool insert(const IntervalType &key, Value &&value) {
+         return this->with_shard<std::unique_lock<std::shared_mutex>>(key, [&](Shard &shard) {
+            auto inserted = shard.map.try_emplace(key, std::move(value)).second;
+            if (inserted) { shard.refresh(); }
+
+            return inserted;
+         });
+      }
+
+      // Returns whether key was added rather than overwritten.
+      template <typename V>
+      bool insert_or_assign(const IntervalType &key, V &&value) {
+         return this->with_shard<std::unique_lock<std::shared_mutex>>(key, [&](Shard &shard) {
+            auto inserted = shard.map.insert_or_assign(key, std::forward<V>(value)).second;
+            if (inserted) { shard.refresh(); }
+
+            return inserted;
+         });
+      }
+
+      // Returns whether key was present.
+      bool remove(const IntervalType &key) {
+         return this->with_shard<std::unique_lock<std::shared_mutex>>(key, [&](Shard &shard) {
+            if (!shard.map.contains(key)) { return false; }
+
+            shard.map.remove(key);
+            shard.refresh();
+
+            return true;
+         });
+      }
+
+      // Values are copied out: a reference would outlive the shard lock.
+      std::optional<Value> find(const IntervalType &key) const {
+         return this->with_shard<std::shared_lock<std::shared_mutex>>(key, [&](Shard &shard) {
+            auto value = shard.map.find(key);
+            return (value != nullptr) ? std::optional<Value>(*value) : std::nullopt;
+         });
+      }
+
+      bool contains(const IntervalType &key) const {
+         return this->with_shard<std::shared_lock<std::shared_mutex>>(key, [&](Shard &shard) { return shard.map.contains(key); });
+      }
+
+      SetType containing_point(const BoundType &point) const {
+         return this->collect(detail::ContainingPointQuery<IntervalType>{point},
+                              [&](const MapType &map, auto &visitor) { return map.for_each_containing_point(point, visitor); });
+      }
+
+      SetType containing_interval(const IntervalType &interval) const {
+         return this->collect(detail::ContainingIntervalQuery<IntervalType>{interval},
+                              [&](const MapType &map, auto &visitor) { return map.for_each_containing_interval(interval, visitor); });
+      }
+
+      // Returns every key when interval spans them all, as IntervalMap does.
+      SetType overlapping_interval(const IntervalType &interval) const {
+         if (this->spanned_by(interval)) { return this->contained_by_interval(interval); }
+
+         return this->collect(detail::OverlappingIntervalQuery<IntervalType>{interval},
+                              [&](const MapType &map, auto &visitor) { return visit_overlapping(map, interval, visitor); });
+      }
+
+      SetType contained_by_interval(const IntervalType &interval) const {
+         return this->collect(detail::ContainedByIntervalQuery<IntervalType>{interval},
+                              [&](const MapType &map, auto &visitor) { return map.for_each_contained_by_interval(interval, visitor); });
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_point(const BoundType &point, Visitor &&visitor) const {
+         return this->fan_out<std::shared_lock<std::shared_mutex>>(detail::ContainingPointQuery<IntervalType>{point},
+                                                                   [&](Shard &shard) { return shard.map.for_each_containing_point(point, visitor); });
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_interval(const IntervalType &interval, Visitor &&visitor) const {
+         return this->fan_out<std::shared_lock<std::shared_mutex>>(detail::ContainingIntervalQuery<IntervalType>{interval},
+                                                                   [&](Shard &shard) { return shard.map.for_each_containing_interval(interval, visitor); });
+      }
+
+      template <typename Visitor>
+      bool for_each_overlapping_interval(const IntervalType &interval, Visitor &&visitor) const {
+         if (this->spanned_by(interval)) { return this->for_each_contained_by_interval(interval, visitor); }
+
+         return this->fan_out<std::shared_lock<std::shared_mutex>>(detail::OverlappingIntervalQuery<IntervalType>{interval},
+                                                                   [&](Shard &shard) { return visit_overlapping(shard.map, interval, visitor); });
+      }
+
+      template <typename Visitor>
+      bool for_each_contained_by_interval(const IntervalType &interval, Visitor &&visitor) const {
+         return this->fan_out<std::shared_lock<std::shared_mutex>>(detail::ContainedByIntervalQuery<IntervalType>{interval},
+                                                                   [&](Shard &shard) { return shard.map.for_each_contained_by_interval(interval, visitor); });
+      }
+
+      // Both return how many intervals were erased, the same ones the matching query returns.
+      std::size_t erase_overlapping(const IntervalType &interval) {
+         if (this->spanned_by(interval)) { return this->erase_contained_by(interval); }
+
+         std::size_t erased = 0;
+
+         this->fan_out<std::unique_lock<std::shared_mutex>>(detail::OverlappingIntervalQuery<IntervalType>{interval}, [&](Shard &shard) {
+            if (shard_spanned(shard.map, interval))
+            {
+               std::vector<IntervalType> keys;
+               auto record = [&keys](const ValueType &value) { keys.push_back(value.first); };
+
+               visit_overlapping(shard.map, interval, record);
+
+               for (auto &key : keys)
+                  shard.map.remove(key);
+
+               erased += keys.size();
+            }
+            else { erased += shard.map.erase_overlapping(interval); }
+
+            shard.refresh();
+
+            return true;
+         });
+
+         return erased;
+      }
+
+      std::size_t erase_contained_by(const IntervalType &interval) {
+         std::size_t erased = 0;
+
+         this->fan_out<std::unique_lock<std::shared_mutex>>(detail::ContainedByIntervalQuery<IntervalType>{interval}, [&](Shard &shard) {
+            erased += shard.map.erase_contained_by(interval);
+            shard.refresh();
+
+            return true;
+         });
+
+         return erased;
+      }
+
+      // Summed over the shards.
+      MemoryUsage memory_usage() const {
+         auto total = MemoryUsage();
+
+         for (auto &shard : this->_shards)
+         {
+            std::shared_lock<std::shared_mutex> guard(shard->lock);
+            auto usage = shard->map.memory_usage();
+
+            total.nodes += usage.nodes;
+            total.node_size = usage.node_size;
+            total.key_bytes += usage.key_bytes;
+            total.value_bytes += usage.value_bytes;
+            total.overhead_bytes += usage.overhead_bytes;
+            total.slack_bytes += usage.slack_bytes;
+         }
+
+         return total;
+      }
+
+      // Compacts one shard at a time; the others stay available.
+      void shrink_to_fit() {
+         for (auto &shard : this->_shards)
+         {
+            std::unique_lock<std::shared_mutex> guard(shard->lock);
+            shard->map.shrink_to_fit();
+         }
+      }
+
+      void clear() {
+         for (auto &shard : this->_shards)
+         {
+            std::unique_lock<std::shared_mutex> guard(shard->lock);
+
+            shard->map.clear();
+            shard->refresh();
+         }
+      }
+
+      /* Moves the bounds so every shard holds about the same number of intervals. Blocks all
+       * other access while it runs: the shards are joined into one tree and split at the new
+       * bounds, O(shards log n) plus copying for arena storage (see split()).
+       */
+      void rebalance() {
+         this->rebalance_with([this](const MapType &all) {
+            std::vector<BoundType> bounds;
+            auto count = all.size();
+
+            for (std::size_t index = 1; index < this->_shards.size(); ++index)
+            {
+               if (count == 0) { bounds.push_back(this->_shards[index]->low.load()); }
+               else { bounds.push_back(all.select(std::min(count - 1, index * count / this->_shards.size())).first.low); }
+            }
+
+            return bounds;
+         });
+      }
+
+      // Moves the bounds to the ones given, as the constructor takes them.
+      void rebalance(const std::vector<BoundType> &bounds) {
+         if (bounds.size() + 1 != this->_shards.size() || !std::is_sorted(bounds.begin(), bounds.end())) { throw exception::BadShardBounds(); }
+
+         this->rebalance_with([&bounds](const MapType &) { return bounds; });
+      }
+   };
+}
+
+#endif
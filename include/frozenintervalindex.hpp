@@ -0,0 +1,485 @@
+#ifndef __FROZENINTERVALINDEX_H
+#define __FROZENINTERVALINDEX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <intervaltree.hpp>
+
+namespace intervaltree
+{
+   // Full-width columns: low, high and subtree max, each one BoundType per interval.
+   template <typename BoundType>
+   class WideKeyColumns
+   {
+      std::vector<BoundType> _lows;
+      std::vector<BoundType> _highs;
+      std::vector<BoundType> _max;
+
+   public:
+      void reserve(std::size_t count) {
+         this->_lows.reserve(count);
+         this->_highs.reserve(count);
+         this->_max.reserve(count);
+      }
+
+      // Keys must arrive sorted. The subtree max starts out as the key's own high.
+      void push_back(const BoundType &low, const BoundType &high) {
+         this->_lows.push_back(low);
+         this->_highs.push_back(high);
+         this->_max.push_back(high);
+      }
+
+      inline std::size_t size() const { return this->_lows.size(); }
+      inline BoundType low(std::size_t index) const { return this->_lows[index]; }
+      inline BoundType high(std::size_t index) const { return this->_highs[index]; }
+      inline BoundType max(std::size_t index) const { return this->_max[index]; }
+      inline void set_max(std::size_t index, const BoundType &max) { this->_max[index] = max; }
+
+      inline const std::vector<BoundType> &lows() const { return this->_lows; }
+      inline const std::vector<BoundType> &highs() const { return this->_highs; }
+   };
+
+   /* Twelve bytes per interval instead of 24 for 64-bit bounds: low as a 32-bit offset from the
+    * first low of its block of BlockSize keys, high as a 32-bit length, and the subtree max as a
+    * 32-bit span past low. A span that does not fit saturates and reads back as the largest bound,
+    * which only costs pruning. A key whose offset or length does not fit is escaped to a side
+    * table, so any key set round-trips; clustered, short regions never touch it.
+    */
+   template <typename BoundType, std::size_t BlockSize=256>
+   class CompactKeyColumns
+   {
+      static_assert(std::is_integral<BoundType>::value, "CompactKeys requires an integral bound type.");
+
+      using Unsigned = typename std::make_unsigned<BoundType>::type;
+
+      static constexpr std::uint32_t Escape = std::numeric_limits<std::uint32_t>::max();
+
+      struct Escaped
+      {
+         std::size_t index;
+         BoundType low;
+         BoundType high;
+      };
+
+      std::vector<BoundType> _bases;
+      std::vector<std::uint32_t> _offsets;
+      std::vector<std::uint32_t> _lengths;
+      std::vector<std::uint32_t> _spans;
+      std::vector<Escaped> _escaped;
+
+      static inline Unsigned distance(const BoundType &from, const BoundType &to) { return Unsigned(to) - Unsigned(from); }
+
+      const Escaped &escaped(std::size_t index) const {
+         return *std::lower_bound(this->_escaped.begin(), this->_escaped.end(), index, [](const Escaped &entry, std::size_t index) {
+            return entry.index < index;
+         });
+      }
+
+   public:
+      void reserve(std::size_t count) {
+         this->_bases.reserve((count + BlockSize - 1) / BlockSize);
+         this->_offsets.reserve(count);
+         this->_lengths.reserve(count);
+         this->_spans.reserve(count);
+      }
+
+      // Keys must arrive sorted by low, so every offset from the block base is non-negative.
+      void push_back(const BoundType &low, const BoundType &high) {
+         auto index = this->_offsets.size();
+
+         if (index % BlockSize == 0) { this->_bases.push_back(low); }
+
+         auto offset = distance(this->_bases.back(), low);
+         auto length = distance(low, high);
+
+         if (offset >= Escape || length >= Escape)
+         {
+            this->_offsets.push_back(Escape);
+            this->_lengths.push_back(Escape);
+            this->_escaped.push_back({index, low, high});
+         }
+         else
+         {
+            this->_offsets.push_back(static_cast<std::uint32_t>(offset));
+            this->_lengths.push_back(static_cast<std::uint32_t>(length));
+         }
+
+         this->_spans.push_back(static_cast<std::uint32_t>(std::min<Unsigned>(length, Escape)));
+      }
+
+      inline std::size_t size() const { return this->_offsets.size(); }
+
+      inline BoundType low(std::size_t index) const {
+         if (this->_offsets[index] == Escape) { return this->escaped(index).low; }
+
+         return static_cast<BoundType>(Unsigned(this->_bases[index / BlockSize]) + this->_offsets[index]);
+      }
+
+      inline BoundType high(std::size_t index) const {
+         if (this->_offsets[index] == Escape) { return this->escaped(index).high; }
+
+         return static_cast<BoundType>(Unsigned(this->low(index)) + this->_lengths[index]);
+      }
+
+      inline BoundType max(std::size_t index) const {
+         if (this->_spans[index] == Escape) { return std::numeric_limits<BoundType>::max(); }
+
+         return static_cast<BoundType>(Unsigned(this->low(index)) + this->_spans[index]);
+      }
+
+      inline void set_max(std::size_t index, const BoundType &max) {
+         this->_spans[index] = static_cast<std::uint32_t>(std::min<Unsigned>(distance(this->low(index), max), Escape));
+      }
+
+      inline std::size_t escaped_count() const { return this->_escaped.size(); }
+   };
+
+   struct WideKeys
+   {
+      template <typename BoundType>
+      using Columns = WideKeyColumns<BoundType>;
+   };
+
+   struct CompactKeys
+   {
+      template <typename BoundType>
+      using Columns = CompactKeyColumns<BoundType>;
+   };
+
+   namespace detail
+   {
+      /* Fills in max(i) for the implicit tree over sorted key columns (see FrozenIntervalIndex).
+       * Columns provides size(), high(i), max(i) and set_max(i, max), with every max(i) starting
+       * out as high(i). Returns the root level, or -1 when there are no keys.
+       */
+      template <typename Columns>
+      int index_implicit(Columns &columns) {
+         using BoundType = decltype(columns.high(0));
+
+         auto n = columns.size();
+         if (n == 0) { return -1; }
+
+         std::size_t last_index = 0;
+         BoundType last = columns.high(0);
+
+         for (std::size_t i = 0; i < n; i += 2)
+         {
+            last_index = i;
+            last = columns.max(i);
+         }
+
+         int level = 1;
+
+         for (; (std::size_t(1) << level) <= n; ++level)
+         {
+            std::size_t half = std::size_t(1) << (level - 1);
+            std::size_t step = half << 2;
+
+            for (std::size_t i = (half << 1) - 1; i < n; i += step)
+            {
+               auto left_max = columns.max(i - half);
+               auto right_max = (i + half < n) ? columns.max(i + half) : last;
+               auto max = columns.high(i);
+
+               if (max < left_max) { max = left_max; }
+               if (max < right_max) { max = right_max; }
+
+               columns.set_max(i, max);
+            }
+
+            last_index = ((last_index >> level) & 1) ? last_index - half : last_index + half;
+
+            if (last_index < n && last < columns.max(last_index))
+               last = columns.max(last_index);
+         }
+
+         return level - 1;
+      }
+
+      // Whether interval spans every key of an implicit tree; the root max is the highest high.
+      template <typename IntervalType, typename Columns>
+      bool spans_implicit(const Columns &columns, int max_level, const IntervalType &interval) {
+         if (columns.size() == 0) { return false; }
+
+         return spans_keys(interval, columns.low(0), columns.max((std::size_t(1) << max_level) - 1));
+      }
+
+      // Calls match(i) for every matching index in key order; stops early when it returns false.
+      template <typename IntervalType, typename Columns, typename Query, typename Match>
+      bool visit_implicit(const Columns &columns, int max_level, const Query &query, Match &match) {
+         struct Frame { std::size_t index; int level; bool left_done; };
+
+         const int LinearScanLevel = 3;
+         auto n = columns.size();
+         if (n == 0) { return true; }
+
+         auto key = [&columns](std::size_t index) {
+            IntervalType key;
+            key.low = columns.low(index);
+            key.high = columns.high(index);
+
+            return key;
+         };
+
+         Frame stack[2 * (sizeof(std::size_t) * 8) + 2];
+         int top = 0;
+
+         stack[top++] = { (std::size_t(1) << max_level) - 1, max_level, false };
+
+         while (top > 0)
+         {
+            auto frame = stack[--top];
+
+            if (frame.level <= LinearScanLevel)
+            {
+               auto first = (frame.index >> frame.level) << frame.level;
+               auto last = std::min(first + (std::size_t(1) << (frame.level + 1)) - 1, n);
+
+               for (auto i = first; i < last; ++i)
+               {
+                  auto current = key(i);
+
+                  if (!query.may_match_after(current)) { return true; }
+                  if (query.matches(current) && !match(i)) { return false; }
+               }
+            }
+            else if (!frame.left_done)
+            {
+               auto left = frame.index - (std::size_t(1) << (frame.level - 1));
+
+               stack[top++] = { frame.index, frame.level, true };
+
+               if (frame.index < n && !query.may_match_before(key(frame.index))) { continue; }
+               if (left >= n || query.may_match_below(columns.max(left)))
+                  stack[top++] = { left, frame.level - 1, false };
+            }
+            else if (frame.index < n)
+            {
+               auto current = key(frame.index);
+               auto right = frame.index + (std::size_t(1) << (frame.level - 1));
+
+               if (!query.may_match_after(current)) { return true; }
+               if (query.matches(current) && !match(frame.index)) { return false; }
+               if (right >= n || query.may_match_below(columns.max(right)))
+                  stack[top++] = { right, frame.level - 1, false };
+            }
+         }
+
+         return true;
+      }
+   }
+
+   /* A read-only snapshot of a tree laid out as sorted structure-of-arrays columns. The sorted
+    * array doubles as an implicit balanced tree: index i sits at level ctz(~i), its children are
+    * i -/+ 2^(level-1), and max(i) holds the largest high in that implicit subtree. Queries walk
+    * it with a small index stack and scan subtrees of 15 entries or fewer linearly. Keys picks the
+    * column layout: WideKeys, or CompactKeys for integral bounds.
+    */
+   template <typename IntervalType, typename Value=void, typename Keys=WideKeys>
+   class FrozenIntervalIndex
+   {
+      static_assert(std::is_base_of<Interval<typename IntervalType::ValueType, IntervalType::Inclusive>, IntervalType>::value,
+                    "IntervalType template argument must derive the Interval structure.");
+
+   public:
+      using BoundType = typename IntervalType::ValueType;
+      using SetType = std::set<IntervalType, typename IntervalType::Compare>;
+      struct NoValue {};
+      using MappedType = typename std::conditional<std::is_void<Value>::value, NoValue, Value>::type;
+      using ColumnsType = typename Keys::template Columns<BoundType>;
+
+   protected:
+      ColumnsType _keys;
+      std::vector<MappedType> _values;
+      int _max_level;
+      // Kept apart from the root max, which CompactKeys may saturate.
+      BoundType _highest;
+
+      void index() {
+         this->_max_level = detail::index_implicit(this->_keys);
+         this->_highest = BoundType();
+
+         for (std::size_t index = 0; index < this->_keys.size(); ++index)
+            if (index == 0 || this->_highest < this->_keys.high(index)) { this->_highest = this->_keys.high(index); }
+      }
+
+      inline bool spanned_by(const IntervalType &interval) const {
+         return this->_keys.size() != 0 && detail::spans_keys(interval, this->_keys.low(0), this->_highest);
+      }
+
+      void assign_sorted(const std::vector<IntervalType> &keys) {
+         this->_keys.reserve(keys.size());
+
+         for (auto &key : keys)
+            this->_keys.push_back(key.low, key.high);
+      }
+
+      template <typename Visitor>
+      inline bool invoke(Visitor &visitor, std::size_t index) const {
+         auto key = this->key(index);
+
+         if constexpr (std::is_void<Value>::value) { return detail::invoke_visitor(visitor, key); }
+         else
+         {
+            auto &value = this->_values[index];
+
+            if constexpr (std::is_void<decltype(visitor(key, value))>::value) { visitor(key, value); return true; }
+            else { return static_cast<bool>(visitor(key, value)); }
+         }
+      }
+
+      template <typename Query, typename Visitor>
+      bool visit(const Query &query, Visitor &visitor) const {
+         auto invoke = [this, &visitor](std::size_t index) { return this->invoke(visitor, index); };
+         return detail::visit_implicit<IntervalType>(this->_keys, this->_max_level, query, invoke);
+      }
+
+      template <typename Query>
+      SetType collect(const Query &query) const {
+         auto result = SetType();
+         auto insert = [&result](const IntervalType &key, auto &&...) { result.insert(key); };
+
+         this->visit(query, insert);
+
+         return result;
+      }
+
+   public:
+      FrozenIntervalIndex() : _max_level(-1), _highest() {}
+
+      // Keys may arrive in any order; duplicates keep their first value.
+      template <typename V=Value, typename std::enable_if<std::is_void<V>::value, int>::type = 0>
+      FrozenIntervalIndex(std::vector<IntervalType> keys) : _max_level(-1) {
+         auto compare = typename IntervalType::Compare();
+
+         std::sort(keys.begin(), keys.end(), compare);
+         keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+         this->assign_sorted(keys);
+         this->index();
+      }
+
+      template <typename V=Value, typename std::enable_if<!std::is_void<V>::value, int>::type = 0>
+      FrozenIntervalIndex(const std::vector<std::pair<IntervalType, V>> &entries) : _max_level(-1) {
+         auto compare = typename IntervalType::Compare();
+         std::vector<std::size_t> order(entries.size());
+         std::vector<IntervalType> keys;
+
+         std::iota(order.begin(), order.end(), 0);
+         std::stable_sort(order.begin(), order.end(), [&](std::size_t left, std::size_t right) {
+            return compare(entries[left].first, entries[right].first);
+         });
+
+         keys.reserve(entries.size());
+         this->_values.reserve(entries.size());
+
+         for (auto index : order)
+         {
+            if (!keys.empty() && keys.back() == entries[index].first) { continue; }
+
+            keys.push_back(entries[index].first);
+            this->_values.push_back(entries[index].second);
+         }
+
+         this->assign_sorted(keys);
+         this->index();
+      }
+
+      // Builds from any tree in this library; its in-order walk is already sorted.
+      template <typename Tree, typename = decltype(std::declval<const Tree &>().root_node())>
+      explicit FrozenIntervalIndex(const Tree &tree) : _max_level(-1) {
+         tree.for_each_value([this](const typename Tree::ValueType &value) {
+            if constexpr (std::is_void<Value>::value) { this->_keys.push_back(value.low, value.high); }
+            else
+            {
+               this->_keys.push_back(value.first.low, value.first.high);
+               this->_values.push_back(value.second);
+            }
+         });
+
+         this->index();
+      }
+
+      inline std::size_t size() const { return this->_keys.size(); }
+      inline bool empty() const { return this->_keys.size() == 0; }
+
+      inline IntervalType key(std::size_t index) const {
+         IntervalType key;
+         key.low = this->_keys.low(index);
+         key.high = this->_keys.high(index);
+
+         return key;
+      }
+
+      template <typename V=Value, typename std::enable_if<!std::is_void<V>::value, int>::type = 0>
+      inline const V &value(std::size_t index) const { return this->_values[index]; }
+
+      inline const ColumnsType &columns() const { return this->_keys; }
+      // Wide columns only; CompactKeys stores offsets, read through columns() or key().
+      template <typename K=Keys, typename std::enable_if<std::is_same<K, WideKeys>::value, int>::type = 0>
+      inline const std::vector<BoundType> &lows() const { return this->_keys.lows(); }
+      template <typename K=Keys, typename std::enable_if<std::is_same<K, WideKeys>::value, int>::type = 0>
+      inline const std::vector<BoundType> &highs() const { return this->_keys.highs(); }
+
+      SetType containing_point(const BoundType &point) const {
+         return this->collect(detail::ContainingPointQuery<IntervalType>{point});
+      }
+
+      SetType containing_interval(const IntervalType &interval) const {
+         return this->collect(detail::ContainingIntervalQuery<IntervalType>{interval});
+      }
+
+      // Returns every key when interval spans them all, as IntervalTree does.
+      SetType overlapping_interval(const IntervalType &interval) const {
+         if (this->spanned_by(interval)) { return this->collect(detail::ContainedByIntervalQuery<IntervalType>{interval}); }
+
+         return this->collect(detail::OverlappingIntervalQuery<IntervalType>{interval});
+      }
+
+      SetType contained_by_interval(const IntervalType &interval) const {
+         return this->collect(detail::ContainedByIntervalQuery<IntervalType>{interval});
+      }
+
+      // Visitors receive (key) for a frozen tree and (key, value) for a frozen map.
+      template <typename Visitor>
+      bool for_each_containing_point(const BoundType &point, Visitor &&visitor) const {
+         return this->visit(detail::ContainingPointQuery<IntervalType>{point}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_interval(const IntervalType &interval, Visitor &&visitor) const {
+         return this->visit(detail::ContainingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_overlapping_interval(const IntervalType &interval, Visitor &&visitor) const {
+         if (this->spanned_by(interval)) { return this->visit(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor); }
+
+         return this->visit(detail::OverlappingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_contained_by_interval(const IntervalType &interval, Visitor &&visitor) const {
+         return this->visit(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor);
+      }
+   };
+
+   template <typename Keys=WideKeys, typename IntervalType, typename Storage>
+   FrozenIntervalIndex<IntervalType, void, Keys> freeze(const IntervalTree<IntervalType, Storage> &tree) {
+      return FrozenIntervalIndex<IntervalType, void, Keys>(tree);
+   }
+
+   template <typename Keys=WideKeys, typename IntervalType, typename Value, typename Storage>
+   FrozenIntervalIndex<IntervalType, Value, Keys> freeze(const IntervalMap<IntervalType, Value, Storage> &map) {
+      return FrozenIntervalIndex<IntervalType, Value, Keys>(map);
+   }
+}
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef __INTERVALSET_H
+#define __INTERVALSET_H
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <intervaltree.hpp>
+
+namespace intervaltree
+{
+   /* A set of points kept as disjoint intervals. insert() merges every interval the new one
+    * overlaps (or touches, under Coalesce::Adjacent) into a single node, and erase() cuts a span
+    * out, trimming or splitting the intervals it falls across. Disjoint intervals in key order are
+    * also in order of high, so the first affected interval is one descent away and the rest follow
+    * it as one run, which is cut out with a single split and join: O(log n + k), with no temporary
+    * sets. Empty exclusive intervals hold no points and are ignored.
+    */
+   template <typename IntervalType, typename Nodes=ArenaNodes<>>
+   class IntervalSet : public ArenaIntervalTreeBase<IntervalType, IntervalType, avltree::KeyIsValue<IntervalType>, Nodes>
+   {
+   public:
+      using BaseType = ArenaIntervalTreeBase<IntervalType, IntervalType, avltree::KeyIsValue<IntervalType>, Nodes>;
+      using IntervalNode = typename BaseType::IntervalNode;
+      using iterator = typename BaseType::const_iterator;
+
+   protected:
+      Coalesce _coalesce;
+
+      static inline bool empty_interval(const IntervalType &interval) {
+         return !IntervalType::Inclusive && interval.low == interval.high;
+      }
+
+      // True when left lies wholly before right and the two stay separate intervals.
+      inline bool separated(const IntervalType &left, const IntervalType &right) const {
+         auto adjacent = (this->_coalesce == Coalesce::Adjacent);
+
+         if constexpr (IntervalType::Inclusive) { return left.high < right.low && !(adjacent && right.low - left.high == 1); }
+         else { return left.high < right.low || (left.high == right.low && !adjacent); }
+      }
+
+      // True when left ends before the first point of right.
+      static inline bool ends_before(const IntervalType &left, const IntervalType &right) {
+         if constexpr (IntervalType::Inclusive) { return left.high < right.low; }
+         else { return left.high <= right.low; }
+      }
+
+      // What erase() leaves of key below and above interval.
+      static inline IntervalType left_of(const IntervalType &key, const IntervalType &interval) {
+         if constexpr (IntervalType::Inclusive) { return IntervalType(key.low, interval.low - 1); }
+         else { return IntervalType(key.low, interval.low); }
+      }
+
+      static inline IntervalType right_of(const IntervalType &key, const IntervalType &interval) {
+         if constexpr (IntervalType::Inclusive) { return IntervalType(interval.high + 1, key.high); }
+         else { return IntervalType(interval.high, key.high); }
+      }
+
+      // The leftmost node for which skip() is false; skip() must hold for a prefix of the set.
+      template <typename Skip>
+      IntervalNode *first_node(Skip skip) {
+         IntervalNode *node = this->root_node();
+         IntervalNode *found = nullptr;
+
+         while (node != nullptr)
+         {
+            if (skip(node->key())) { node = node->right_node(); }
+            else
+            {
+               found = node;
+               node = node->left_node();
+            }
+         }
+
+         return found;
+      }
+
+   public:
+      explicit IntervalSet(Coalesce coalesce=Coalesce::Overlapping) : BaseType(), _coalesce(coalesce) {}
+      template <typename Iterator>
+      IntervalSet(Iterator first, Iterator last, Coalesce coalesce=Coalesce::Overlapping) : BaseType(), _coalesce(coalesce) {
+         this->bulk_insert(first, last);
+      }
+      IntervalSet(const std::vector<IntervalType> &intervals, Coalesce coalesce=Coalesce::Overlapping)
+         : IntervalSet(intervals.begin(), intervals.end(), coalesce) {}
+
+      inline Coalesce coalesce() const { return this->_coalesce; }
+
+      iterator begin() const { return iterator(this->root()); }
+      iterator end() const { return iterator(nullptr); }
+      iterator cbegin() const { return this->begin(); }
+      iterator cend() const { return this->end(); }
+
+      // Returns the node now covering interval, or nullptr when interval is empty.
+      IntervalNode *insert(const IntervalType &interval) {
+         if (empty_interval(interval)) { return nullptr; }
+
+         auto node = this->first_node([&](const IntervalType &key) { return this->separated(key, interval); });
+         if (node == nullptr || this->separated(interval, node->key())) { return BaseType::insert(interval); }
+
+         auto merged = node->key().join(interval);
+         auto last = node;
+         std::size_t absorbed = 0;
+
+         for (auto next = detail::next_node(node); next != nullptr && !this->separated(merged, next->key()); next = detail::next_node(next))
+         {
+            merged = merged.join(next->key());
+            last = next;
+            ++absorbed;
+         }
+
+         if (absorbed > 0)
+         {
+            auto first_key = detail::next_node(node)->key();
+            auto last_key = last->key();
+
+            this->erase_run(first_key, last_key, absorbed);
+         }
+
+         if (merged != node->key()) { node = this->rekey(node, merged); }
+
+         return node;
+      }
+
+      // Removes every point of interval from the set. Returns whether anything was removed.
+      bool erase(const IntervalType &interval) {
+         if (empty_interval(interval)) { return false; }
+
+         auto head = this->first_node([&](const IntervalType &key) { return ends_before(key, interval); });
+         if (head == nullptr || ends_before(interval, head->key())) { return false; }
+
+         auto tail = head;
+         std::size_t count = 1;
+
+         for (auto next = detail::next_node(tail); next != nullptr && !ends_before(interval, next->key()); next = detail::next_node(next))
+         {
+            tail = next;
+            ++count;
+         }
+
+         auto keep_left = head->key().low < interval.low;
+         auto keep_right = interval.high < tail->key().high;
+
+         if (head == tail)
+         {
+            auto key = head->key();
+
+            if (keep_left) { this->rekey(head, left_of(key, interval)); }
+            if (keep_right)
+            {
+               if (keep_left) { BaseType::insert(right_of(key, interval)); }
+               else { this->rekey(head, right_of(key, interval)); }
+            }
+
+            if (!keep_left && !keep_right) { this->erase_node(head); }
+
+            return true;
+         }
+
+         // Only head and tail can keep a piece; the intervals between are covered whole.
+         auto covered = count - (keep_left ? 1 : 0) - (keep_right ? 1 : 0);
+
+         if (covered > 0)
+         {
+            auto first_key = (keep_left ? detail::next_node(head) : head)->key();
+            auto last_key = (keep_right ? detail::prev_node(tail) : tail)->key();
+
+            this->erase_run(first_key, last_key, covered);
+         }
+
+         if (keep_left) { this->rekey(head, left_of(head->key(), interval)); }
+         if (keep_right) { this->rekey(tail, right_of(tail->key(), interval)); }
+
+         return true;
+      }
+
+      // The interval holding point, if any.
+      const IntervalType *find(const typename IntervalType::ValueType &point) const {
+         auto node = this->root_node();
+
+         while (node != nullptr)
+         {
+            if (node->key().contains(point)) { return &node->key(); }
+
+            node = (point < node->key().low) ? node->left_node() : node->right_node();
+         }
+
+         return nullptr;
+      }
+
+      inline bool contains_point(const typename IntervalType::ValueType &point) const { return this->find(point) != nullptr; }
+
+      // Joins as the base tree does, then merges across the seam if the two sides overlap or touch there.
+      void join(IntervalSet &&right) {
+         auto seam = right.root_node();
+         if (seam == nullptr || &right == this) { return; }
+
+         while (seam->left_node() != nullptr)
+            seam = seam->left_node();
+
+         auto key = seam->key();
+
+         BaseType::join(std::move(right));
+         this->insert(key);
+      }
+
+      // An empty set is normalized in one linear pass (after a sort unless the input is already sorted);
+      // otherwise values are merged one at a time.
+      template <typename Iterator>
+      void bulk_insert(Iterator first, Iterator last) {
+         if (this->root() != nullptr)
+         {
+            for (; first != last; ++first)
+               this->insert(*first);
+
+            return;
+         }
+
+         std::vector<IntervalType> intervals(first, last);
+
+         if (!std::is_sorted(intervals.begin(), intervals.end(), typename IntervalType::Compare()))
+            std::sort(intervals.begin(), intervals.end(), typename IntervalType::Compare());
+         intervals = this->normalize_sorted(intervals.begin(), intervals.end());
+
+         BaseType::bulk_insert(std::move(intervals), BulkOrder::Trusted);
+      }
+
+      // Coalesces intervals already in Interval::Compare order in one pass, without a tree.
+      template <typename Iterator>
+      std::vector<IntervalType> normalize_sorted(Iterator first, Iterator last) const {
+         std::vector<IntervalType> result;
+
+         for (; first != last; ++first)
+         {
+            if (empty_interval(*first)) { continue; }
+
+            if (!result.empty() && !this->separated(result.back(), *first)) { result.back() = result.back().join(*first); }
+            else { result.push_back(*first); }
+         }
+
+         return result;
+      }
+
+      IntervalNode *add_node(const IntervalType &interval) = delete;
+   };
+
+   // Linear in the size of tree: its in-order walk is already sorted.
+   template <typename IntervalType, typename Storage>
+   IntervalSet<IntervalType> normalize(const IntervalTree<IntervalType, Storage> &tree, Coalesce coalesce=Coalesce::Overlapping) {
+      auto set = IntervalSet<IntervalType>(coalesce);
+
+      set.bulk_insert(tree.begin(), tree.end());
+
+      return set;
+   }
+}
+
+#endif
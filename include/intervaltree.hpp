@@ -1,8 +1,26 @@
 #ifndef __INTERVALTREE_H
 #define __INTERVALTREE_H
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
 #include <set>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <avltree.hpp>
 
@@ -10,6 +28,25 @@ namespace intervaltree
 {
    namespace exception {
       using namespace avltree::exception;
+
+      // A KeyNotFound, so handlers written for the shared engine also catch it from the other containers.
+      class IntervalNotFound : public KeyNotFound
+      {
+      public:
+         const char *what() const noexcept { return "Interval not found in tree."; }
+      };
+
+      class IndexOutOfRange : public std::exception
+      {
+      public:
+         const char *what() const noexcept { return "Index is past the end of the tree."; }
+      };
+
+      class JoinOutOfOrder : public std::exception
+      {
+      public:
+         const char *what() const noexcept { return "Every interval of the left tree must sort before those of the right tree."; }
+      };
    }
 
    template<typename Key, typename Value, typename KeyOfValue, typename KeyCompare>
@@ -29,7 +66,11 @@ namespace intervaltree
          if (low < high) { this->low = low; this->high = high; }
          else { this->low = high; this->high = low; }
       }
-      Interval(const Interval &other) : low(other.low), high(other.high) {}
+      Interval(const Interval &other) = default;
+      Interval(Interval &&other) = default;
+
+      Interval &operator=(const Interval &other) = default;
+      Interval &operator=(Interval &&other) = default;
 
       struct Compare {
          bool operator() (const Interval &left, const Interval &right) const {
@@ -87,349 +128,3581 @@ namespace intervaltree
       }
    };
 
-   template <typename IntervalType, typename ValueType, typename KeyOfValue>
-   class IntervalTreeBase : public AVLTreeBase<IntervalType, ValueType, KeyOfValue, typename IntervalType::Compare>
+   enum class Coalesce
    {
-      static_assert(std::is_base_of<Interval<typename IntervalType::ValueType, IntervalType::Inclusive>, IntervalType>::value,
-                    "IntervalType template argument must derive the Interval structure.");
-      
-   public:
-      using SetType = std::set<IntervalType, typename IntervalType::Compare>;
-      
-      class IntervalNode : public AVLTreeBase::Node
-      {
-      protected:
-         typename IntervalType::ValueType _max;
+      Overlapping, // intervals sharing at least one point become one
+      Adjacent     // touching intervals ([0,5) and [5,9), or [0,4] and [5,9]) are joined as well
+   };
 
-      public:
-         friend class IntervalTreeBase;
-         
-         IntervalNode() : _max(0), AVLTreeBase::Node() {}
-         IntervalNode(const typename AVLTreeBase::ValueType &value) : _max(KeyOfValue()(value).high), AVLTreeBase::Node(value) {}
-         IntervalNode(const IntervalNode &other) : _max(other._max), AVLTreeBase::Node(other) {}
+   enum class BulkOrder
+   {
+      Unsorted, // stably sorted and deduplicated (first occurrence wins) before building
+      Checked,  // verified in one pass, falling back to Unsorted when out of order
+      Trusted   // caller guarantees strictly increasing Interval::Compare order
+   };
 
-         virtual void copy_node_data(const typename AVLTreeBase::Node &node) {
-            AVLTreeBase::Node::copy_node_data(node);
+   // Thread count for the parallel overloads; 0 picks std::thread::hardware_concurrency().
+   struct Parallel
+   {
+      std::size_t threads;
 
-            auto int_node = dynamic_cast<const IntervalNode &>(node);
-            this->_max = int_node._max;
-         }
-         
-         inline typename IntervalType::ValueType &max() { return this->_max; }
-         inline const typename IntervalType::ValueType &max() const { return this->_max; }
-         typename IntervalType::ValueType new_max() const {
-            auto left = std::dynamic_pointer_cast<const IntervalNode>(this->left());
-            auto right = std::dynamic_pointer_cast<const IntervalNode>(this->right());
+      explicit Parallel(std::size_t threads=0) : threads(threads) {}
 
-            auto left_max = (left != nullptr) ? left->max() : this->key().high;
-            auto right_max = (right != nullptr) ? right->max() : this->key().high;
+      inline std::size_t count() const {
+         if (this->threads != 0) { return this->threads; }
 
-            return std::max(this->key().high, std::max(left_max, right_max));
-         }
-      };
+         auto hardware = static_cast<std::size_t>(std::thread::hardware_concurrency());
+         return (hardware == 0) ? 1 : hardware;
+      }
+   };
 
-   protected:
-      void update_max(typename AVLTreeBase::SharedNode node) {
-         typename AVLTreeBase::SharedNode update = node;
+   // Counters of one query, passed to the trace hook (see IntervalQueries::set_query_trace).
+   struct QueryStats
+   {
+      const char *query;
+      std::uint64_t nodes_visited;
+      std::uint64_t nodes_pruned;
+      std::uint64_t hits;
+   };
 
-         while (update != nullptr)
-         {
-            auto int_node = std::static_pointer_cast<IntervalNode>(update);
-            int_node->_max = int_node->new_max();
+   // Counters accumulated by a tree since construction or the last reset_stats().
+   struct TreeStats
+   {
+      std::uint64_t queries;
+      std::uint64_t nodes_visited;
+      std::uint64_t nodes_pruned;
+      std::uint64_t hits;
+      std::uint64_t rotations;
+      std::uint64_t max_updates;
+      std::uint64_t allocations;
+      std::size_t height;
+   };
 
-            auto parent = std::static_pointer_cast<IntervalNode>(int_node->parent());
+   /* Bytes held by a tree, from memory_usage(). Every node costs node_size: its key, the rest of
+    * its value (mapped value and pair padding; zero for sets) and overhead (links, augmentation,
+    * padding, the vtable pointer and make_shared control block of the shared engine). slack_bytes
+    * is what the allocator holds beyond the nodes: free and never-used arena slots, or for
+    * per-node allocations an estimate of the allocator's header and rounding. Memory that values
+    * own themselves is not counted.
+    */
+   struct MemoryUsage
+   {
+      std::size_t nodes;
+      std::size_t node_size;
+      std::size_t key_bytes;
+      std::size_t value_bytes;
+      std::size_t overhead_bytes;
+      std::size_t slack_bytes;
+
+      inline std::size_t node_bytes() const { return this->nodes * this->node_size; }
+      inline std::size_t total_bytes() const { return this->node_bytes() + this->slack_bytes; }
+   };
 
-            if (parent != nullptr && parent->max() != int_node->max())
-               update = parent;
-            else
-               update = nullptr;
-         }
-      }
+   namespace detail
+   {
+      // A one-word header and 16-byte rounding, as the common malloc implementations do; an estimate.
+      constexpr std::size_t heap_block_size(std::size_t size) {
+         auto granule = 2 * sizeof(void *);
+         auto block = (size + sizeof(void *) + granule - 1) / granule * granule;
 
-      virtual void rotate_left(typename AVLTreeBase::SharedNode node) {
-         AVLTreeBase::rotate_left(node);
-         this->update_max(node);
+         return (block < 2 * granule) ? 2 * granule : block;
       }
 
-      virtual void rotate_right(typename AVLTreeBase::SharedNode node) {
-         AVLTreeBase::rotate_right(node);
-         this->update_max(node);
+      // make_shared puts a vtable pointer and two reference counts ahead of the object.
+      template <typename Object>
+      constexpr std::size_t shared_block_size() {
+         auto header = sizeof(void *) + 2 * sizeof(std::int32_t);
+
+         return (header + alignof(Object) - 1) / alignof(Object) * alignof(Object) + sizeof(Object);
       }
 
-      virtual typename AVLTreeBase::SharedNode allocate_node(const typename AVLTreeBase::ValueType &value) {
-         auto node = std::make_shared<IntervalNode>(value);
+      template <typename IntervalType, typename ValueType>
+      MemoryUsage memory_usage(std::size_t nodes, std::size_t node_size, std::size_t held_bytes) {
+         MemoryUsage usage;
 
-         return node;
+         usage.nodes = nodes;
+         usage.node_size = node_size;
+         usage.key_bytes = nodes * sizeof(IntervalType);
+         usage.value_bytes = nodes * (sizeof(ValueType) - sizeof(IntervalType));
+         usage.overhead_bytes = usage.node_bytes() - usage.key_bytes - usage.value_bytes;
+         usage.slack_bytes = held_bytes - usage.node_bytes();
+
+         return usage;
       }
+      enum class Visit { Continue, Exhausted, Stopped };
+      enum class BoundOp { Less, LessEqual, Greater, GreaterEqual };
 
-      virtual typename AVLTreeBase::SharedNode copy_node(typename AVLTreeBase::ConstSharedNode node) {
-         auto upcast_node = std::static_pointer_cast<const IntervalNode>(node);
-         auto new_node = std::make_shared<IntervalNode>(*upcast_node);
+      template <typename BoundType>
+      struct BoundTest
+      {
+         BoundOp op;
+         BoundType value;
+      };
 
-         return new_node;
+      template <typename Visitor, typename Value>
+      inline bool invoke_visitor(Visitor &visitor, Value &value) {
+         if constexpr (std::is_void<decltype(visitor(value))>::value) { visitor(value); return true; }
+         else { return static_cast<bool>(visitor(value)); }
       }
 
-      virtual void update_node(typename AVLTreeBase::SharedNode node) {
-         this->update_max(node);
-         return AVLTreeBase::update_node(node);
-      }
+      /* Each query describes how a traversal may be pruned:
+       *   may_match_below  -- whether a subtree with the given max can hold a hit
+       *   may_match_before -- whether the key or anything sorted before it can be a hit
+       *   may_match_after  -- whether the key or anything sorted after it can be a hit
+       * low_test, high_test and max_test restate matches() and may_match_below() as single
+       * comparisons against a bound so that columns of bounds can be tested in bulk.
+       */
+      template <typename IntervalType>
+      struct ContainingPointQuery
+      {
+         static constexpr const char *name = "containing_point";
 
-   public:
-      IntervalTreeBase() : AVLTreeBase() {}
-      IntervalTreeBase(std::vector<IntervalType> &nodes) : AVLTreeBase(nodes) {}
-      IntervalTreeBase(const IntervalTreeBase &other) : AVLTreeBase(other) {}
+         typename IntervalType::ValueType point;
 
-      std::shared_ptr<IntervalNode> insert(const ValueType &value) {
-         return std::static_pointer_cast<IntervalNode>(AVLTreeBase::insert(value));
-      }
-         
-      SetType containing_point(const typename IntervalType::ValueType &point) const {
-         auto result = SetType();
-         if (this->root() == nullptr) { return result; }
+         inline bool matches(const IntervalType &key) const { return key.contains(this->point); }
+         inline bool may_match_below(const typename IntervalType::ValueType &max) const {
+            if constexpr (IntervalType::Inclusive) { return this->point <= max; }
+            else { return this->point < max; }
+         }
+         inline bool may_match_before(const IntervalType &) const { return true; }
+         inline bool may_match_after(const IntervalType &key) const { return key.low <= this->point; }
 
-         std::vector<typename AVLTreeBase::ConstSharedNode> traversal = { this->root() };
+         using Test = BoundTest<typename IntervalType::ValueType>;
+         inline Test low_test() const { return { BoundOp::LessEqual, this->point }; }
+         inline Test high_test() const { return { IntervalType::Inclusive ? BoundOp::GreaterEqual : BoundOp::Greater, this->point }; }
+         inline Test max_test() const { return this->high_test(); }
+      };
 
-         while (traversal.size() > 0)
-         {
-            auto node = traversal.front();
-            traversal.erase(traversal.begin());
-            if (node == nullptr) { continue; }
+      template <typename IntervalType>
+      struct ContainingIntervalQuery
+      {
+         static constexpr const char *name = "containing_interval";
 
-            auto int_node = std::static_pointer_cast<const IntervalNode>(node);
+         IntervalType interval;
 
-            if (int_node->key().contains(point))
-               result.insert(int_node->key());
-            
-            if constexpr (IntervalType::Inclusive)
-            {
-               if (point <= int_node->max())
-                  traversal.push_back(int_node->left());
-            }
-            else {
-               if (point < int_node->max())
-                  traversal.push_back(int_node->left());
-            }
+         inline bool matches(const IntervalType &key) const { return key.contains(this->interval); }
+         inline bool may_match_below(const typename IntervalType::ValueType &max) const { return this->interval.high <= max; }
+         inline bool may_match_before(const IntervalType &) const { return true; }
+         inline bool may_match_after(const IntervalType &key) const { return key.low <= this->interval.low; }
+
+         using Test = BoundTest<typename IntervalType::ValueType>;
+         inline Test low_test() const { return { BoundOp::LessEqual, this->interval.low }; }
+         inline Test high_test() const { return { BoundOp::GreaterEqual, this->interval.high }; }
+         inline Test max_test() const { return this->high_test(); }
+      };
+
+      template <typename IntervalType>
+      struct OverlappingIntervalQuery
+      {
+         static constexpr const char *name = "overlapping_interval";
+
+         IntervalType interval;
 
-            if (point >= int_node->key().low)
-               traversal.push_back(int_node->right());
+         inline bool matches(const IntervalType &key) const { return key.overlaps(this->interval); }
+         inline bool may_match_below(const typename IntervalType::ValueType &max) const {
+            if constexpr (IntervalType::Inclusive) { return this->interval.low <= max; }
+            else { return this->interval.low < max; }
+         }
+         inline bool may_match_before(const IntervalType &) const { return true; }
+         inline bool may_match_after(const IntervalType &key) const {
+            if constexpr (IntervalType::Inclusive) { return key.low <= this->interval.high; }
+            else { return key.low < this->interval.high; }
          }
 
-         return result;
-      }
+         using Test = BoundTest<typename IntervalType::ValueType>;
+         inline Test low_test() const { return { IntervalType::Inclusive ? BoundOp::LessEqual : BoundOp::Less, this->interval.high }; }
+         inline Test high_test() const { return { IntervalType::Inclusive ? BoundOp::GreaterEqual : BoundOp::Greater, this->interval.low }; }
+         inline Test max_test() const { return this->high_test(); }
+      };
 
-      SetType containing_interval(const IntervalType &interval) const {
-         auto result = SetType();
-         if (this->root() == nullptr) { return result; }
-         std::vector<typename AVLTreeBase::ConstSharedNode> traversal = { this->root() };
+      template <typename IntervalType>
+      struct ContainedByIntervalQuery
+      {
+         static constexpr const char *name = "contained_by_interval";
 
-         while (traversal.size() > 0)
-         {
-            auto node = traversal.front();
-            traversal.erase(traversal.begin());
-            if (node == nullptr) { continue; }
+         IntervalType interval;
 
-            auto int_node = std::static_pointer_cast<const IntervalNode>(node);
+         inline bool matches(const IntervalType &key) const { return key.contained_by(this->interval); }
+         inline bool may_match_below(const typename IntervalType::ValueType &max) const { return this->interval.low <= max; }
+         inline bool may_match_before(const IntervalType &key) const { return key.low >= this->interval.low; }
+         inline bool may_match_after(const IntervalType &key) const { return key.low <= this->interval.high; }
 
-            if (int_node->key().contains(interval))
-            {
-               result.insert(int_node->key());
-            }
+         using Test = BoundTest<typename IntervalType::ValueType>;
+         inline Test low_test() const { return { BoundOp::GreaterEqual, this->interval.low }; }
+         inline Test high_test() const { return { BoundOp::LessEqual, this->interval.high }; }
+         inline Test max_test() const { return { BoundOp::GreaterEqual, this->interval.low }; }
+      };
 
-            if constexpr (IntervalType::Inclusive)
-            {
-               if (interval.low <= int_node->max())
-                  traversal.push_back(int_node->left());
-            }
-            else
-            {
-               if (interval.low < int_node->max())
-                  traversal.push_back(int_node->left());
-            }
-            
-            if (interval.high >= int_node->key().low)
-               traversal.push_back(int_node->right());
+      /* overlapping_interval as a single query type, for the lazy ranges: when spanned is set the
+       * query spans every key and walks as the contained-by query, as the collecting calls do.
+       */
+      template <typename IntervalType>
+      struct SpannedOverlapQuery
+      {
+         static constexpr const char *name = "overlapping_interval";
+
+         IntervalType interval;
+         bool spanned;
+
+         inline bool matches(const IntervalType &key) const {
+            if (this->spanned) { return ContainedByIntervalQuery<IntervalType>{this->interval}.matches(key); }
+            else { return OverlappingIntervalQuery<IntervalType>{this->interval}.matches(key); }
+         }
+         inline bool may_match_below(const typename IntervalType::ValueType &max) const {
+            if (this->spanned) { return ContainedByIntervalQuery<IntervalType>{this->interval}.may_match_below(max); }
+            else { return OverlappingIntervalQuery<IntervalType>{this->interval}.may_match_below(max); }
+         }
+         inline bool may_match_before(const IntervalType &key) const {
+            if (this->spanned) { return ContainedByIntervalQuery<IntervalType>{this->interval}.may_match_before(key); }
+            else { return OverlappingIntervalQuery<IntervalType>{this->interval}.may_match_before(key); }
+         }
+         inline bool may_match_after(const IntervalType &key) const {
+            if (this->spanned) { return ContainedByIntervalQuery<IntervalType>{this->interval}.may_match_after(key); }
+            else { return OverlappingIntervalQuery<IntervalType>{this->interval}.may_match_after(key); }
          }
+      };
 
-         return result;
+      /* The trees answer overlapping_interval with every key when the query reaches from the lowest
+       * low to the highest high, so an empty exclusive key at either end of it still counts. Every
+       * key then lies inside the query, and a contained-by walk yields exactly those keys.
+       */
+      template <typename IntervalType>
+      inline bool spans_keys(const IntervalType &interval, const typename IntervalType::ValueType &lowest, const typename IntervalType::ValueType &highest) {
+         return interval.low <= lowest && interval.high >= highest;
       }
 
-      SetType overlapping_interval(const IntervalType &interval) const {
-         auto result = SetType();
-         if (this->root() == nullptr) { return result; }
+      // Probes count the nodes a query walk touches. NullProbe counts nothing and inlines away.
+      struct NullProbe
+      {
+         NullProbe(const char *) {}
+
+         inline void visit() {}
+         inline void prune() {}
+         inline void hit() {}
+      };
+
+      struct CountingProbe
+      {
+         QueryStats stats;
+
+         CountingProbe(const char *query) : stats{query, 0, 0, 0} {}
 
-         std::vector<typename AVLTreeBase::ConstSharedNode> traversal = { this->root() };
-         auto int_root = std::static_pointer_cast<const IntervalNode>(this->root());
-         auto int_leftmost = int_root;
+         inline void visit() { ++this->stats.nodes_visited; }
+         inline void prune() { ++this->stats.nodes_pruned; }
+         inline void hit() { ++this->stats.hits; }
+      };
 
-         while (int_leftmost->left() != nullptr)
-            int_leftmost = std::static_pointer_cast<const IntervalNode>(int_leftmost->left());
+      template <typename Node, typename Query, typename Visitor, typename Probe>
+      Visit visit_query(Node *node, const Query &query, Visitor &visitor, Probe &probe) {
+         if (node == nullptr) { return Visit::Continue; }
 
-         // check if this interval overlaps all possible nodes
-         if (interval.low <= int_leftmost->key().low && interval.high >= int_root->max())
+         if (!query.may_match_below(node->max()))
          {
-            for (auto value : this->to_vec())
-               result.insert(KeyOfValue()(value));
-            
-            return result;
+            probe.prune();
+            return Visit::Continue;
          }
 
-         while (traversal.size() > 0)
+         probe.visit();
+
+         if (query.may_match_before(node->key()))
          {
-            auto node = traversal.front();
-            traversal.erase(traversal.begin());
-            if (node == nullptr) { continue; }
+            auto result = visit_query(node->left_node(), query, visitor, probe);
+            if (result != Visit::Continue) { return result; }
+         }
+         else if (node->left_node() != nullptr) { probe.prune(); }
 
-            auto int_node = std::static_pointer_cast<const IntervalNode>(node);
+         if (!query.may_match_after(node->key())) { return Visit::Exhausted; }
 
-            if (int_node->key().overlaps(interval))
-               result.insert(int_node->key());
-            
-            if constexpr (IntervalType::Inclusive)
-            {
-               if (interval.low <= int_node->max())
-                  traversal.push_back(int_node->left());
-            }
-            else
-            {
-               if (interval.low < int_node->max())
-                  traversal.push_back(int_node->left());
-            }
-            
-            if (interval.high >= int_node->key().low)
-               traversal.push_back(int_node->right());
+         if (query.matches(node->key()))
+         {
+            probe.hit();
+            if (!visitor(node->value())) { return Visit::Stopped; }
          }
 
-         return result;
+         return visit_query(node->right_node(), query, visitor, probe);
       }
 
-      SetType contained_by_interval(const IntervalType &interval) const {
-         auto result = SetType();
-         if (this->root() == nullptr) { return result; }
+      template <typename Node, typename Query, typename Visitor>
+      Visit visit_query(Node *node, const Query &query, Visitor &visitor) {
+         auto probe = NullProbe(Query::name);
+         return visit_query(node, query, visitor, probe);
+      }
+
+      template <typename Node, typename Query, typename Value>
+      class QueryIterator
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using value_type = typename std::remove_const<Value>::type;
+         using difference_type = std::ptrdiff_t;
+         using pointer = Value *;
+         using reference = Value &;
 
-         std::vector<typename AVLTreeBase::ConstSharedNode> traversal = { this->root() };
-         auto int_root = std::static_pointer_cast<const IntervalNode>(this->root());
-         auto int_leftmost = int_root;
+      protected:
+         Node *_node;
+         Query _query;
 
-         while (int_leftmost->left() != nullptr)
-            int_leftmost = std::static_pointer_cast<const IntervalNode>(int_leftmost->left());
+         static Node *descend(Node *node, const Query &query) {
+            if (node == nullptr || !query.may_match_below(node->max())) { return nullptr; }
 
-         // check if this interval contains all possible nodes
-         if (interval.low <= int_leftmost->key().low && interval.high >= int_root->max())
-         {
-            for (auto value : this->to_vec())
-               result.insert(KeyOfValue()(value));
-            
-            return result;
+            while (query.may_match_before(node->key()))
+            {
+               auto left = node->left_node();
+               if (left == nullptr || !query.may_match_below(left->max())) { break; }
+
+               node = left;
+            }
+
+            return node;
          }
 
-         while (traversal.size() > 0)
-         {
-            auto node = traversal.front();
-            traversal.erase(traversal.begin());
-            if (node == nullptr) { continue; }
+         Node *successor(Node *node) const {
+            auto right = descend(node->right_node(), this->_query);
+            if (right != nullptr) { return right; }
 
-            auto int_node = std::static_pointer_cast<const IntervalNode>(node);
+            for (auto parent = node->parent_node(); parent != nullptr; node = parent, parent = parent->parent_node())
+               if (parent->left_node() == node) { return parent; }
 
-            if (int_node->key().contained_by(interval))
-               result.insert(int_node->key());
-            
-            if constexpr (IntervalType::Inclusive)
-            {
-               if (interval.low <= int_node->max())
-                  traversal.push_back(int_node->left());
-            }
-            else
-            {
-               if (interval.low < int_node->max())
-                  traversal.push_back(int_node->left());
-            }
-            
-            if (interval.high >= int_node->key().low)
-               traversal.push_back(int_node->right());
+            return nullptr;
          }
 
-         return result;
-      }
-   };
+         void settle(Node *node) {
+            while (node != nullptr && this->_query.may_match_after(node->key()) && !this->_query.matches(node->key()))
+               node = this->successor(node);
 
-   template <typename IntervalType>
-   class IntervalTree : public IntervalTreeBase<IntervalType, IntervalType, avltree::KeyIsValue<IntervalType>>
-   {
-   public:
-      using iterator = typename IntervalTreeBase::const_iterator;
+            if (node != nullptr && !this->_query.may_match_after(node->key())) { node = nullptr; }
+
+            this->_node = node;
+         }
 
-      IntervalTree() : IntervalTreeBase() {}
-      IntervalTree(std::vector<IntervalType> &nodes) : IntervalTreeBase(nodes) {}
-      IntervalTree(const IntervalTree &other) : IntervalTreeBase(other) {}
+      public:
+         QueryIterator() : _node(nullptr), _query() {}
+         QueryIterator(Node *root, const Query &query) : _node(nullptr), _query(query) { this->settle(descend(root, query)); }
 
-      iterator begin() const { return iterator(this->root()); }
-      iterator end() const { return iterator(nullptr); }
-      iterator cbegin() const { return this->begin(); }
-      iterator cend() const { return this->end(); }
-      
-      std::shared_ptr<typename IntervalTreeBase::IntervalNode> insert_overlap(const IntervalType &interval)
+         inline Node *node() const { return this->_node; }
+
+         reference operator*() const { return this->_node->value(); }
+         pointer operator->() const { return &this->_node->value(); }
+
+         QueryIterator &operator++() {
+            this->settle(this->successor(this->_node));
+            return *this;
+         }
+
+         QueryIterator operator++(int) {
+            auto previous = *this;
+            ++(*this);
+            return previous;
+         }
+
+         bool operator==(const QueryIterator &other) const { return this->_node == other._node; }
+         bool operator!=(const QueryIterator &other) const { return this->_node != other._node; }
+      };
+
+      template <typename Iterator>
+      class QueryRange
       {
-         auto overlaps = this->overlapping_interval(interval);
-         auto final_interval = interval;
+         Iterator _begin;
 
-         if (overlaps.size() != 0)
-         {
-            for (auto overlap : overlaps)
+      public:
+         QueryRange(const Iterator &begin) : _begin(begin) {}
+
+         Iterator begin() const { return this->_begin; }
+         Iterator end() const { return Iterator(); }
+         bool empty() const { return this->_begin == this->end(); }
+      };
+
+      // Work below this many elements is not worth handing to another thread.
+      static const std::size_t ParallelGrain = 4096;
+
+      /* Runs fn(0) .. fn(count - 1) on up to `threads` threads, the calling thread included. Each
+       * worker claims the next unstarted task from a shared counter, so uneven tasks balance out.
+       * The first exception thrown by a task is rethrown once every worker has finished.
+       */
+      template <typename Function>
+      void parallel_tasks(std::size_t threads, std::size_t count, Function &fn) {
+         std::atomic<std::size_t> next(0);
+         std::exception_ptr error;
+         std::mutex error_lock;
+
+         auto worker = [&]() {
+            for (auto task = next++; task < count; task = next++)
             {
-               final_interval = final_interval.join(overlap);
-               this->remove(overlap);
+               try { fn(task); }
+               catch (...)
+               {
+                  std::lock_guard<std::mutex> guard(error_lock);
+
+                  if (error == nullptr) { error = std::current_exception(); }
+                  next = count;
+               }
             }
-         }
+         };
 
-         return this->insert(final_interval);
-      }
+         std::vector<std::thread> pool;
 
-      IntervalTree deoverlap() {
-         auto values = this->to_vec();
-         IntervalTree new_tree;
+         for (std::size_t i = 1; i < std::min(threads, count); ++i)
+         {
+            try { pool.emplace_back(worker); }
+            catch (const std::system_error &) { break; }
+         }
 
-         for (auto value : values)
-            new_tree.insert_overlap(value);
+         worker();
 
-         return new_tree;
+         for (auto &thread : pool)
+            thread.join();
+
+         if (error != nullptr) { std::rethrow_exception(error); }
       }
-   };
 
-   template <typename IntervalType, typename Value>
-   class IntervalMap : public IntervalTreeBase<IntervalType, std::pair<const IntervalType, Value>, avltree::KeyOfPair<IntervalType, Value>>
-   {
-   public:
-      IntervalMap() : IntervalTreeBase() {}
-      IntervalMap(std::vector<typename IntervalTreeBase::ValueType> &nodes) : IntervalTreeBase(nodes) {}
-      IntervalMap(const IntervalMap &other) : IntervalTreeBase(other) {}
-      
-      Value &operator[](const IntervalType &key) {
-         try {
-            return this->get(key);
+      // Same result as std::stable_sort: chunks are sorted in parallel, then merged pairwise in order.
+      template <typename Iterator, typename Compare>
+      void parallel_stable_sort(Iterator first, Iterator last, Compare compare, std::size_t threads) {
+         auto count = static_cast<std::size_t>(std::distance(first, last));
+         auto parts = std::min(threads, count / ParallelGrain);
+
+         if (parts <= 1)
+         {
+            std::stable_sort(first, last, compare);
+            return;
          }
-         catch (exception::KeyNotFound &) {
-            auto node = this->add_node(std::make_pair(key, Value()));
-            return node->value().second;
+
+         std::vector<Iterator> bounds;
+
+         for (std::size_t i = 0; i <= parts; ++i)
+            bounds.push_back(first + static_cast<std::ptrdiff_t>(count * i / parts));
+
+         auto sort = [&](std::size_t part) { std::stable_sort(bounds[part], bounds[part + 1], compare); };
+         parallel_tasks(threads, parts, sort);
+
+         for (std::size_t width = 1; width < parts; width *= 2)
+         {
+            auto merge = [&](std::size_t pair) {
+               auto low = 2 * width * pair;
+               auto middle = std::min(low + width, parts);
+               auto high = std::min(low + 2 * width, parts);
+
+               if (middle < high) { std::inplace_merge(bounds[low], bounds[middle], bounds[high], compare); }
+            };
+
+            parallel_tasks(threads, (parts + 2 * width - 1) / (2 * width), merge);
          }
       }
-      const Value &operator[](const IntervalType &key) const { return this->get(key); }
-      
-      bool has_interval(const IntervalType &key) const {
-         return this->contains(key);
-      }
 
-      std::shared_ptr<typename IntervalTreeBase::IntervalNode> insert(const IntervalType &key, const Value &value) {
-         return IntervalTreeBase::insert(std::make_pair(key, value));
-      }
+      template <typename IntervalType, typename KeyOfValue, typename Iterator>
+      bool strictly_sorted(Iterator first, Iterator last) {
+         auto compare = typename IntervalType::Compare();
 
-      Value &get(const IntervalType &key) {
-         return IntervalTreeBase::get(key)->value().second;
+         return std::adjacent_find(first, last, [&compare](const auto &left, const auto &right) {
+            return !compare(KeyOfValue()(left), KeyOfValue()(right));
+         }) == last;
       }
 
-      const Value &get(const IntervalType &key) const {
-         return IntervalTreeBase::get(key)->value().second;
+      template <typename Iterator>
+      struct IndirectIterator
+      {
+         Iterator iter;
+
+         inline decltype(auto) operator*() const { return **this->iter; }
+         inline IndirectIterator &operator++() { ++this->iter; return *this; }
+      };
+
+      template <typename Iterator>
+      inline IndirectIterator<Iterator> make_indirect_iterator(Iterator iter) { return IndirectIterator<Iterator>{iter}; }
+
+      // Returns pointers to the input elements in build order without copying the elements themselves.
+      template <typename IntervalType, typename KeyOfValue, typename Iterator>
+      auto bulk_order(Iterator first, Iterator last, BulkOrder order, std::size_t threads=1) {
+         using Pointer = decltype(&*first);
+
+         std::vector<Pointer> result;
+         result.reserve(static_cast<std::size_t>(std::distance(first, last)));
+
+         for (auto iter = first; iter != last; ++iter)
+            result.push_back(&*iter);
+
+         if (order == BulkOrder::Trusted) { return result; }
+         if (order == BulkOrder::Checked && strictly_sorted<IntervalType, KeyOfValue>(first, last)) { return result; }
+
+         auto compare = typename IntervalType::Compare();
+
+         parallel_stable_sort(result.begin(), result.end(), [&compare](Pointer left, Pointer right) {
+            return compare(KeyOfValue()(*left), KeyOfValue()(*right));
+         }, threads);
+         result.erase(std::unique(result.begin(), result.end(), [](Pointer left, Pointer right) {
+            return KeyOfValue()(*left) == KeyOfValue()(*right);
+         }), result.end());
+
+         return result;
       }
-   };
+
+      template <typename Iterator>
+      struct AddressIterator
+      {
+         Iterator iter;
+
+         inline auto operator*() const { return &*this->iter; }
+         inline AddressIterator &operator++() { ++this->iter; return *this; }
+         inline bool operator==(const AddressIterator &other) const { return this->iter == other.iter; }
+         inline bool operator!=(const AddressIterator &other) const { return this->iter != other.iter; }
+      };
+
+      /* Merges two sequences sorted by low, calling emit(left, right) once for every pair whose keys
+       * satisfy match(left_key, right_key); match must imply the two keys overlap or touch. Each side
+       * keeps the elements that may still meet something further along; they are dropped once the
+       * sweep passes their high, so the work is O(n + m + pairs) plus the scans of the open elements.
+       */
+      template <typename IntervalType, typename LeftIterator, typename RightIterator, typename LeftKey, typename RightKey, typename Match, typename Emit>
+      void sweep_join(LeftIterator left, LeftIterator left_end, RightIterator right, RightIterator right_end,
+                      const LeftKey &left_key, const RightKey &right_key, const Match &match, Emit &emit) {
+         using LeftValue = typename std::decay<decltype(*left)>::type;
+         using RightValue = typename std::decay<decltype(*right)>::type;
+
+         std::vector<LeftValue> left_active;
+         std::vector<RightValue> right_active;
+
+         auto process = [](const IntervalType &key, auto &active, const auto &active_key, const auto &visit_pair) {
+            for (std::size_t i = 0; i < active.size();)
+            {
+               const IntervalType &other = active_key(active[i]);
+
+               if (other.high < key.low)
+               {
+                  active[i] = active.back();
+                  active.pop_back();
+                  continue;
+               }
+
+               visit_pair(active[i], other);
+
+               ++i;
+            }
+         };
+
+         while ((left != left_end || !left_active.empty()) && (right != right_end || !right_active.empty()))
+         {
+            if (left == left_end && right == right_end) { break; }
+
+            if (right == right_end || (left != left_end && !(right_key(*right).low < left_key(*left).low)))
+            {
+               LeftValue value = *left;
+               const IntervalType &key = left_key(value);
+               ++left;
+
+               process(key, right_active, right_key, [&](const RightValue &other, const IntervalType &other_key) {
+                  if (match(key, other_key)) { emit(value, other); }
+               });
+               left_active.push_back(value);
+            }
+            else
+            {
+               RightValue value = *right;
+               const IntervalType &key = right_key(value);
+               ++right;
+
+               process(key, left_active, left_key, [&](const LeftValue &other, const IntervalType &other_key) {
+                  if (match(other_key, key)) { emit(other, value); }
+               });
+               right_active.push_back(value);
+            }
+         }
+      }
+
+      template <typename IntervalType, typename Node, typename Point, typename Emit>
+      void stab_points(Node *node, const std::size_t *first, const std::size_t *last, const Point *points, Emit &emit) {
+         if (node == nullptr || first == last) { return; }
+
+         last = std::partition_point(first, last, [&](std::size_t index) {
+            return ContainingPointQuery<IntervalType>{points[index]}.may_match_below(node->max());
+         });
+
+         if (first == last) { return; }
+
+         stab_points<IntervalType>(node->left_node(), first, last, points, emit);
+
+         auto middle = std::partition_point(first, last, [&](std::size_t index) { return points[index] < node->key().low; });
+
+         for (auto iter = middle; iter != last && node->key().contains(points[*iter]); ++iter)
+            emit(*iter, node->value());
+
+         stab_points<IntervalType>(node->right_node(), middle, last, points, emit);
+      }
+
+      template <typename Key>
+      std::vector<std::size_t> sorted_order(const Key *keys, std::size_t count, bool sorted) {
+         std::vector<std::size_t> order(count);
+
+         for (std::size_t i = 0; i < count; ++i)
+            order[i] = i;
+
+         if (!sorted)
+            std::stable_sort(order.begin(), order.end(), [keys](std::size_t left, std::size_t right) { return keys[left] < keys[right]; });
+
+         return order;
+      }
+
+      template <typename Node, typename Visitor>
+      bool visit_nodes(Node *node, Visitor &visitor) {
+         if (node == nullptr) { return true; }
+         if (!visit_nodes(node->left_node(), visitor)) { return false; }
+         if (!visitor(node->value())) { return false; }
+
+         return visit_nodes(node->right_node(), visitor);
+      }
+
+      // In-order neighbours through parent links; both engines' nodes provide them.
+      template <typename Node>
+      Node *next_node(Node *node) {
+         if (node->right_node() != nullptr)
+         {
+            node = node->right_node();
+
+            while (node->left_node() != nullptr)
+               node = node->left_node();
+
+            return node;
+         }
+
+         auto parent = node->parent_node();
+
+         while (parent != nullptr && parent->right_node() == node)
+         {
+            node = parent;
+            parent = parent->parent_node();
+         }
+
+         return parent;
+      }
+
+      template <typename Node>
+      Node *prev_node(Node *node) {
+         if (node->left_node() != nullptr)
+         {
+            node = node->left_node();
+
+            while (node->right_node() != nullptr)
+               node = node->right_node();
+
+            return node;
+         }
+
+         auto parent = node->parent_node();
+
+         while (parent != nullptr && parent->left_node() == node)
+         {
+            node = parent;
+            parent = parent->parent_node();
+         }
+
+         return parent;
+      }
+
+      // Key of a tree value or range element: the interval itself, or the first member of a pair.
+      template <typename Value, typename = void>
+      struct JoinKey
+      {
+         using Type = Value;
+
+         static inline const Type &get(const Value &value) { return value; }
+      };
+
+      template <typename Value>
+      struct JoinKey<Value, decltype(void(std::declval<const Value &>().first))>
+      {
+         using Type = typename std::decay<decltype(std::declval<const Value &>().first)>::type;
+
+         static inline const Type &get(const Value &value) { return value.first; }
+      };
+
+      // Walks a tree in order through parent links, yielding a pointer to each value.
+      template <typename Node>
+      class InOrderIterator
+      {
+         Node *_node;
+
+      public:
+         InOrderIterator(Node *root) : _node(root) {
+            if (this->_node == nullptr) { return; }
+
+            while (this->_node->left_node() != nullptr)
+               this->_node = this->_node->left_node();
+         }
+
+         inline auto operator*() const { return &this->_node->value(); }
+         inline InOrderIterator &operator++() { this->_node = next_node(this->_node); return *this; }
+         inline bool operator==(const InOrderIterator &other) const { return this->_node == other._node; }
+         inline bool operator!=(const InOrderIterator &other) const { return this->_node != other._node; }
+      };
+
+      // Joins two sequences of value pointers, calling emit with the values themselves.
+      template <typename LeftIterator, typename RightIterator, typename Match, typename Emit>
+      void join_pointers(LeftIterator left, LeftIterator left_end, RightIterator right, RightIterator right_end, const Match &match, Emit &emit) {
+         using LeftValue = typename std::decay<decltype(**left)>::type;
+         using RightValue = typename std::decay<decltype(**right)>::type;
+         using IntervalType = typename JoinKey<LeftValue>::Type;
+
+         static_assert(std::is_same<IntervalType, typename JoinKey<RightValue>::Type>::value, "Both sides of a join must use the same interval type.");
+
+         auto left_key = [](const LeftValue *value) -> const IntervalType & { return JoinKey<LeftValue>::get(*value); };
+         auto right_key = [](const RightValue *value) -> const IntervalType & { return JoinKey<RightValue>::get(*value); };
+         auto forward = [&emit](const LeftValue *left_value, const RightValue *right_value) { emit(*left_value, *right_value); };
+
+         sweep_join<IntervalType>(left, left_end, right, right_end, left_key, right_key, match, forward);
+      }
+
+      template <typename Left, typename Right, typename Match, typename Emit>
+      void join_trees(const Left &left, const Right &right, const Match &match, Emit &emit) {
+         using LeftNode = typename std::remove_pointer<decltype(left.root_node())>::type;
+         using RightNode = typename std::remove_pointer<decltype(right.root_node())>::type;
+
+         join_pointers(InOrderIterator<LeftNode>(left.root_node()), InOrderIterator<LeftNode>(nullptr),
+                       InOrderIterator<RightNode>(right.root_node()), InOrderIterator<RightNode>(nullptr), match, emit);
+      }
+
+      template <typename LeftIterator, typename RightIterator, typename Match, typename Emit>
+      void join_ranges(LeftIterator left, LeftIterator left_end, RightIterator right, RightIterator right_end, const Match &match, Emit &emit) {
+         join_pointers(AddressIterator<LeftIterator>{left}, AddressIterator<LeftIterator>{left_end},
+                       AddressIterator<RightIterator>{right}, AddressIterator<RightIterator>{right_end}, match, emit);
+      }
+
+      struct OverlapMatch
+      {
+         template <typename IntervalType>
+         inline bool operator()(const IntervalType &left, const IntervalType &right) const { return left.overlaps(right); }
+      };
+
+      struct ContainingMatch
+      {
+         template <typename IntervalType>
+         inline bool operator()(const IntervalType &left, const IntervalType &right) const { return left.contains(right); }
+      };
+
+      struct ContainedByMatch
+      {
+         template <typename IntervalType>
+         inline bool operator()(const IntervalType &left, const IntervalType &right) const { return left.contained_by(right); }
+      };
+
+      // Overlap or containment: a superset of both tests for callers that pick one per pair.
+      struct OverlapOrContainedByMatch
+      {
+         template <typename IntervalType>
+         inline bool operator()(const IntervalType &left, const IntervalType &right) const { return left.overlaps(right) || left.contained_by(right); }
+      };
+
+      template <typename Left, typename Right, typename Match>
+      auto join_buffer(const Left &left, const Right &right, const Match &match) {
+         using LeftValue = typename std::decay<decltype(left.root_node()->value())>::type;
+         using RightValue = typename std::decay<decltype(right.root_node()->value())>::type;
+
+         std::vector<std::pair<const LeftValue *, const RightValue *>> pairs;
+         auto emit = [&pairs](const LeftValue &left_value, const RightValue &right_value) { pairs.emplace_back(&left_value, &right_value); };
+
+         join_trees(left, right, match, emit);
+
+         return pairs;
+      }
+
+      template <typename T, typename = void>
+      struct is_equality_comparable : std::false_type {};
+
+      template <typename T>
+      struct is_equality_comparable<T, decltype(void(std::declval<const T &>() == std::declval<const T &>()))> : std::true_type {};
+
+      template <typename Node>
+      std::size_t subtree_height(Node *node) {
+         if (node == nullptr) { return 0; }
+
+         return 1 + std::max(subtree_height(node->left_node()), subtree_height(node->right_node()));
+      }
+
+      template <typename Node>
+      inline std::size_t subtree_count(const Node *node) { return (node != nullptr) ? node->count() : 0; }
+
+      // Number of nodes whose low is below bound, or not above it when inclusive. Keys are ordered by
+      // low first, so one descent with the subtree counts answers it.
+      template <typename Node, typename Bound>
+      std::size_t count_lows_below(const Node *node, const Bound &bound, bool inclusive) {
+         std::size_t count = 0;
+
+         while (node != nullptr)
+         {
+            if (node->key().low < bound || (inclusive && node->key().low == bound))
+            {
+               count += 1 + subtree_count(node->left_node());
+               node = node->right_node();
+            }
+            else { node = node->left_node(); }
+         }
+
+         return count;
+      }
+
+      // Number of nodes whose key sorts before key.
+      template <typename Node, typename IntervalType>
+      std::size_t rank_of(const Node *node, const IntervalType &key) {
+         auto compare = typename IntervalType::Compare();
+         std::size_t count = 0;
+
+         while (node != nullptr)
+         {
+            if (compare(node->key(), key))
+            {
+               count += 1 + subtree_count(node->left_node());
+               node = node->right_node();
+            }
+            else { node = node->left_node(); }
+         }
+
+         return count;
+      }
+
+      // The node at in-order position index, or nullptr past the end.
+      template <typename Node>
+      Node *select_node(Node *node, std::size_t index) {
+         while (node != nullptr)
+         {
+            auto left = subtree_count(node->left_node());
+
+            if (index < left) { node = node->left_node(); }
+            else if (index == left) { return node; }
+            else
+            {
+               index -= left + 1;
+               node = node->right_node();
+            }
+         }
+
+         return nullptr;
+      }
+
+      // Where the last find_containing() lookup ended. Any change to the tree invalidates it, as it
+      // would an iterator; reset() it then.
+      template <typename Node>
+      struct Finger
+      {
+         Node *node = nullptr;
+
+         inline void reset() { this->node = nullptr; }
+      };
+
+      /* The interval holding point in a subtree of disjoint intervals, found in one descent. Returns
+       * nullptr on a miss; last is left at the final node looked at.
+       */
+      template <typename Node, typename Point>
+      Node *descend_containing(Node *node, const Point &point, Node *&last) {
+         while (node != nullptr)
+         {
+            last = node;
+
+            if (point < node->key().low) { node = node->left_node(); }
+            else if (node->key().contains(point)) { return node; }
+            else { node = node->right_node(); }
+         }
+
+         return nullptr;
+      }
+
+      // Free points between an interval ending at high and one starting at low (their length, for
+      // exclusive intervals).
+      template <typename IntervalType>
+      typename IntervalType::ValueType free_between(const typename IntervalType::ValueType &high, const typename IntervalType::ValueType &low) {
+         using Bound = typename IntervalType::ValueType;
+
+         if (!(high < low)) { return Bound(0); }
+
+         if constexpr (IntervalType::Inclusive) { return low - high - 1; }
+         else { return low - high; }
+      }
+
+      /* Largest free span between the intervals of a subtree, taken on their own. Exact when they
+       * are disjoint; otherwise an upper bound, as intervals before the subtree can only cover more.
+       */
+      template <typename IntervalType, typename Node>
+      typename IntervalType::ValueType subtree_gap(const Node *left, const IntervalType &key, const Node *right) {
+         auto gap = typename IntervalType::ValueType(0);
+         auto high = key.high;
+
+         if (left != nullptr)
+         {
+            gap = std::max(left->gap(), free_between<IntervalType>(left->max(), key.low));
+            high = std::max(high, left->max());
+         }
+
+         if (right != nullptr) { gap = std::max(gap, std::max(right->gap(), free_between<IntervalType>(high, right->min_low()))); }
+
+         return gap;
+      }
+
+      /* The free space of a window as a walk in key order uncovers it: `from` is the first point not
+       * yet covered (`full` once none is left) and `to` ends the window, with the interval type's
+       * inclusiveness.
+       */
+      template <typename IntervalType>
+      struct FreeSpace
+      {
+         using Bound = typename IntervalType::ValueType;
+
+         Bound from;
+         Bound to;
+         bool full;
+
+         inline bool covers(const Bound &high) const {
+            if constexpr (IntervalType::Inclusive) { return this->full || high < this->from; }
+            else { return this->full || !(this->from < high); }
+         }
+
+         void cover(const Bound &high) {
+            if (this->covers(high)) { return; }
+
+            if constexpr (IntervalType::Inclusive)
+            {
+               if (high == std::numeric_limits<Bound>::max()) { this->full = true; }
+               else { this->from = high + 1; }
+            }
+            else { this->from = high; }
+         }
+
+         inline bool past(const Bound &low) const {
+            if constexpr (IntervalType::Inclusive) { return this->to < low; }
+            else { return !(low < this->to); }
+         }
+
+         // The free points before low, clipped to the window.
+         bool hole_before(const Bound &low, IntervalType &hole) const {
+            if (this->full || !(this->from < low)) { return false; }
+
+            if constexpr (IntervalType::Inclusive)
+            {
+               auto last = std::min(Bound(low - 1), this->to);
+               if (last < this->from) { return false; }
+
+               hole = IntervalType(this->from, last);
+            }
+            else
+            {
+               auto end = std::min(low, this->to);
+               if (!(this->from < end)) { return false; }
+
+               hole = IntervalType(this->from, end);
+            }
+
+            return true;
+         }
+
+         bool tail(IntervalType &hole) const {
+            if (this->full) { return false; }
+
+            if constexpr (IntervalType::Inclusive)
+            {
+               if (this->to < this->from) { return false; }
+               hole = IntervalType(this->from, this->to);
+            }
+            else
+            {
+               if (!(this->from < this->to)) { return false; }
+               hole = IntervalType(this->from, this->to);
+            }
+
+            return true;
+         }
+
+         static inline bool fits(const IntervalType &hole, const Bound &size) {
+            if constexpr (IntervalType::Inclusive) { return hole.high - hole.low >= size - 1; }
+            else { return hole.high - hole.low >= size; }
+         }
+
+         // The block of size points starting at start.
+         static inline IntervalType block(const Bound &start, const Bound &size) {
+            if constexpr (IntervalType::Inclusive) { return IntervalType(start, start + (size - 1)); }
+            else { return IntervalType(start, start + size); }
+         }
+      };
+
+      /* Offers each hole of the window to visit(hole), in order, until it returns false. Subtrees
+       * that are already covered, lie past the window, or cannot hold size points are stepped over
+       * whole, which keeps a first-fit search on disjoint intervals to O(log n).
+       */
+      template <typename Node, typename IntervalType, typename Visitor>
+      bool visit_gaps(const Node *node, FreeSpace<IntervalType> &space, const typename IntervalType::ValueType &size, Visitor &visit) {
+         if (node == nullptr || space.covers(node->max()) || space.past(node->min_low())) { return true; }
+
+         IntervalType hole;
+
+         if (node->gap() < size && !(space.hole_before(node->min_low(), hole) && space.fits(hole, size)))
+         {
+            space.cover(node->max());
+            return true;
+         }
+
+         if (!visit_gaps(node->left_node(), space, size, visit)) { return false; }
+         if (space.past(node->key().low)) { return true; }
+         if (space.hole_before(node->key().low, hole) && !visit(hole)) { return false; }
+
+         space.cover(node->key().high);
+
+         return visit_gaps(node->right_node(), space, size, visit);
+      }
+
+      /* Cuts the tree `depth` levels down into in-order tasks: whole subtrees below the cut and
+       * single nodes above it. Subtrees the query rules out are dropped here.
+       */
+      template <typename Node, typename Query>
+      void subtree_tasks(Node *node, const Query &query, std::size_t depth, std::vector<std::pair<Node *, bool>> &tasks) {
+         if (node == nullptr || !query.may_match_below(node->max())) { return; }
+
+         if (depth == 0)
+         {
+            tasks.emplace_back(node, true);
+            return;
+         }
+
+         if (query.may_match_before(node->key())) { subtree_tasks(node->left_node(), query, depth - 1, tasks); }
+         if (!query.may_match_after(node->key())) { return; }
+
+         tasks.emplace_back(node, false);
+         subtree_tasks(node->right_node(), query, depth - 1, tasks);
+      }
+
+      /* Joins each run of overlapping intervals in a range sorted by Interval::Compare. Intervals
+       * starting at `lowest` are always joined: deoverlap() does the same, because every one of
+       * them reaches overlapping_interval() as a query spanning the whole tree.
+       */
+      template <typename IntervalType, typename Iterator>
+      std::vector<IntervalType> merge_overlaps(Iterator first, Iterator last, const typename IntervalType::ValueType &lowest) {
+         std::vector<IntervalType> result;
+
+         for (; first != last; ++first)
+         {
+            if (!result.empty() && (result.back().overlaps(*first) || first->low == lowest)) { result.back() = result.back().join(*first); }
+            else { result.push_back(*first); }
+         }
+
+         return result;
+      }
+   }
+
+   /* Results of a batched query in compressed sparse row form: the hits for query i are
+    * hits[offsets[i]] up to hits[offsets[i+1]], in Interval::Compare order.
+    */
+   template <typename Hit>
+   class BatchResult
+   {
+   public:
+      class Slice
+      {
+         const Hit *_begin;
+         const Hit *_end;
+
+      public:
+         Slice(const Hit *begin, const Hit *end) : _begin(begin), _end(end) {}
+
+         inline const Hit *begin() const { return this->_begin; }
+         inline const Hit *end() const { return this->_end; }
+         inline std::size_t size() const { return static_cast<std::size_t>(this->_end - this->_begin); }
+         inline bool empty() const { return this->_begin == this->_end; }
+         inline const Hit &operator[](std::size_t index) const { return this->_begin[index]; }
+      };
+
+      std::vector<std::size_t> offsets;
+      std::vector<Hit> hits;
+
+      BatchResult() : offsets(1, 0) {}
+
+      // Groups (query, hit) pairs by query, preserving the order hits were produced in.
+      BatchResult(std::size_t queries, const std::vector<std::pair<std::size_t, Hit>> &pairs) : offsets(queries + 1, 0), hits(pairs.size()) {
+         for (auto &pair : pairs)
+            ++this->offsets[pair.first + 1];
+
+         for (std::size_t i = 0; i < queries; ++i)
+            this->offsets[i + 1] += this->offsets[i];
+
+         auto cursor = std::vector<std::size_t>(this->offsets.begin(), this->offsets.end() - 1);
+
+         for (auto &pair : pairs)
+            this->hits[cursor[pair.first]++] = pair.second;
+      }
+
+      inline std::size_t size() const { return this->offsets.size() - 1; }
+      inline Slice operator[](std::size_t query) const {
+         return Slice(this->hits.data() + this->offsets[query], this->hits.data() + this->offsets[query + 1]);
+      }
+   };
+
+   template <typename Derived, typename IntervalType, typename ValueType, typename KeyOfValue>
+   class IntervalQueries
+   {
+   public:
+      using SetType = std::set<IntervalType, typename IntervalType::Compare>;
+      using VisitType = typename std::conditional<std::is_same<ValueType, IntervalType>::value, const ValueType, ValueType>::type;
+      using BatchType = BatchResult<const ValueType *>;
+
+   protected:
+      inline const Derived &derived() const { return *static_cast<const Derived *>(this); }
+      inline Derived &derived() { return *static_cast<Derived *>(this); }
+
+      /* Hot-path counters, compiled in only with INTERVALTREE_STATS. They are plain integers, so a
+       * tree that is queried from several threads at once must not be built with them. Lazy ranges
+       * and batch queries are not counted.
+       */
+#if defined(INTERVALTREE_STATS)
+      using Probe = detail::CountingProbe;
+
+      mutable TreeStats _stats = TreeStats();
+      std::function<void(const QueryStats &)> _trace;
+
+      void record(const Probe &probe) const {
+         ++this->_stats.queries;
+         this->_stats.nodes_visited += probe.stats.nodes_visited;
+         this->_stats.nodes_pruned += probe.stats.nodes_pruned;
+         this->_stats.hits += probe.stats.hits;
+
+         if (this->_trace) { this->_trace(probe.stats); }
+      }
+
+      inline void stats_rotation() { ++this->_stats.rotations; }
+      inline void stats_max_update() { ++this->_stats.max_updates; }
+      inline void stats_allocation(std::size_t count=1) { this->_stats.allocations += count; }
+#else
+      using Probe = detail::NullProbe;
+
+      inline void record(const Probe &) const {}
+      inline void stats_rotation() {}
+      inline void stats_max_update() {}
+      inline void stats_allocation(std::size_t=1) {}
+#endif
+
+      template <typename Query, typename Visitor>
+      bool visit(const Query &query, Visitor &visitor) const {
+         auto forward = [&visitor](const ValueType &value) { return detail::invoke_visitor(visitor, value); };
+         auto probe = Probe(Query::name);
+         auto result = detail::visit_query(this->derived().root_node(), query, forward, probe);
+
+         this->record(probe);
+
+         return result != detail::Visit::Stopped;
+      }
+
+      template <typename Query, typename Visitor>
+      bool visit(const Query &query, Visitor &visitor) {
+         auto forward = [&visitor](VisitType &value) { return detail::invoke_visitor(visitor, value); };
+         auto probe = Probe(Query::name);
+         auto result = detail::visit_query(this->derived().root_node(), query, forward, probe);
+
+         this->record(probe);
+
+         return result != detail::Visit::Stopped;
+      }
+
+      template <typename Query>
+      auto range(const Query &query) const {
+         using Node = typename std::remove_pointer<decltype(this->derived().root_node())>::type;
+         using Iterator = detail::QueryIterator<Node, Query, const ValueType>;
+
+         return detail::QueryRange<Iterator>(Iterator(this->derived().root_node(), query));
+      }
+
+      template <typename Query>
+      auto range(const Query &query) {
+         using Node = typename std::remove_pointer<decltype(this->derived().root_node())>::type;
+         using Iterator = detail::QueryIterator<Node, Query, VisitType>;
+
+         return detail::QueryRange<Iterator>(Iterator(this->derived().root_node(), query));
+      }
+
+      template <typename Query>
+      SetType collect(const Query &query) const {
+         auto result = SetType();
+         auto insert = [&result](const ValueType &value) { result.insert(KeyOfValue()(value)); return true; };
+         auto probe = Probe(Query::name);
+
+         detail::visit_query(this->derived().root_node(), query, insert, probe);
+         this->record(probe);
+
+         return result;
+      }
+
+      template <typename Query>
+      bool exists(const Query &query) const {
+         auto stop = [](const ValueType &) { return false; };
+         auto probe = Probe(Query::name);
+         auto result = detail::visit_query(this->derived().root_node(), query, stop, probe);
+
+         this->record(probe);
+
+         return result == detail::Visit::Stopped;
+      }
+
+      template <typename Query>
+      std::size_t count_hits(const Query &query) const {
+         std::size_t hits = 0;
+         auto tally = [&hits](const ValueType &) { ++hits; return true; };
+         auto probe = Probe(Query::name);
+
+         detail::visit_query(this->derived().root_node(), query, tally, probe);
+         this->record(probe);
+
+         return hits;
+      }
+
+      // Walks the holes of within that may hold size points; a zero size finds nothing.
+      template <typename Visitor>
+      void visit_gaps(const typename IntervalType::ValueType &size, const IntervalType &within, Visitor &visit) const {
+         if (size == 0) { return; }
+
+         auto space = detail::FreeSpace<IntervalType>{within.low, within.high, false};
+         IntervalType hole;
+
+         if (detail::visit_gaps(this->derived().root_node(), space, size, visit) && space.tail(hole)) { visit(hole); }
+      }
+
+      // The root's subtree bounds hold the lowest low and the highest high.
+      bool spanned_by(const IntervalType &interval) const {
+         auto root = this->derived().root_node();
+
+         return root != nullptr && detail::spans_keys(interval, root->min_low(), root->max());
+      }
+
+      template <typename Query>
+      SetType collect_spanned(const Query &query) const {
+         auto root = this->derived().root_node();
+
+         // check if this interval spans all possible nodes
+         if (this->spanned_by(query.interval))
+         {
+            auto result = SetType();
+            auto probe = Probe(Query::name);
+            auto insert = [&result, &probe](const ValueType &value) {
+               probe.visit();
+               probe.hit();
+               result.insert(KeyOfValue()(value));
+               return true;
+            };
+
+            detail::visit_nodes(root, insert);
+            this->record(probe);
+            
+            return result;
+         }
+
+         return this->collect(query);
+      }
+
+      // Splits the walk into subtree tasks for the worker threads; hits are concatenated in order.
+      template <typename Query>
+      SetType collect_parallel(const Query &query, const Parallel &parallel) const {
+         using Node = typename std::remove_pointer<decltype(this->derived().root_node())>::type;
+
+         auto threads = parallel.count();
+         std::size_t depth = 0;
+         std::vector<std::pair<Node *, bool>> tasks;
+
+         while ((std::size_t(1) << depth) < 8 * threads)
+            ++depth;
+
+         detail::subtree_tasks(this->derived().root_node(), query, depth, tasks);
+
+         std::vector<std::vector<IntervalType>> hits(tasks.size());
+         std::vector<Probe> probes(tasks.size(), Probe(Query::name));
+         auto run = [&](std::size_t task) {
+            auto &found = hits[task];
+            auto &probe = probes[task];
+            auto node = tasks[task].first;
+
+            if (tasks[task].second)
+            {
+               auto insert = [&found](const ValueType &value) { found.push_back(KeyOfValue()(value)); return true; };
+               detail::visit_query(node, query, insert, probe);
+            }
+            else
+            {
+               probe.visit();
+
+               if (query.matches(node->key()))
+               {
+                  probe.hit();
+                  found.push_back(node->key());
+               }
+            }
+         };
+
+         detail::parallel_tasks(threads, tasks.size(), run);
+
+#if defined(INTERVALTREE_STATS)
+         auto merged = Probe(Query::name);
+
+         for (auto &probe : probes)
+         {
+            merged.stats.nodes_visited += probe.stats.nodes_visited;
+            merged.stats.nodes_pruned += probe.stats.nodes_pruned;
+            merged.stats.hits += probe.stats.hits;
+         }
+
+         this->record(merged);
+#endif
+
+         auto result = SetType();
+
+         for (auto &found : hits)
+            for (auto &key : found)
+               result.emplace_hint(result.end(), key);
+
+         return result;
+      }
+
+   public:
+      // Counters are zero unless INTERVALTREE_STATS is defined; height is always measured.
+      TreeStats stats() const {
+#if defined(INTERVALTREE_STATS)
+         auto result = this->_stats;
+#else
+         auto result = TreeStats();
+#endif
+         result.height = detail::subtree_height(this->derived().root_node());
+
+         return result;
+      }
+
+      void reset_stats() {
+#if defined(INTERVALTREE_STATS)
+         this->_stats = TreeStats();
+#endif
+      }
+
+      // Calls trace after every counted query. Does nothing without INTERVALTREE_STATS.
+      void set_query_trace(std::function<void(const QueryStats &)> trace) {
+#if defined(INTERVALTREE_STATS)
+         this->_trace = std::move(trace);
+#else
+         (void)trace;
+#endif
+      }
+
+      auto lookup_node(const IntervalType &key) const {
+         auto node = this->derived().root_node();
+         auto compare = typename IntervalType::Compare();
+
+         while (node != nullptr)
+         {
+            if (compare(key, node->key())) { node = node->left_node(); }
+            else if (compare(node->key(), key)) { node = node->right_node(); }
+            else { break; }
+         }
+
+         return node;
+      }
+
+      auto lookup_node(const IntervalType &key) {
+         auto node = this->derived().root_node();
+         auto compare = typename IntervalType::Compare();
+
+         while (node != nullptr)
+         {
+            if (compare(key, node->key())) { node = node->left_node(); }
+            else if (compare(node->key(), key)) { node = node->right_node(); }
+            else { break; }
+         }
+
+         return node;
+      }
+
+      SetType containing_point(const typename IntervalType::ValueType &point) const {
+         return this->collect(detail::ContainingPointQuery<IntervalType>{point});
+      }
+
+      SetType containing_interval(const IntervalType &interval) const {
+         return this->collect(detail::ContainingIntervalQuery<IntervalType>{interval});
+      }
+
+      SetType overlapping_interval(const IntervalType &interval) const {
+         return this->collect_spanned(detail::OverlappingIntervalQuery<IntervalType>{interval});
+      }
+
+      SetType contained_by_interval(const IntervalType &interval) const {
+         return this->collect_spanned(detail::ContainedByIntervalQuery<IntervalType>{interval});
+      }
+
+      SetType containing_point(const typename IntervalType::ValueType &point, const Parallel &parallel) const {
+         return this->collect_parallel(detail::ContainingPointQuery<IntervalType>{point}, parallel);
+      }
+
+      SetType containing_interval(const IntervalType &interval, const Parallel &parallel) const {
+         return this->collect_parallel(detail::ContainingIntervalQuery<IntervalType>{interval}, parallel);
+      }
+
+      SetType overlapping_interval(const IntervalType &interval, const Parallel &parallel) const {
+         if (this->spanned_by(interval)) { return this->collect_parallel(detail::ContainedByIntervalQuery<IntervalType>{interval}, parallel); }
+
+         return this->collect_parallel(detail::OverlappingIntervalQuery<IntervalType>{interval}, parallel);
+      }
+
+      SetType contained_by_interval(const IntervalType &interval, const Parallel &parallel) const {
+         return this->collect_parallel(detail::ContainedByIntervalQuery<IntervalType>{interval}, parallel);
+      }
+
+      // Stop at the first hit.
+      bool any_containing_point(const typename IntervalType::ValueType &point) const {
+         return this->exists(detail::ContainingPointQuery<IntervalType>{point});
+      }
+
+      bool any_containing_interval(const IntervalType &interval) const {
+         return this->exists(detail::ContainingIntervalQuery<IntervalType>{interval});
+      }
+
+      bool any_overlapping_interval(const IntervalType &interval) const {
+         if (this->spanned_by(interval)) { return true; }
+
+         return this->exists(detail::OverlappingIntervalQuery<IntervalType>{interval});
+      }
+
+      bool any_contained_by_interval(const IntervalType &interval) const {
+         return this->exists(detail::ContainedByIntervalQuery<IntervalType>{interval});
+      }
+
+      // Count hits without collecting them.
+      std::size_t count_containing_point(const typename IntervalType::ValueType &point) const {
+         return this->count_hits(detail::ContainingPointQuery<IntervalType>{point});
+      }
+
+      std::size_t count_containing_interval(const IntervalType &interval) const {
+         return this->count_hits(detail::ContainingIntervalQuery<IntervalType>{interval});
+      }
+
+      /* Intervals starting inside the query (after its low end) always overlap it and are counted by
+       * rank, so only the ones crossing its low end are walked. A query spanning every key counts
+       * them all, as overlapping_interval() returns them all.
+       */
+      std::size_t count_overlapping_interval(const IntervalType &interval) const {
+         if (this->spanned_by(interval)) { return detail::subtree_count(this->derived().root_node()); }
+
+         if (!IntervalType::Inclusive && interval.low == interval.high)
+            return this->count_hits(detail::OverlappingIntervalQuery<IntervalType>{interval});
+
+         auto root = this->derived().root_node();
+         auto starting = detail::count_lows_below(root, interval.high, IntervalType::Inclusive) - detail::count_lows_below(root, interval.low, true);
+
+         return this->count_containing_point(interval.low) + starting;
+      }
+
+      std::size_t count_contained_by_interval(const IntervalType &interval) const {
+         return this->count_hits(detail::ContainedByIntervalQuery<IntervalType>{interval});
+      }
+
+      // Intervals whose low lies in interval, taken with its own inclusiveness. O(log n).
+      std::size_t count_starting_in(const IntervalType &interval) const {
+         auto root = this->derived().root_node();
+
+         return detail::count_lows_below(root, interval.high, IntervalType::Inclusive) - detail::count_lows_below(root, interval.low, false);
+      }
+
+      // Number of values ordered before key, whether or not key is in the tree. O(log n).
+      std::size_t rank(const IntervalType &key) const {
+         return detail::rank_of(this->derived().root_node(), key);
+      }
+
+      // The value at in-order position index. O(log n).
+      const ValueType &select(std::size_t index) const {
+         auto node = detail::select_node(this->derived().root_node(), index);
+         if (node == nullptr) { throw exception::IndexOutOfRange(); }
+
+         return node->value();
+      }
+
+      /* Single-hit lookup for trees whose intervals do not overlap, such as region maps after
+       * deoverlap(): one descent instead of the max-guided walk, and no set. On overlapping
+       * intervals it returns one of the hits, or may miss them all.
+       */
+      const ValueType *find_containing(const typename IntervalType::ValueType &point) const {
+         auto last = this->derived().root_node();
+         auto node = detail::descend_containing(this->derived().root_node(), point, last);
+
+         return (node != nullptr) ? &node->value() : nullptr;
+      }
+
+      /* Starts from where finger was left: a hit on the same node costs one comparison, and a nearby
+       * one climbs only until the subtree spans point, so sequential lookups run in near O(1).
+       */
+      template <typename Node>
+      const ValueType *find_containing(const typename IntervalType::ValueType &point, detail::Finger<Node> &finger) const {
+         auto node = finger.node;
+
+         if (node == nullptr) { node = this->derived().root_node(); }
+         else if (node->key().contains(point)) { return &node->value(); }
+         else
+         {
+            auto query = detail::ContainingPointQuery<IntervalType>{point};
+
+            while (node->parent_node() != nullptr && (point < node->min_low() || !query.may_match_below(node->max())))
+               node = node->parent_node();
+         }
+
+         auto last = node;
+         auto found = detail::descend_containing(node, point, last);
+
+         finger.node = last;
+
+         return (found != nullptr) ? &found->value() : nullptr;
+      }
+
+      /* Free space within a window, for allocators keeping their used ranges in the tree. Each returns
+       * a block of size points (a block of that length, for exclusive intervals) lying in no interval,
+       * or nothing when none fits. Subtrees keep the largest gap between their intervals, so on
+       * disjoint intervals first_fit and aligned_fit descend in O(log n); best_fit looks at every
+       * hole that is large enough. An empty exclusive interval holds no points but still splits the
+       * hole it sits in.
+       */
+      std::optional<IntervalType> first_fit(const typename IntervalType::ValueType &size, const IntervalType &within) const {
+         auto found = std::optional<IntervalType>();
+         auto visit = [&](const IntervalType &hole) {
+            if (!detail::FreeSpace<IntervalType>::fits(hole, size)) { return true; }
+
+            found = detail::FreeSpace<IntervalType>::block(hole.low, size);
+            return false;
+         };
+
+         this->visit_gaps(size, within, visit);
+
+         return found;
+      }
+
+      // The block at the start of the smallest hole that holds it; ties go to the lowest.
+      std::optional<IntervalType> best_fit(const typename IntervalType::ValueType &size, const IntervalType &within) const {
+         auto best = std::optional<IntervalType>();
+         auto visit = [&](const IntervalType &hole) {
+            if (detail::FreeSpace<IntervalType>::fits(hole, size) && (!best || hole.high - hole.low < best->high - best->low)) { best = hole; }
+
+            return true;
+         };
+
+         this->visit_gaps(size, within, visit);
+
+         if (!best) { return best; }
+
+         return detail::FreeSpace<IntervalType>::block(best->low, size);
+      }
+
+      // The lowest block that starts on a multiple of alignment.
+      std::optional<IntervalType> aligned_fit(const typename IntervalType::ValueType &size, const typename IntervalType::ValueType &alignment, const IntervalType &within) const {
+         using Bound = typename IntervalType::ValueType;
+
+         static_assert(std::is_integral<Bound>::value, "aligned_fit needs integral bounds.");
+
+         auto found = std::optional<IntervalType>();
+         auto visit = [&](const IntervalType &hole) {
+            auto start = hole.low;
+            auto remainder = Bound(start % alignment);
+
+            // % truncates toward zero, so a negative start leaves a negative remainder
+            if constexpr (std::is_signed<Bound>::value) { if (remainder < 0) { remainder += alignment; } }
+
+            if (remainder != 0)
+            {
+               if (hole.high - start < alignment - remainder) { return true; }
+
+               start += alignment - remainder;
+            }
+
+            if (!detail::FreeSpace<IntervalType>::fits(IntervalType(start, hole.high), size)) { return true; }
+
+            found = detail::FreeSpace<IntervalType>::block(start, size);
+            return false;
+         };
+
+         if (alignment > 0) { this->visit_gaps(size, within, visit); }
+
+         return found;
+      }
+
+      auto containing_point_range(const typename IntervalType::ValueType &point) const {
+         return this->range(detail::ContainingPointQuery<IntervalType>{point});
+      }
+
+      auto containing_point_range(const typename IntervalType::ValueType &point) {
+         return this->range(detail::ContainingPointQuery<IntervalType>{point});
+      }
+
+      auto containing_interval_range(const IntervalType &interval) const {
+         return this->range(detail::ContainingIntervalQuery<IntervalType>{interval});
+      }
+
+      auto containing_interval_range(const IntervalType &interval) {
+         return this->range(detail::ContainingIntervalQuery<IntervalType>{interval});
+      }
+
+      auto overlapping_interval_range(const IntervalType &interval) const {
+         return this->range(detail::SpannedOverlapQuery<IntervalType>{interval, this->spanned_by(interval)});
+      }
+
+      auto overlapping_interval_range(const IntervalType &interval) {
+         return this->range(detail::SpannedOverlapQuery<IntervalType>{interval, this->spanned_by(interval)});
+      }
+
+      auto contained_by_interval_range(const IntervalType &interval) const {
+         return this->range(detail::ContainedByIntervalQuery<IntervalType>{interval});
+      }
+
+      auto contained_by_interval_range(const IntervalType &interval) {
+         return this->range(detail::ContainedByIntervalQuery<IntervalType>{interval});
+      }
+
+      // Answers every point in one shared descent; sorted says the points are already ascending.
+      BatchType containing_points(const typename IntervalType::ValueType *points, std::size_t count, bool sorted=false) const {
+         auto order = detail::sorted_order(points, count, sorted);
+         std::vector<std::pair<std::size_t, const ValueType *>> pairs;
+         auto emit = [&pairs](std::size_t index, const ValueType &value) { pairs.emplace_back(index, &value); };
+
+         detail::stab_points<IntervalType>(this->derived().root_node(), order.data(), order.data() + order.size(), points, emit);
+
+         return BatchType(count, pairs);
+      }
+
+      BatchType containing_points(const std::vector<typename IntervalType::ValueType> &points, bool sorted=false) const {
+         return this->containing_points(points.data(), points.size(), sorted);
+      }
+
+      /* Sweeps the queries, ordered by low, in clusters whose hulls do not meet; each cluster is
+       * swept against the in-order run of intervals that overlap its own hull, so far-apart
+       * queries never walk the intervals between them. A query that spans every key gets every
+       * key, as overlapping_interval gives it.
+       */
+      BatchType overlapping_intervals(const IntervalType *intervals, std::size_t count, bool sorted=false) const {
+         if (count == 0) { return BatchType(); }
+
+         auto compare = typename IntervalType::Compare();
+         auto order = std::vector<std::size_t>(count);
+
+         for (std::size_t i = 0; i < count; ++i)
+            order[i] = i;
+
+         if (!sorted)
+            std::stable_sort(order.begin(), order.end(), [intervals](std::size_t left, std::size_t right) { return intervals[left].low < intervals[right].low; });
+
+         auto spanned = std::vector<bool>(count);
+
+         for (std::size_t i = 0; i < count; ++i)
+            spanned[i] = this->spanned_by(intervals[i]);
+
+         // Pairs reach emit when they overlap or the key lies inside the query; a spanning query takes both.
+         std::vector<std::pair<std::size_t, const ValueType *>> pairs;
+         auto emit = [&pairs, &spanned, intervals](const ValueType *value, std::size_t index) {
+            if (spanned[index] || KeyOfValue()(*value).overlaps(intervals[index])) { pairs.emplace_back(index, value); }
+         };
+         auto value_key = [](const ValueType *value) -> const IntervalType & { return KeyOfValue()(*value); };
+         auto query_key = [intervals](std::size_t index) -> const IntervalType & { return intervals[index]; };
+
+         for (auto first = order.begin(); first != order.end();)
+         {
+            auto hull = intervals[*first];
+            auto last = first + 1;
+
+            for (; last != order.end() && !(hull.high < intervals[*last].low); ++last)
+               hull = hull.join(intervals[*last]);
+
+            auto candidates = this->overlapping_interval_range(hull);
+            using Iterator = detail::AddressIterator<decltype(candidates.begin())>;
+
+            detail::sweep_join<IntervalType>(Iterator{candidates.begin()}, Iterator{candidates.end()}, first, last, value_key, query_key, detail::OverlapOrContainedByMatch(), emit);
+            first = last;
+         }
+
+         auto result = BatchType(count, pairs);
+
+         for (std::size_t i = 0; i < count; ++i)
+            std::sort(result.hits.begin() + result.offsets[i], result.hits.begin() + result.offsets[i + 1], [&compare](const ValueType *left, const ValueType *right) {
+               return compare(KeyOfValue()(*left), KeyOfValue()(*right));
+            });
+
+         return result;
+      }
+
+      BatchType overlapping_intervals(const std::vector<IntervalType> &intervals, bool sorted=false) const {
+         return this->overlapping_intervals(intervals.data(), intervals.size(), sorted);
+      }
+
+      template <typename Visitor>
+      bool for_each_value(Visitor &&visitor) const {
+         auto forward = [&visitor](const ValueType &value) { return detail::invoke_visitor(visitor, value); };
+         return detail::visit_nodes(this->derived().root_node(), forward);
+      }
+
+      template <typename Visitor>
+      bool for_each_value(Visitor &&visitor) {
+         auto forward = [&visitor](VisitType &value) { return detail::invoke_visitor(visitor, value); };
+         return detail::visit_nodes(this->derived().root_node(), forward);
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_point(const typename IntervalType::ValueType &point, Visitor &&visitor) const {
+         return this->visit(detail::ContainingPointQuery<IntervalType>{point}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_point(const typename IntervalType::ValueType &point, Visitor &&visitor) {
+         return this->visit(detail::ContainingPointQuery<IntervalType>{point}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_interval(const IntervalType &interval, Visitor &&visitor) const {
+         return this->visit(detail::ContainingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_interval(const IntervalType &interval, Visitor &&visitor) {
+         return this->visit(detail::ContainingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_overlapping_interval(const IntervalType &interval, Visitor &&visitor) const {
+         if (this->spanned_by(interval)) { return this->visit(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor); }
+
+         return this->visit(detail::OverlappingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_overlapping_interval(const IntervalType &interval, Visitor &&visitor) {
+         if (this->spanned_by(interval)) { return this->visit(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor); }
+
+         return this->visit(detail::OverlappingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_contained_by_interval(const IntervalType &interval, Visitor &&visitor) const {
+         return this->visit(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_contained_by_interval(const IntervalType &interval, Visitor &&visitor) {
+         return this->visit(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor);
+      }
+   };
+
+   template <typename IntervalType, typename ValueType, typename KeyOfValue>
+   class IntervalTreeBase : public AVLTreeBase<IntervalType, ValueType, KeyOfValue, typename IntervalType::Compare>,
+                            public IntervalQueries<IntervalTreeBase<IntervalType, ValueType, KeyOfValue>, IntervalType, ValueType, KeyOfValue>
+   {
+      static_assert(std::is_base_of<Interval<typename IntervalType::ValueType, IntervalType::Inclusive>, IntervalType>::value,
+                    "IntervalType template argument must derive the Interval structure.");
+      
+   public:
+      using SetType = std::set<IntervalType, typename IntervalType::Compare>;
+      
+      class IntervalNode : public AVLTreeBase::Node
+      {
+      protected:
+         typename IntervalType::ValueType _max;
+         typename IntervalType::ValueType _min_low;
+         typename IntervalType::ValueType _gap;
+         std::size_t _count;
+
+      public:
+         friend class IntervalTreeBase;
+         
+         IntervalNode() : _max(0), _min_low(0), _gap(0), _count(1), AVLTreeBase::Node() {}
+         IntervalNode(const typename AVLTreeBase::ValueType &value)
+            : _max(KeyOfValue()(value).high), _min_low(KeyOfValue()(value).low), _gap(0), _count(1), AVLTreeBase::Node(value) {}
+         IntervalNode(const IntervalNode &other)
+            : _max(other._max), _min_low(other._min_low), _gap(other._gap), _count(other._count), AVLTreeBase::Node(other) {}
+
+         virtual void copy_node_data(const typename AVLTreeBase::Node &node) {
+            AVLTreeBase::Node::copy_node_data(node);
+
+            // only ever handed nodes of this tree, so no RTTI check (or copy) is needed
+            this->_max = static_cast<const IntervalNode &>(node)._max;
+            this->_min_low = static_cast<const IntervalNode &>(node)._min_low;
+            this->_gap = static_cast<const IntervalNode &>(node)._gap;
+            this->_count = static_cast<const IntervalNode &>(node)._count;
+         }
+         
+         inline IntervalNode *left_node() { return static_cast<IntervalNode *>(this->left().get()); }
+         inline const IntervalNode *left_node() const { return static_cast<const IntervalNode *>(this->left().get()); }
+         inline IntervalNode *right_node() { return static_cast<IntervalNode *>(this->right().get()); }
+         inline const IntervalNode *right_node() const { return static_cast<const IntervalNode *>(this->right().get()); }
+         inline IntervalNode *parent_node() { return static_cast<IntervalNode *>(this->parent().get()); }
+         inline const IntervalNode *parent_node() const { return static_cast<const IntervalNode *>(this->parent().get()); }
+
+         inline typename IntervalType::ValueType &max() { return this->_max; }
+         inline const typename IntervalType::ValueType &max() const { return this->_max; }
+         typename IntervalType::ValueType new_max() const {
+            auto left = this->left_node();
+            auto right = this->right_node();
+
+            auto left_max = (left != nullptr) ? left->max() : this->key().high;
+            auto right_max = (right != nullptr) ? right->max() : this->key().high;
+
+            return std::max(this->key().high, std::max(left_max, right_max));
+         }
+
+         // Number of nodes in this subtree, this one included.
+         inline std::size_t count() const { return this->_count; }
+         std::size_t new_count() const {
+            return 1 + detail::subtree_count(this->left_node()) + detail::subtree_count(this->right_node());
+         }
+
+         // Lowest low in this subtree, and the largest free span between its intervals.
+         inline const typename IntervalType::ValueType &min_low() const { return this->_min_low; }
+         inline const typename IntervalType::ValueType &gap() const { return this->_gap; }
+         typename IntervalType::ValueType new_min_low() const {
+            return (this->left_node() != nullptr) ? this->left_node()->min_low() : this->key().low;
+         }
+         typename IntervalType::ValueType new_gap() const {
+            return detail::subtree_gap(this->left_node(), this->key(), this->right_node());
+         }
+      };
+
+      using NodePointer = std::shared_ptr<IntervalNode>;
+      using Finger = detail::Finger<const IntervalNode>;
+
+   protected:
+      // Set by allocate_node(), so try_insert() can tell a new node from the one already holding the key.
+      bool _allocated = false;
+
+      // Refreshes the augmentation from node toward the root, stopping at the first ancestor it leaves unchanged.
+      void update_max(typename AVLTreeBase::SharedNode node) {
+         auto update = std::static_pointer_cast<IntervalNode>(node);
+
+         while (update != nullptr)
+         {
+            auto max = update->new_max();
+            auto min_low = update->new_min_low();
+            auto gap = update->new_gap();
+            auto count = update->new_count();
+
+            if (update != node && max == update->_max && min_low == update->_min_low && gap == update->_gap && count == update->_count) { break; }
+
+            update->_max = max;
+            update->_min_low = min_low;
+            update->_gap = gap;
+            update->_count = count;
+            this->stats_max_update();
+
+            update = std::static_pointer_cast<IntervalNode>(update->parent());
+         }
+      }
+
+      virtual void rotate_left(typename AVLTreeBase::SharedNode node) {
+         AVLTreeBase::rotate_left(node);
+         this->stats_rotation();
+         this->update_max(node);
+      }
+
+      virtual void rotate_right(typename AVLTreeBase::SharedNode node) {
+         AVLTreeBase::rotate_right(node);
+         this->stats_rotation();
+         this->update_max(node);
+      }
+
+      virtual typename AVLTreeBase::SharedNode allocate_node(const typename AVLTreeBase::ValueType &value) {
+         auto node = std::make_shared<IntervalNode>(value);
+         this->stats_allocation();
+         this->_allocated = true;
+
+         return node;
+      }
+
+      virtual typename AVLTreeBase::SharedNode copy_node(typename AVLTreeBase::ConstSharedNode node) {
+         auto upcast_node = std::static_pointer_cast<const IntervalNode>(node);
+         auto new_node = std::make_shared<IntervalNode>(*upcast_node);
+         this->stats_allocation();
+
+         return new_node;
+      }
+
+      virtual void update_node(typename AVLTreeBase::SharedNode node) {
+         this->update_max(node);
+         return AVLTreeBase::update_node(node);
+      }
+
+      template <typename Keys>
+      std::size_t erase_keys(const Keys &keys) {
+         for (auto &key : keys)
+            this->remove(key);
+
+         return keys.size();
+      }
+
+   public:
+      IntervalTreeBase() : AVLTreeBase() {}
+      IntervalTreeBase(std::vector<ValueType> &nodes) : AVLTreeBase() { this->bulk_insert(nodes.begin(), nodes.end()); }
+      IntervalTreeBase(std::vector<ValueType> &&nodes, BulkOrder order=BulkOrder::Unsorted, const Parallel &parallel=Parallel(1)) : AVLTreeBase() {
+         this->bulk_insert(nodes.begin(), nodes.end(), order, parallel);
+      }
+      template <typename Iterator>
+      IntervalTreeBase(Iterator first, Iterator last, BulkOrder order=BulkOrder::Unsorted, const Parallel &parallel=Parallel(1)) : AVLTreeBase() {
+         this->bulk_insert(first, last, order, parallel);
+      }
+      IntervalTreeBase(const IntervalTreeBase &other) : AVLTreeBase(other) {}
+
+      std::shared_ptr<IntervalNode> insert(const ValueType &value) {
+         return std::static_pointer_cast<IntervalNode>(AVLTreeBase::insert(value));
+      }
+
+      // Inserts value unless its key is present, in a single descent. The bool is whether it went in.
+      std::pair<std::shared_ptr<IntervalNode>, bool> try_insert(const ValueType &value) {
+         this->_allocated = false;
+         auto node = this->insert(value);
+
+         return { node, this->_allocated };
+      }
+
+      // avltree offers no way to link nodes directly, so values go in breadth-first by median.
+      // Each insert then lands on a balanced tree and never rotates. Only the sort runs in parallel.
+      template <typename Iterator>
+      void bulk_insert(Iterator first, Iterator last, BulkOrder order=BulkOrder::Unsorted, const Parallel &parallel=Parallel(1)) {
+         auto sorted = detail::bulk_order<IntervalType, KeyOfValue>(first, last, order, parallel.count());
+         std::vector<std::pair<std::size_t, std::size_t>> ranges;
+
+         if (sorted.size() > 0) { ranges.emplace_back(0, sorted.size()); }
+
+         for (std::size_t head = 0; head < ranges.size(); ++head)
+         {
+            auto low = ranges[head].first;
+            auto high = ranges[head].second;
+            auto middle = low + (high - low) / 2;
+
+            this->insert(*sorted[middle]);
+
+            if (low < middle) { ranges.emplace_back(low, middle); }
+            if (middle + 1 < high) { ranges.emplace_back(middle + 1, high); }
+         }
+      }
+
+      // Both return how many intervals were erased. avltree cannot cut or link subtrees, so each
+      // hit is removed on its own: O(k log n).
+      std::size_t erase_overlapping(const IntervalType &interval) {
+         return this->erase_keys(this->overlapping_interval(interval));
+      }
+
+      std::size_t erase_contained_by(const IntervalType &interval) {
+         return this->erase_keys(this->contained_by_interval(interval));
+      }
+
+      // Node and slack sizes are estimates here: make_shared and the allocator add their own headers.
+      MemoryUsage memory_usage() const {
+         auto nodes = detail::subtree_count(this->root_node());
+         auto node_size = detail::shared_block_size<IntervalNode>();
+
+         return detail::memory_usage<IntervalType, ValueType>(nodes, node_size, nodes * detail::heap_block_size(node_size));
+      }
+
+      /* Rebuilds the tree by median insertion into a fresh tree, which never rotates and comes out
+       * balanced, then assigns it over this one through avltree, which frees the old nodes. Where
+       * avltree cannot move a tree the assignment copies the nodes once more, doubling the
+       * allocations. If an allocation throws, the tree is left as it was. Node placement is up to
+       * the allocator. Values are copied, O(n log n).
+       */
+      void shrink_to_fit() {
+         std::vector<ValueType> values;
+         values.reserve(detail::subtree_count(this->root_node()));
+
+         for (auto node = detail::InOrderIterator<IntervalNode>(this->root_node()); node != detail::InOrderIterator<IntervalNode>(nullptr); ++node)
+            values.push_back(**node);
+
+         IntervalTreeBase fresh(values.begin(), values.end(), BulkOrder::Trusted);
+
+         static_cast<AVLTreeBase &>(*this) = std::move(static_cast<AVLTreeBase &>(fresh));
+         this->stats_allocation(values.size());
+      }
+         
+      inline IntervalNode *root_node() { return static_cast<IntervalNode *>(this->root().get()); }
+      inline const IntervalNode *root_node() const { return static_cast<const IntervalNode *>(this->root().get()); }
+   };
+
+   template <typename Node, std::size_t ChunkSize>
+   class NodeArena
+   {
+      union Slot {
+         Slot *next;
+         typename std::aligned_storage<sizeof(Node), alignof(Node)>::type storage;
+      };
+
+      std::vector<std::unique_ptr<Slot[]>> _chunks;
+      std::size_t _chunk;
+      std::size_t _offset;
+      Slot *_free;
+
+   public:
+      // A run of slots handed out by claim(); slot i may be constructed from any thread.
+      class Block
+      {
+         friend class NodeArena;
+
+         std::vector<Slot *> _chunks;
+         std::size_t _first;
+
+      public:
+         inline void *operator[](std::size_t index) const {
+            auto position = this->_first + index;
+            return &this->_chunks[position / ChunkSize][position % ChunkSize].storage;
+         }
+      };
+
+      NodeArena() : _chunk(0), _offset(0), _free(nullptr) {}
+      NodeArena(const NodeArena &other) = delete;
+      NodeArena(NodeArena &&other) noexcept
+         : _chunks(std::move(other._chunks)), _chunk(other._chunk), _offset(other._offset), _free(other._free) {
+         other.reset();
+      }
+
+      NodeArena &operator=(const NodeArena &other) = delete;
+      NodeArena &operator=(NodeArena &&other) noexcept {
+         this->_chunks = std::move(other._chunks);
+         this->_chunk = other._chunk;
+         this->_offset = other._offset;
+         this->_free = other._free;
+         other.reset();
+
+         return *this;
+      }
+
+      template <typename... Args>
+      Node *create(Args &&... args) {
+         Slot *slot;
+
+         if (this->_free != nullptr)
+         {
+            slot = this->_free;
+            this->_free = slot->next;
+         }
+         else
+         {
+            if (this->_chunk < this->_chunks.size() && this->_offset == ChunkSize)
+            {
+               ++this->_chunk;
+               this->_offset = 0;
+            }
+
+            if (this->_chunk == this->_chunks.size())
+               this->_chunks.emplace_back(new Slot[ChunkSize]);
+
+            slot = &this->_chunks[this->_chunk][this->_offset++];
+         }
+
+         return new (&slot->storage) Node(std::forward<Args>(args)...);
+      }
+
+      // Takes the next count bump-allocated slots at once, bypassing the free list.
+      Block claim(std::size_t count) {
+         Block block;
+
+         if (this->_chunk < this->_chunks.size() && this->_offset == ChunkSize)
+         {
+            ++this->_chunk;
+            this->_offset = 0;
+         }
+
+         block._first = this->_offset;
+
+         while (count > 0)
+         {
+            if (this->_chunk == this->_chunks.size())
+               this->_chunks.emplace_back(new Slot[ChunkSize]);
+
+            auto taken = std::min(count, ChunkSize - this->_offset);
+
+            block._chunks.push_back(this->_chunks[this->_chunk].get());
+            count -= taken;
+            this->_offset += taken;
+
+            if (count > 0)
+            {
+               ++this->_chunk;
+               this->_offset = 0;
+            }
+         }
+
+         return block;
+      }
+
+      void destroy(Node *node) {
+         node->~Node();
+
+         auto slot = reinterpret_cast<Slot *>(node);
+         slot->next = this->_free;
+         this->_free = slot;
+      }
+
+      // Forgets every node without running destructors; chunks are kept for reuse.
+      void reset() {
+         this->_chunk = 0;
+         this->_offset = 0;
+         this->_free = nullptr;
+      }
+
+      /* Takes over other's chunks, and with them its nodes. Its used chunks go ahead of the one
+       * being filled here, its spare chunks to the back, and the unused tail of its current chunk
+       * and its free slots onto the free list.
+       */
+      void adopt(NodeArena &&other) {
+         auto used = std::min(other._chunk + ((other._offset > 0) ? 1 : 0), other._chunks.size());
+
+         if (other._offset > 0 && other._chunk < other._chunks.size())
+         {
+            for (auto offset = other._offset; offset < ChunkSize; ++offset)
+            {
+               auto slot = &other._chunks[other._chunk][offset];
+               slot->next = other._free;
+               other._free = slot;
+            }
+         }
+
+         if (other._free != nullptr)
+         {
+            auto tail = other._free;
+
+            while (tail->next != nullptr)
+               tail = tail->next;
+
+            tail->next = this->_free;
+            this->_free = other._free;
+         }
+
+         auto spare = std::min(this->_chunk, this->_chunks.size());
+
+         this->_chunks.insert(this->_chunks.begin() + static_cast<std::ptrdiff_t>(spare),
+                              std::make_move_iterator(other._chunks.begin()), std::make_move_iterator(other._chunks.begin() + static_cast<std::ptrdiff_t>(used)));
+         this->_chunk += used;
+         this->_chunks.insert(this->_chunks.end(), std::make_move_iterator(other._chunks.begin() + static_cast<std::ptrdiff_t>(used)), std::make_move_iterator(other._chunks.end()));
+
+         other._chunks.clear();
+         other.reset();
+      }
+
+      inline std::size_t capacity() const { return this->_chunks.size() * ChunkSize; }
+      inline std::size_t capacity_bytes() const { return this->capacity() * sizeof(Slot); }
+
+      // Everything the arena holds, chunk table included, however many nodes are live.
+      inline std::size_t held_bytes(std::size_t) const {
+         return this->capacity_bytes() + this->_chunks.capacity() * sizeof(std::unique_ptr<Slot[]>);
+      }
+
+      static constexpr std::size_t NodeSize = sizeof(Slot);
+      static constexpr bool Rewinds = true;
+      // Single nodes cannot move to another arena; adopt() moves them all.
+      static constexpr bool Transfers = false;
+   };
+
+   // One global allocation per node. reset() cannot reclaim anything, so owners destroy every node.
+   template <typename Node>
+   class NodeHeap
+   {
+   public:
+      class Block
+      {
+         friend class NodeHeap;
+
+         std::vector<void *> _slots;
+
+      public:
+         inline void *operator[](std::size_t index) const { return this->_slots[index]; }
+      };
+
+      template <typename... Args>
+      Node *create(Args &&... args) {
+         auto slot = ::operator new(sizeof(Node));
+
+         try { return new (slot) Node(std::forward<Args>(args)...); }
+         catch (...) { ::operator delete(slot); throw; }
+      }
+
+      Block claim(std::size_t count) {
+         Block block;
+         block._slots.reserve(count);
+
+         for (std::size_t i = 0; i < count; ++i)
+            block._slots.push_back(::operator new(sizeof(Node)));
+
+         return block;
+      }
+
+      void destroy(Node *node) {
+         node->~Node();
+         ::operator delete(node);
+      }
+
+      void reset() {}
+      void adopt(NodeHeap &&) {}
+
+      inline std::size_t held_bytes(std::size_t nodes) const { return nodes * detail::heap_block_size(sizeof(Node)); }
+
+      static constexpr std::size_t NodeSize = sizeof(Node);
+      static constexpr bool Rewinds = false;
+      static constexpr bool Transfers = true;
+   };
+
+   template <std::size_t ChunkSize=1024>
+   struct ArenaNodes
+   {
+      template <typename Node>
+      using Pool = NodeArena<Node, ChunkSize>;
+   };
+
+   struct HeapNodes
+   {
+      template <typename Node>
+      using Pool = NodeHeap<Node>;
+   };
+
+   /* A self-contained AVL core: raw pointer links and non-virtual, inlined augmentation, so no hook
+    * goes through a vtable and no child access needs RTTI. Nodes come from Nodes::Pool, either the
+    * arena slabs or one heap allocation each.
+    */
+   template <typename IntervalType, typename _ValueType, typename KeyOfValue, typename Nodes=ArenaNodes<>>
+   class ArenaIntervalTreeBase : public IntervalQueries<ArenaIntervalTreeBase<IntervalType, _ValueType, KeyOfValue, Nodes>, IntervalType, _ValueType, KeyOfValue>
+   {
+      static_assert(std::is_base_of<Interval<typename IntervalType::ValueType, IntervalType::Inclusive>, IntervalType>::value,
+                    "IntervalType template argument must derive the Interval structure.");
+
+   public:
+      using KeyType = IntervalType;
+      using ValueType = _ValueType;
+      using SetType = std::set<IntervalType, typename IntervalType::Compare>;
+
+      class IntervalNode
+      {
+      protected:
+         ValueType _value;
+         typename IntervalType::ValueType _max;
+         typename IntervalType::ValueType _min_low;
+         typename IntervalType::ValueType _gap;
+         std::size_t _count;
+         IntervalNode *_left;
+         IntervalNode *_right;
+         IntervalNode *_parent;
+         std::int8_t _height;
+
+      public:
+         friend class ArenaIntervalTreeBase;
+
+         IntervalNode(const ValueType &value, IntervalNode *parent)
+            : _value(value), _max(KeyOfValue()(value).high), _min_low(KeyOfValue()(value).low), _gap(0), _count(1),
+              _left(nullptr), _right(nullptr), _parent(parent), _height(1) {}
+         IntervalNode(ValueType &&value, IntervalNode *parent)
+            : _value(std::move(value)), _max(KeyOfValue()(this->_value).high), _min_low(KeyOfValue()(this->_value).low), _gap(0), _count(1),
+              _left(nullptr), _right(nullptr), _parent(parent), _height(1) {}
+
+         // rekey() may have replaced _value, whose key is const, so it is only reached through std::launder.
+         inline const IntervalType &key() const { return KeyOfValue()(this->value()); }
+         inline ValueType &value() { return *std::launder(&this->_value); }
+         inline const ValueType &value() const { return *std::launder(&this->_value); }
+         inline const typename IntervalType::ValueType &max() const { return this->_max; }
+         inline const typename IntervalType::ValueType &min_low() const { return this->_min_low; }
+         inline const typename IntervalType::ValueType &gap() const { return this->_gap; }
+         inline std::size_t count() const { return this->_count; }
+         inline int height() const { return this->_height; }
+
+         inline IntervalNode *left_node() { return this->_left; }
+         inline const IntervalNode *left_node() const { return this->_left; }
+         inline IntervalNode *right_node() { return this->_right; }
+         inline const IntervalNode *right_node() const { return this->_right; }
+         inline IntervalNode *parent_node() { return this->_parent; }
+         inline const IntervalNode *parent_node() const { return this->_parent; }
+      };
+
+      using NodePointer = IntervalNode *;
+      using Finger = detail::Finger<const IntervalNode>;
+
+      class const_iterator
+      {
+         const IntervalNode *_node;
+
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using value_type = ValueType;
+         using difference_type = std::ptrdiff_t;
+         using pointer = const ValueType *;
+         using reference = const ValueType &;
+
+         const_iterator(const IntervalNode *root) : _node(root) {
+            if (this->_node == nullptr) { return; }
+
+            while (this->_node->left_node() != nullptr)
+               this->_node = this->_node->left_node();
+         }
+
+         reference operator*() const { return this->_node->value(); }
+         pointer operator->() const { return &this->_node->value(); }
+
+         const_iterator &operator++() {
+            if (this->_node->right_node() != nullptr)
+            {
+               this->_node = this->_node->right_node();
+
+               while (this->_node->left_node() != nullptr)
+                  this->_node = this->_node->left_node();
+            }
+            else
+            {
+               auto parent = this->_node->parent_node();
+
+               while (parent != nullptr && parent->right_node() == this->_node)
+               {
+                  this->_node = parent;
+                  parent = parent->parent_node();
+               }
+
+               this->_node = parent;
+            }
+
+            return *this;
+         }
+
+         const_iterator operator++(int) {
+            auto previous = *this;
+            ++(*this);
+            return previous;
+         }
+
+         bool operator==(const const_iterator &other) const { return this->_node == other._node; }
+         bool operator!=(const const_iterator &other) const { return this->_node != other._node; }
+      };
+
+   protected:
+      using NodePool = typename Nodes::template Pool<IntervalNode>;
+
+      IntervalNode *_root;
+      std::size_t _size;
+      NodePool _arena;
+
+      static inline int height(const IntervalNode *node) { return (node != nullptr) ? node->_height : 0; }
+
+      static void update(IntervalNode *node) {
+         node->_height = static_cast<std::int8_t>(1 + std::max(height(node->_left), height(node->_right)));
+         node->_max = node->key().high;
+         node->_min_low = (node->_left != nullptr) ? node->_left->_min_low : node->key().low;
+         node->_gap = detail::subtree_gap(node->_left, node->key(), node->_right);
+         node->_count = 1 + detail::subtree_count(node->_left) + detail::subtree_count(node->_right);
+
+         if (node->_left != nullptr && node->_max < node->_left->_max) { node->_max = node->_left->_max; }
+         if (node->_right != nullptr && node->_max < node->_right->_max) { node->_max = node->_right->_max; }
+      }
+
+      void replace_child(IntervalNode *parent, IntervalNode *child, IntervalNode *replacement) {
+         if (replacement != nullptr) { replacement->_parent = parent; }
+
+         if (parent == nullptr) { this->_root = replacement; }
+         else if (parent->_left == child) { parent->_left = replacement; }
+         else { parent->_right = replacement; }
+      }
+
+      IntervalNode *rotate_left(IntervalNode *node) {
+         auto pivot = node->_right;
+
+         node->_right = pivot->_left;
+         if (node->_right != nullptr) { node->_right->_parent = node; }
+
+         this->replace_child(node->_parent, node, pivot);
+         pivot->_left = node;
+         node->_parent = pivot;
+         this->stats_rotation();
+
+         update(node);
+         update(pivot);
+
+         return pivot;
+      }
+
+      IntervalNode *rotate_right(IntervalNode *node) {
+         auto pivot = node->_left;
+
+         node->_left = pivot->_right;
+         if (node->_left != nullptr) { node->_left->_parent = node; }
+
+         this->replace_child(node->_parent, node, pivot);
+         pivot->_right = node;
+         node->_parent = pivot;
+         this->stats_rotation();
+
+         update(node);
+         update(pivot);
+
+         return pivot;
+      }
+
+      IntervalNode *balance(IntervalNode *node) {
+         auto factor = height(node->_left) - height(node->_right);
+
+         if (factor > 1)
+         {
+            if (height(node->_left->_left) < height(node->_left->_right))
+               this->rotate_left(node->_left);
+
+            return this->rotate_right(node);
+         }
+         else if (factor < -1)
+         {
+            if (height(node->_right->_right) < height(node->_right->_left))
+               this->rotate_right(node->_right);
+
+            return this->rotate_left(node);
+         }
+
+         return node;
+      }
+
+      // Walks toward the root until a subtree's height and augmentation come out unchanged. Nodes up to and
+      // including `through` are always refreshed, since a relinked node may carry stale augmentation.
+      void rebalance(IntervalNode *node, const IntervalNode *through=nullptr) {
+         while (node != nullptr)
+         {
+            auto old_height = node->_height;
+            auto old_max = node->_max;
+            auto old_count = node->_count;
+            auto old_min_low = node->_min_low;
+            auto old_gap = node->_gap;
+
+            if (node == through) { through = nullptr; }
+
+            update(node);
+            this->stats_max_update();
+            node = this->balance(node);
+
+            if (through == nullptr && node->_height == old_height && node->_max == old_max && node->_count == old_count
+                && node->_min_low == old_min_low && node->_gap == old_gap) { break; }
+
+            node = node->_parent;
+         }
+      }
+
+      void erase_node(IntervalNode *node) {
+         IntervalNode *rebalance_from;
+         IntervalNode *relinked = nullptr;
+
+         if (node->_left != nullptr && node->_right != nullptr)
+         {
+            auto successor = node->_right;
+
+            while (successor->_left != nullptr)
+               successor = successor->_left;
+
+            if (successor->_parent != node)
+            {
+               rebalance_from = successor->_parent;
+               this->replace_child(successor->_parent, successor, successor->_right);
+               successor->_right = node->_right;
+               successor->_right->_parent = successor;
+            }
+            else { rebalance_from = successor; }
+
+            successor->_left = node->_left;
+            successor->_left->_parent = successor;
+            successor->_height = node->_height;
+            successor->_max = node->_max;
+            successor->_count = node->_count;
+            successor->_min_low = node->_min_low;
+            successor->_gap = node->_gap;
+            this->replace_child(node->_parent, node, successor);
+            relinked = successor;
+         }
+         else
+         {
+            rebalance_from = node->_parent;
+            this->replace_child(node->_parent, node, (node->_left != nullptr) ? node->_left : node->_right);
+         }
+
+         this->_arena.destroy(node);
+         --this->_size;
+         this->rebalance(rebalance_from, relinked);
+      }
+
+      /* Joins two detached subtrees around pivot: every key of left sorts before pivot's and pivot's
+       * before every key of right. The shorter tree hangs off the taller one's spine and the path
+       * above is rebalanced, O(1 + height difference). _root is used as the working root.
+       */
+      IntervalNode *join_nodes(IntervalNode *left, IntervalNode *pivot, IntervalNode *right) {
+         if (left != nullptr) { left->_parent = nullptr; }
+         if (right != nullptr) { right->_parent = nullptr; }
+
+         pivot->_parent = nullptr;
+
+         if (height(left) > height(right) + 1)
+         {
+            auto node = left;
+
+            while (height(node->_right) > height(right) + 1)
+               node = node->_right;
+
+            pivot->_left = node->_right;
+            pivot->_right = right;
+            node->_right = pivot;
+            pivot->_parent = node;
+            this->_root = left;
+         }
+         else if (height(right) > height(left) + 1)
+         {
+            auto node = right;
+
+            while (height(node->_left) > height(left) + 1)
+               node = node->_left;
+
+            pivot->_right = node->_left;
+            pivot->_left = left;
+            node->_left = pivot;
+            pivot->_parent = node;
+            this->_root = right;
+         }
+         else
+         {
+            pivot->_left = left;
+            pivot->_right = right;
+            this->_root = pivot;
+         }
+
+         if (pivot->_left != nullptr) { pivot->_left->_parent = pivot; }
+         if (pivot->_right != nullptr) { pivot->_right->_parent = pivot; }
+
+         update(pivot);
+         if (pivot->_parent != nullptr) { this->rebalance(pivot->_parent, pivot->_parent); }
+
+         return this->_root;
+      }
+
+      // Joins two detached subtrees, the first of right's nodes serving as the pivot.
+      IntervalNode *concat_nodes(IntervalNode *left, IntervalNode *right) {
+         if (left == nullptr) { return right; }
+         if (right == nullptr) { return left; }
+
+         auto pivot = right;
+
+         while (pivot->_left != nullptr)
+            pivot = pivot->_left;
+
+         auto parent = pivot->_parent;
+
+         this->_root = right;
+         right->_parent = nullptr;
+         this->replace_child(parent, pivot, pivot->_right);
+         if (parent != nullptr) { this->rebalance(parent, parent); }
+
+         return this->join_nodes(left, pivot, this->_root);
+      }
+
+      /* Cuts a detached subtree into the nodes ordered before key (or up to and including it, when
+       * inclusive) and the rest, rejoining the pieces on the way up: O(log n) in all.
+       */
+      std::pair<IntervalNode *, IntervalNode *> split_nodes(IntervalNode *node, const IntervalType &key, bool inclusive=false) {
+         if (node == nullptr) { return { nullptr, nullptr }; }
+
+         auto compare = typename IntervalType::Compare();
+         auto left = node->_left;
+         auto right = node->_right;
+
+         if (compare(node->key(), key) || (inclusive && !compare(key, node->key())))
+         {
+            auto parts = this->split_nodes(right, key, inclusive);
+            return { this->join_nodes(left, node, parts.first), parts.second };
+         }
+
+         auto parts = this->split_nodes(left, key, inclusive);
+         return { parts.first, this->join_nodes(parts.second, node, right) };
+      }
+
+      /* Erases the count keys from first through last if nothing else sorts between them: the run
+       * is split out and the two sides joined, O(log n + count). Otherwise erases nothing.
+       */
+      bool erase_run(const IntervalType &first, const IntervalType &last, std::size_t count) {
+         if (this->rank(last) - this->rank(first) + 1 != count) { return false; }
+
+         auto before = this->split_nodes(this->_root, first);
+         auto run = this->split_nodes(before.second, last, true);
+
+         this->destroy_nodes(run.first);
+         this->_root = this->concat_nodes(before.first, run.second);
+         this->_size -= count;
+
+         return true;
+      }
+
+      /* Erases the hits of query. When they form one run in key order (always, for disjoint
+       * intervals) the run is cut out in O(log n + k); otherwise each hit is erased on its own.
+       */
+      template <typename Query>
+      std::size_t erase_matching(const Query &query) {
+         std::vector<IntervalType> keys;
+         auto record = [&keys](const ValueType &value) { keys.push_back(KeyOfValue()(value)); return true; };
+
+         detail::visit_query(this->_root, query, record);
+
+         if (keys.empty()) { return 0; }
+         if (this->erase_run(keys.front(), keys.back(), keys.size())) { return keys.size(); }
+
+         for (auto &key : keys)
+            this->erase_node(this->lookup_node(key));
+
+         return keys.size();
+      }
+
+      /* Descends once for key and, only if it is absent, links a node holding make(); make is not
+       * called for a key already present. Returns the node and whether it was added.
+       */
+      template <typename Make>
+      std::pair<IntervalNode *, bool> emplace_node(const IntervalType &key, Make &&make) {
+         auto compare = typename IntervalType::Compare();
+         IntervalNode *parent = nullptr;
+         IntervalNode **link = &this->_root;
+
+         while (*link != nullptr)
+         {
+            parent = *link;
+
+            if (compare(key, parent->key())) { link = &parent->_left; }
+            else if (compare(parent->key(), key)) { link = &parent->_right; }
+            else { return { parent, false }; }
+         }
+
+         auto node = this->_arena.create(make(), parent);
+         this->stats_allocation();
+         *link = node;
+         ++this->_size;
+         this->rebalance(parent);
+
+         return { node, true };
+      }
+
+      /* Replaces a node's value, in place when the new key keeps the node's in-order position and
+       * the value moves without throwing; otherwise the node is unlinked and the value inserted.
+       * Returns the node now holding the value.
+       */
+      IntervalNode *rekey(IntervalNode *node, ValueType value) {
+         auto compare = typename IntervalType::Compare();
+         auto previous = detail::prev_node(node);
+         auto next = detail::next_node(node);
+         const auto &key = KeyOfValue()(value);
+
+         if (std::is_nothrow_move_constructible<ValueType>::value
+             && (previous == nullptr || compare(previous->key(), key))
+             && (next == nullptr || compare(key, next->key())))
+         {
+            node->value().~ValueType();
+            new (&node->_value) ValueType(std::move(value));
+            this->rebalance(node, node);
+
+            return node;
+         }
+
+         this->erase_node(node);
+
+         return this->insert(std::move(value));
+      }
+
+      // Consumes count values from iter in order, producing a perfectly balanced subtree.
+      template <typename Iterator, typename Project>
+      IntervalNode *build(Iterator &iter, std::size_t count, IntervalNode *parent, Project &project) {
+         if (count == 0) { return nullptr; }
+
+         auto left_count = count / 2;
+         auto left = this->build(iter, left_count, nullptr, project);
+         auto node = this->_arena.create(project(*iter), parent);
+         this->stats_allocation();
+         ++iter;
+
+         node->_left = left;
+         if (left != nullptr) { left->_parent = node; }
+
+         node->_right = this->build(iter, count - left_count - 1, node, project);
+         update(node);
+
+         return node;
+      }
+
+      template <bool Move, typename Iterator>
+      void build_from(Iterator first, Iterator last, BulkOrder order) {
+         auto project = [](auto &&value) -> decltype(auto) {
+            if constexpr (Move) { return std::move(value); }
+            else { return static_cast<const ValueType &>(value); }
+         };
+
+         if (order == BulkOrder::Checked && detail::strictly_sorted<IntervalType, KeyOfValue>(first, last)) { order = BulkOrder::Trusted; }
+
+         if (order == BulkOrder::Trusted)
+         {
+            auto count = static_cast<std::size_t>(std::distance(first, last));
+
+            this->_root = this->build(first, count, nullptr, project);
+            this->_size = count;
+
+            return;
+         }
+
+         auto sorted = detail::bulk_order<IntervalType, KeyOfValue>(first, last, order);
+         auto iter = detail::make_indirect_iterator(sorted.begin());
+
+         this->_root = this->build(iter, sorted.size(), nullptr, project);
+         this->_size = sorted.size();
+      }
+
+      static IntervalNode *link(IntervalNode *const *nodes, std::size_t count) {
+         if (count == 0) { return nullptr; }
+
+         auto left_count = count / 2;
+         auto node = nodes[left_count];
+
+         node->_parent = nullptr;
+         node->_left = link(nodes, left_count);
+         node->_right = link(nodes + left_count + 1, count - left_count - 1);
+
+         if (node->_left != nullptr) { node->_left->_parent = node; }
+         if (node->_right != nullptr) { node->_right->_parent = node; }
+
+         update(node);
+
+         return node;
+      }
+
+      // Splits [first, first + count) the way link() does, stopping depth levels down.
+      static void link_ranges(std::size_t first, std::size_t count, std::size_t depth, std::vector<std::pair<std::size_t, std::size_t>> &ranges) {
+         if (depth == 0 || count == 0)
+         {
+            ranges.emplace_back(first, count);
+            return;
+         }
+
+         auto left_count = count / 2;
+
+         link_ranges(first, left_count, depth - 1, ranges);
+         link_ranges(first + left_count + 1, count - left_count - 1, depth - 1, ranges);
+      }
+
+      static IntervalNode *link_top(IntervalNode *const *nodes, std::size_t count, std::size_t depth, IntervalNode *const *roots, std::size_t &next) {
+         if (depth == 0 || count == 0) { return roots[next++]; }
+
+         auto left_count = count / 2;
+         auto node = nodes[left_count];
+
+         node->_parent = nullptr;
+         node->_left = link_top(nodes, left_count, depth - 1, roots, next);
+         node->_right = link_top(nodes + left_count + 1, count - left_count - 1, depth - 1, roots, next);
+
+         if (node->_left != nullptr) { node->_left->_parent = node; }
+         if (node->_right != nullptr) { node->_right->_parent = node; }
+
+         update(node);
+
+         return node;
+      }
+
+      // Same shape as build(): nodes are constructed in parallel chunks, then the subtrees below
+      // the top levels are linked in parallel and the top levels are linked last.
+      template <bool Move, typename Iterator>
+      void build_parallel(Iterator first, Iterator last, BulkOrder order, std::size_t threads) {
+         auto sorted = detail::bulk_order<IntervalType, KeyOfValue>(first, last, order, threads);
+         auto count = sorted.size();
+         auto block = this->_arena.claim(count);
+         std::vector<IntervalNode *> nodes(count);
+         this->stats_allocation(count);
+
+         auto construct = [&](std::size_t part) {
+            auto high = std::min((part + 1) * detail::ParallelGrain, count);
+
+            for (auto i = part * detail::ParallelGrain; i < high; ++i)
+            {
+               if constexpr (Move) { nodes[i] = new (block[i]) IntervalNode(std::move(*sorted[i]), nullptr); }
+               else { nodes[i] = new (block[i]) IntervalNode(static_cast<const ValueType &>(*sorted[i]), nullptr); }
+            }
+         };
+
+         detail::parallel_tasks(threads, (count + detail::ParallelGrain - 1) / detail::ParallelGrain, construct);
+
+         std::size_t depth = 0;
+         std::vector<std::pair<std::size_t, std::size_t>> ranges;
+
+         while ((std::size_t(1) << depth) < 4 * threads && (count >> depth) > detail::ParallelGrain)
+            ++depth;
+
+         link_ranges(0, count, depth, ranges);
+
+         std::vector<IntervalNode *> roots(ranges.size());
+         auto link_range = [&](std::size_t range) { roots[range] = link(nodes.data() + ranges[range].first, ranges[range].second); };
+
+         detail::parallel_tasks(threads, ranges.size(), link_range);
+
+         std::size_t next = 0;
+
+         this->_root = link_top(nodes.data(), count, depth, roots.data(), next);
+         this->_size = count;
+      }
+
+      IntervalNode *clone(const IntervalNode *node, IntervalNode *parent) {
+         if (node == nullptr) { return nullptr; }
+
+         auto copy = this->_arena.create(node->value(), parent);
+         this->stats_allocation();
+         copy->_max = node->_max;
+         copy->_count = node->_count;
+         copy->_min_low = node->_min_low;
+         copy->_gap = node->_gap;
+         copy->_height = node->_height;
+         copy->_left = this->clone(node->_left, copy);
+         copy->_right = this->clone(node->_right, copy);
+
+         return copy;
+      }
+
+      // Destroys a detached subtree through pool, which need not be this tree's.
+      static void release(NodePool &pool, IntervalNode *node) {
+         if (node == nullptr) { return; }
+
+         release(pool, node->_left);
+         release(pool, node->_right);
+         pool.destroy(node);
+      }
+
+      void destroy_nodes(IntervalNode *node) { release(this->_arena, node); }
+
+   public:
+      ArenaIntervalTreeBase() : _root(nullptr), _size(0) {}
+      ArenaIntervalTreeBase(std::vector<ValueType> &nodes) : _root(nullptr), _size(0) {
+         this->bulk_insert(nodes.begin(), nodes.end());
+      }
+      ArenaIntervalTreeBase(std::vector<ValueType> &&nodes, BulkOrder order=BulkOrder::Unsorted, const Parallel &parallel=Parallel(1))
+         : _root(nullptr), _size(0) {
+         this->bulk_insert(std::move(nodes), order, parallel);
+      }
+      template <typename Iterator>
+      ArenaIntervalTreeBase(Iterator first, Iterator last, BulkOrder order=BulkOrder::Unsorted, const Parallel &parallel=Parallel(1))
+         : _root(nullptr), _size(0) {
+         this->bulk_insert(first, last, order, parallel);
+      }
+      ArenaIntervalTreeBase(const ArenaIntervalTreeBase &other) : _root(nullptr), _size(other._size) {
+         this->_root = this->clone(other._root, nullptr);
+      }
+      ArenaIntervalTreeBase(ArenaIntervalTreeBase &&other) noexcept
+         : _root(other._root), _size(other._size), _arena(std::move(other._arena)) {
+         other._root = nullptr;
+         other._size = 0;
+      }
+      ~ArenaIntervalTreeBase() {
+         if constexpr (!std::is_trivially_destructible<ValueType>::value || !NodePool::Rewinds) { this->destroy_nodes(this->_root); }
+      }
+
+      ArenaIntervalTreeBase &operator=(const ArenaIntervalTreeBase &other) {
+         if (this == &other) { return *this; }
+
+         this->clear();
+         this->_root = this->clone(other._root, nullptr);
+         this->_size = other._size;
+
+         return *this;
+      }
+
+      ArenaIntervalTreeBase &operator=(ArenaIntervalTreeBase &&other) noexcept {
+         if (this == &other) { return *this; }
+
+         this->clear();
+         this->_root = other._root;
+         this->_size = other._size;
+         this->_arena = std::move(other._arena);
+         other._root = nullptr;
+         other._size = 0;
+
+         return *this;
+      }
+
+      inline IntervalNode *root() { return this->_root; }
+      inline const IntervalNode *root() const { return this->_root; }
+      inline IntervalNode *root_node() { return this->_root; }
+      inline const IntervalNode *root_node() const { return this->_root; }
+      inline std::size_t size() const { return this->_size; }
+      inline bool empty() const { return this->_size == 0; }
+
+      const_iterator begin() const { return const_iterator(this->_root); }
+      const_iterator end() const { return const_iterator(nullptr); }
+
+      // Returns the existing node untouched if the key is already present; value is then left as it was.
+      IntervalNode *insert(const ValueType &value) {
+         return this->emplace_node(KeyOfValue()(value), [&value]() -> const ValueType & { return value; }).first;
+      }
+
+      IntervalNode *insert(ValueType &&value) {
+         return this->emplace_node(KeyOfValue()(value), [&value]() -> ValueType && { return std::move(value); }).first;
+      }
+
+      IntervalNode *add_node(const ValueType &value) { return this->insert(value); }
+
+      // An empty tree is built bottom-up in O(n) (plus the sort unless the input is known sorted);
+      // otherwise the values are inserted one at a time. The bottom-up build is what runs in parallel.
+      template <typename Iterator>
+      void bulk_insert(Iterator first, Iterator last, BulkOrder order=BulkOrder::Unsorted, const Parallel &parallel=Parallel(1)) {
+         if (this->_root != nullptr)
+         {
+            for (; first != last; ++first)
+               this->insert(*first);
+
+            return;
+         }
+
+         if (parallel.count() > 1) { this->build_parallel<false>(first, last, order, parallel.count()); }
+         else { this->build_from<false>(first, last, order); }
+      }
+
+      void bulk_insert(std::vector<ValueType> &&values, BulkOrder order=BulkOrder::Unsorted, const Parallel &parallel=Parallel(1)) {
+         if (this->_root != nullptr)
+         {
+            for (auto &value : values)
+               this->insert(value);
+
+            return;
+         }
+
+         if (parallel.count() > 1) { this->build_parallel<true>(values.begin(), values.end(), order, parallel.count()); }
+         else { this->build_from<true>(values.begin(), values.end(), order); }
+      }
+
+      void remove(const IntervalType &key) {
+         auto node = this->lookup_node(key);
+         if (node == nullptr) { throw exception::IntervalNotFound(); }
+
+         this->erase_node(node);
+      }
+
+      // Both return how many intervals were erased, the same ones the matching query returns.
+      std::size_t erase_overlapping(const IntervalType &interval) {
+         if (this->spanned_by(interval)) { return this->erase_matching(detail::ContainedByIntervalQuery<IntervalType>{interval}); }
+
+         return this->erase_matching(detail::OverlappingIntervalQuery<IntervalType>{interval});
+      }
+
+      std::size_t erase_contained_by(const IntervalType &interval) {
+         return this->erase_matching(detail::ContainedByIntervalQuery<IntervalType>{interval});
+      }
+
+      /* Moves every value ordered at or after key into right, replacing whatever right held. Heap
+       * nodes simply change owners, O(log n); arena nodes cannot leave their arena, so the smaller
+       * side is copied into a fresh one.
+       */
+      void split(const IntervalType &key, ArenaIntervalTreeBase &right) {
+         if (&right == this) { return; }
+
+         right.clear();
+
+         auto parts = this->split_nodes(this->_root, key);
+         auto left_count = detail::subtree_count(parts.first);
+         auto right_count = detail::subtree_count(parts.second);
+
+         if constexpr (NodePool::Transfers)
+         {
+            this->_root = parts.first;
+            right._root = parts.second;
+         }
+         else if (right_count <= left_count)
+         {
+            right._root = right.clone(parts.second, nullptr);
+            this->destroy_nodes(parts.second);
+            this->_root = parts.first;
+         }
+         else
+         {
+            std::swap(this->_arena, right._arena);
+            this->_root = this->clone(parts.first, nullptr);
+            right.destroy_nodes(parts.first);
+            right._root = parts.second;
+         }
+
+         this->_size = left_count;
+         right._size = right_count;
+      }
+
+      // Appends every value of right, which must all sort after this tree's, in O(log n). right is left empty.
+      void join(ArenaIntervalTreeBase &&right) {
+         if (&right == this || right._root == nullptr) { return; }
+
+         if (this->_root != nullptr)
+         {
+            auto last = this->_root;
+            auto first = right._root;
+
+            while (last->_right != nullptr)
+               last = last->_right;
+
+            while (first->_left != nullptr)
+               first = first->_left;
+
+            if (!typename IntervalType::Compare()(last->key(), first->key())) { throw exception::JoinOutOfOrder(); }
+         }
+
+         this->_arena.adopt(std::move(right._arena));
+         this->_root = this->concat_nodes(this->_root, right._root);
+         this->_size += right._size;
+         right._root = nullptr;
+         right._size = 0;
+      }
+
+      bool contains(const IntervalType &key) const { return this->lookup_node(key) != nullptr; }
+
+      IntervalNode *get(const IntervalType &key) {
+         auto node = this->lookup_node(key);
+         if (node == nullptr) { throw exception::IntervalNotFound(); }
+
+         return node;
+      }
+
+      const IntervalNode *get(const IntervalType &key) const {
+         auto node = this->lookup_node(key);
+         if (node == nullptr) { throw exception::IntervalNotFound(); }
+
+         return node;
+      }
+
+      std::vector<ValueType> to_vec() const {
+         std::vector<ValueType> result;
+         result.reserve(this->_size);
+
+         for (auto &value : *this)
+            result.push_back(value);
+
+         return result;
+      }
+
+      MemoryUsage memory_usage() const {
+         return detail::memory_usage<IntervalType, ValueType>(this->_size, NodePool::NodeSize, this->_arena.held_bytes(this->_size));
+      }
+
+      /* Rebuilds the tree in a fresh pool, allocating nodes in key order so that an in-order walk
+       * reads memory front to back, then frees the old pool with its free slots and spare chunks.
+       * Values are moved when that cannot throw and copied otherwise, and the tree comes out
+       * perfectly balanced. If anything throws, the moved values go back and the tree is left as
+       * it was. O(n).
+       */
+      void shrink_to_fit() {
+         std::vector<IntervalNode *> nodes;
+         nodes.reserve(this->_size);
+
+         auto fresh = NodePool();
+         auto end = detail::InOrderIterator<IntervalNode>(nullptr);
+
+         try
+         {
+            for (auto value = detail::InOrderIterator<IntervalNode>(this->_root); value != end; ++value)
+               nodes.push_back(fresh.create(std::move_if_noexcept(**value), nullptr));
+         }
+         catch (...)
+         {
+            auto value = detail::InOrderIterator<IntervalNode>(this->_root);
+
+            for (auto node : nodes)
+            {
+               if constexpr (std::is_nothrow_move_constructible<ValueType>::value)
+               {
+                  (*value)->~ValueType();
+                  new (*value) ValueType(std::move(node->value()));
+               }
+
+               fresh.destroy(node);
+               ++value;
+            }
+
+            throw;
+         }
+
+         this->stats_allocation(nodes.size());
+
+         auto old_root = this->_root;
+         auto old_pool = std::move(this->_arena);
+
+         this->_arena = std::move(fresh);
+         this->_root = link(nodes.data(), nodes.size());
+
+         if constexpr (!std::is_trivially_destructible<ValueType>::value || !NodePool::Rewinds) { release(old_pool, old_root); }
+      }
+
+      // Constant time with arena nodes when ValueType is trivially destructible: the arena is rewound, not walked.
+      void clear() {
+         if constexpr (!std::is_trivially_destructible<ValueType>::value || !NodePool::Rewinds) { this->destroy_nodes(this->_root); }
+
+         this->_arena.reset();
+         this->_root = nullptr;
+         this->_size = 0;
+      }
+   };
+
+   struct SharedStorage
+   {
+      template <typename IntervalType, typename ValueType, typename KeyOfValue>
+      using Base = IntervalTreeBase<IntervalType, ValueType, KeyOfValue>;
+   };
+
+   /* Keeps nodes in 1024-node slabs linked by raw pointers. For Interval<std::uintptr_t> keys an
+    * arena node is 80 bytes (88 with a std::size_t mapped value); a shared node adds the
+    * make_shared control block, a vtable pointer, three smart-pointer links and the allocator's
+    * per-block header on top. memory_usage() breaks down what a given tree holds. clear()
+    * rewinds the slabs instead of freeing them.
+    */
+   struct ArenaStorage
+   {
+      template <typename IntervalType, typename ValueType, typename KeyOfValue>
+      using Base = ArenaIntervalTreeBase<IntervalType, ValueType, KeyOfValue>;
+   };
+
+   // The arena engine's statically dispatched core with ordinary per-node heap allocation.
+   struct HeapStorage
+   {
+      template <typename IntervalType, typename ValueType, typename KeyOfValue>
+      using Base = ArenaIntervalTreeBase<IntervalType, ValueType, KeyOfValue, HeapNodes>;
+   };
+
+   template <typename IntervalType, typename Storage=SharedStorage>
+   class IntervalTree : public Storage::template Base<IntervalType, IntervalType, avltree::KeyIsValue<IntervalType>>
+   {
+   public:
+      using BaseType = typename Storage::template Base<IntervalType, IntervalType, avltree::KeyIsValue<IntervalType>>;
+      using iterator = typename BaseType::const_iterator;
+
+      IntervalTree() : BaseType() {}
+      IntervalTree(std::vector<IntervalType> &nodes) : BaseType(nodes) {}
+      IntervalTree(std::vector<IntervalType> &&nodes, BulkOrder order=BulkOrder::Unsorted, const Parallel &parallel=Parallel(1))
+         : BaseType(std::move(nodes), order, parallel) {}
+      template <typename Iterator>
+      IntervalTree(Iterator first, Iterator last, BulkOrder order=BulkOrder::Unsorted, const Parallel &parallel=Parallel(1))
+         : BaseType(first, last, order, parallel) {}
+      IntervalTree(const IntervalTree &other) : BaseType(other) {}
+
+      iterator begin() const { return iterator(this->root()); }
+      iterator end() const { return iterator(nullptr); }
+      iterator cbegin() const { return this->begin(); }
+      iterator cend() const { return this->end(); }
+
+      // nullptr when interval is not in the tree.
+      const IntervalType *find(const IntervalType &interval) const {
+         auto node = this->lookup_node(interval);
+
+         return (node != nullptr) ? &node->key() : nullptr;
+      }
+      
+      typename BaseType::NodePointer insert_overlap(const IntervalType &interval)
+      {
+         auto overlaps = this->overlapping_interval(interval);
+         auto final_interval = interval;
+
+         if (overlaps.size() != 0)
+         {
+            for (auto overlap : overlaps)
+            {
+               final_interval = final_interval.join(overlap);
+               this->remove(overlap);
+            }
+         }
+
+         return this->insert(final_interval);
+      }
+
+      // One merge_overlaps pass over the sorted values. Intervals starting at the lowest bound are
+      // always joined, as the old query-per-interval deoverlap did through spanning queries.
+      IntervalTree deoverlap() const { return this->deoverlap(Parallel(1)); }
+
+      // Same result as deoverlap(): chunks of the sorted intervals are merged in parallel, then the
+      // much shorter list of merged runs is merged once more across chunk boundaries.
+      IntervalTree deoverlap(const Parallel &parallel) const {
+         auto values = this->to_vec();
+         auto lowest = values.empty() ? typename IntervalType::ValueType() : values.front().low;
+         auto threads = parallel.count();
+         auto parts = std::max<std::size_t>(1, std::min(threads, values.size() / detail::ParallelGrain));
+         std::vector<std::vector<IntervalType>> runs(parts);
+
+         auto merge = [&](std::size_t part) {
+            auto first = values.begin() + static_cast<std::ptrdiff_t>(values.size() * part / parts);
+            auto last = values.begin() + static_cast<std::ptrdiff_t>(values.size() * (part + 1) / parts);
+
+            runs[part] = detail::merge_overlaps<IntervalType>(first, last, lowest);
+         };
+
+         detail::parallel_tasks(threads, parts, merge);
+
+         std::vector<IntervalType> joined;
+
+         for (auto &run : runs)
+            joined.insert(joined.end(), run.begin(), run.end());
+
+         return IntervalTree(detail::merge_overlaps<IntervalType>(joined.begin(), joined.end(), lowest), BulkOrder::Checked, parallel);
+      }
+   };
+
+   template <typename IntervalType, typename Value, typename Storage=SharedStorage>
+   class IntervalMap : public Storage::template Base<IntervalType, std::pair<const IntervalType, Value>, avltree::KeyOfPair<IntervalType, Value>>
+   {
+   public:
+      using BaseType = typename Storage::template Base<IntervalType, std::pair<const IntervalType, Value>, avltree::KeyOfPair<IntervalType, Value>>;
+
+   protected:
+      using NodeType = typename std::remove_pointer<decltype(std::declval<BaseType &>().root_node())>::type;
+
+      // Raw-pointer engines can rewrite a node's key in place; avltree nodes are removed and re-added.
+      static constexpr bool InPlace = std::is_pointer<typename BaseType::NodePointer>::value;
+
+      static_assert(InPlace || std::is_copy_constructible<Value>::value,
+                    "SharedStorage copies every entry into its node: a move-only Value needs ArenaStorage or HeapStorage.");
+
+      static inline bool empty_interval(const IntervalType &interval) {
+         return !IntervalType::Inclusive && interval.low == interval.high;
+      }
+
+      static inline bool touches(const IntervalType &left, const IntervalType &right) {
+         if constexpr (IntervalType::Inclusive) { return left.high < right.low && right.low - left.high == 1; }
+         else { return left.high == right.low; }
+      }
+
+      NodeType *place(const IntervalType &key, const Value &value) {
+         return &*BaseType::insert(typename BaseType::ValueType(key, value));
+      }
+
+      NodeType *place(const IntervalType &key, Value &&value) {
+         return &*BaseType::insert(typename BaseType::ValueType(key, std::move(value)));
+      }
+
+      /* Adds the entry make() builds unless key is present. Raw-pointer engines find the spot and
+       * link the node in one descent. avltree also inserts in one descent, but takes a built entry
+       * and copies it into the node; when building it would move from the caller's arguments
+       * (Consumes), the key is looked up first so a present key leaves them untouched.
+       */
+      template <bool Consumes, typename Make>
+      std::pair<NodeType *, bool> emplace_with(const IntervalType &key, Make &&make) {
+         if constexpr (InPlace) { return this->emplace_node(key, make); }
+         else
+         {
+            if constexpr (Consumes)
+            {
+               auto node = this->lookup_node(key);
+               if (node != nullptr) { return { node, false }; }
+            }
+
+            auto result = this->try_insert(make());
+
+            return { &*result.first, result.second };
+         }
+      }
+
+      void unlink(NodeType *node) {
+         if constexpr (InPlace) { this->erase_node(node); }
+         else
+         {
+            auto key = node->key();
+            this->remove(key);
+         }
+      }
+
+      NodeType *replace(NodeType *node, const IntervalType &key, const Value &value) {
+         if constexpr (InPlace) { return this->rekey(node, typename BaseType::ValueType(key, value)); }
+         else
+         {
+            auto copy = value;
+
+            this->unlink(node);
+
+            return this->place(key, std::move(copy));
+         }
+      }
+
+      // value must not live in node, which may be unlinked before value is moved.
+      NodeType *replace(NodeType *node, const IntervalType &key, Value &&value) {
+         if constexpr (InPlace) { return this->rekey(node, typename BaseType::ValueType(key, std::move(value))); }
+         else
+         {
+            this->unlink(node);
+
+            return this->place(key, std::move(value));
+         }
+      }
+
+      static inline bool inside(const IntervalType &key, const IntervalType &interval) {
+         return !(key.low < interval.low) && !(interval.high < key.high);
+      }
+
+      // Cuts an entry crossing an end of interval down to its parts outside it, splitting it in two
+      // when it crosses both.
+      void trim(NodeType *node, const IntervalType &interval) {
+         auto key = node->key();
+         auto keep_left = key.low < interval.low;
+         auto keep_right = interval.high < key.high;
+         IntervalType left, right;
+
+         if constexpr (IntervalType::Inclusive)
+         {
+            if (keep_left) { left = IntervalType(key.low, interval.low - 1); }
+            if (keep_right) { right = IntervalType(interval.high + 1, key.high); }
+         }
+         else
+         {
+            if (keep_left) { left = IntervalType(key.low, interval.low); }
+            if (keep_right) { right = IntervalType(interval.high, key.high); }
+         }
+
+         if (keep_left && keep_right)
+         {
+            auto value = node->value().second;
+
+            this->replace(node, left, value);
+            this->place(right, std::move(value));
+         }
+         else if (keep_left) { this->replace(node, left, node->value().second); }
+         else { this->replace(node, right, node->value().second); }
+      }
+
+      /* Trims every entry overlapping interval down to its parts outside it. Entries wholly inside
+       * are removed, except one handed back through reuse so assign() can rewrite it rather than
+       * allocate. Trimmed pieces that collide with an existing key give way to it. Only entries
+       * sharing a point with interval are touched, whatever else the map holds, so the whole-tree
+       * rule of overlapping_interval does not apply here.
+       *
+       * Raw-pointer engines cut the entries inside out as one run whenever nothing else sorts
+       * between them, as in a painted map, and then trim the entries crossing the ends one by
+       * one: O(log n + k) when those are few. avltree cannot cut subtrees, so there each entry
+       * costs O(log n).
+       */
+      bool clip(const IntervalType &interval, NodeType **reuse) {
+         auto query = detail::OverlappingIntervalQuery<IntervalType>{interval};
+
+         if constexpr (InPlace)
+         {
+            std::size_t within = 0, crossing = 0;
+            IntervalType first, last;
+            auto tally = [&](const typename BaseType::ValueType &value) {
+               if (!inside(value.first, interval)) { ++crossing; return; }
+               if (within++ == 0) { first = value.first; }
+
+               last = value.first;
+            };
+
+            this->visit(query, tally);
+
+            auto touched = within + crossing > 0;
+
+            if (within > 0)
+            {
+               auto keep = (reuse != nullptr && *reuse == nullptr) ? this->lookup_node(first) : nullptr;
+               auto cut = (keep == nullptr) ? this->erase_run(first, last, within)
+                                            : within == 1 || this->erase_run(detail::next_node(keep)->key(), last, within - 1);
+
+               if (!cut)
+               {
+                  std::vector<IntervalType> keys;
+                  auto record = [&keys, &interval](const typename BaseType::ValueType &value) {
+                     if (inside(value.first, interval)) { keys.push_back(value.first); }
+                  };
+
+                  this->visit(query, record);
+
+                  for (auto &key : keys)
+                     if (keep == nullptr || !(key == first)) { this->unlink(this->lookup_node(key)); }
+               }
+
+               if (keep != nullptr) { *reuse = keep; }
+            }
+
+            // Trimmed pieces lie outside interval, so each pass finds the next entry still crossing it.
+            for (; crossing > 0; --crossing)
+            {
+               NodeType *node = nullptr;
+               auto find = [this, &node, &interval](const typename BaseType::ValueType &value) {
+                  if (inside(value.first, interval)) { return true; }
+
+                  node = this->lookup_node(value.first);
+                  return false;
+               };
+
+               this->visit(query, find);
+               this->trim(node, interval);
+            }
+
+            return touched;
+         }
+         else
+         {
+            std::vector<IntervalType> keys;
+            auto record = [&keys](const typename BaseType::ValueType &value) { keys.push_back(value.first); };
+
+            this->visit(query, record);
+
+            for (auto &key : keys)
+            {
+               auto node = this->lookup_node(key);
+               if (node == nullptr) { continue; }
+
+               if (inside(key, interval)) { this->unlink(node); }
+               else { this->trim(node, interval); }
+            }
+
+            return !keys.empty();
+         }
+      }
+
+      // Joins node with the in-order neighbours that touch it and hold an equal value.
+      void merge_neighbours(NodeType *node) {
+         if constexpr (detail::is_equality_comparable<Value>::value)
+         {
+            auto key = node->key();
+            auto previous = detail::prev_node(node);
+            auto next = detail::next_node(node);
+            auto join_previous = previous != nullptr && touches(previous->key(), key) && previous->value().second == node->value().second;
+            auto join_next = next != nullptr && touches(key, next->key()) && next->value().second == node->value().second;
+
+            if (!join_previous && !join_next) { return; }
+
+            auto merged = IntervalType(join_previous ? previous->key().low : key.low, join_next ? next->key().high : key.high);
+            auto previous_key = join_previous ? previous->key() : key;
+            auto next_key = join_next ? next->key() : key;
+
+            if (join_previous) { this->unlink(this->lookup_node(previous_key)); }
+            if (join_next) { this->unlink(this->lookup_node(next_key)); }
+
+            node = this->lookup_node(key);
+            this->replace(node, merged, node->value().second);
+         }
+      }
+
+   public:
+      IntervalMap() : BaseType() {}
+      IntervalMap(std::vector<typename BaseType::ValueType> &nodes) : BaseType(nodes) {}
+      IntervalMap(std::vector<typename BaseType::ValueType> &&nodes, BulkOrder order=BulkOrder::Unsorted, const Parallel &parallel=Parallel(1))
+         : BaseType(std::move(nodes), order, parallel) {}
+      template <typename Iterator>
+      IntervalMap(Iterator first, Iterator last, BulkOrder order=BulkOrder::Unsorted, const Parallel &parallel=Parallel(1))
+         : BaseType(first, last, order, parallel) {}
+      IntervalMap(const IntervalMap &other) : BaseType(other) {}
+      
+      Value &operator[](const IntervalType &key) {
+         return *this->try_emplace(key).first;
+      }
+      const Value &operator[](const IntervalType &key) const { return this->get(key); }
+      
+      bool has_interval(const IntervalType &key) const {
+         return this->contains(key);
+      }
+
+      typename BaseType::NodePointer insert(const IntervalType &key, const Value &value) {
+         return BaseType::insert(typename BaseType::ValueType(key, value));
+      }
+
+      typename BaseType::NodePointer insert(const IntervalType &key, Value &&value) {
+         return BaseType::insert(typename BaseType::ValueType(key, std::move(value)));
+      }
+
+      /* The std::map family: each returns the mapped value and whether the entry was added, in one
+       * descent. With arena or heap nodes values are built in place and only moved into the node, so
+       * Value may be move-only. SharedStorage (the default) copies the built entry into its node and
+       * needs a copyable Value; there try_emplace given rvalue args looks the key up first.
+       * try_emplace leaves args untouched when key is present; emplace builds its entry regardless.
+       */
+      template <typename... Args>
+      std::pair<Value *, bool> try_emplace(const IntervalType &key, Args &&... args) {
+         constexpr bool consumes = !(std::is_lvalue_reference<Args>::value && ...);
+         auto result = this->emplace_with<consumes>(key, [&]() {
+            return typename BaseType::ValueType(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+         });
+
+         return { &result.first->value().second, result.second };
+      }
+
+      template <typename... Args>
+      std::pair<Value *, bool> emplace(Args &&... args) {
+         auto entry = typename BaseType::ValueType(std::forward<Args>(args)...);
+         auto result = this->emplace_with<false>(entry.first, [&entry]() -> typename BaseType::ValueType && { return std::move(entry); });
+
+         return { &result.first->value().second, result.second };
+      }
+
+      template <typename Mapped>
+      std::pair<Value *, bool> insert_or_assign(const IntervalType &key, Mapped &&value) {
+         auto result = this->try_emplace(key, std::forward<Mapped>(value));
+         if (!result.second) { *result.first = std::forward<Mapped>(value); }
+
+         return result;
+      }
+
+      // nullptr when key is not mapped; get() throws instead.
+      Value *find(const IntervalType &key) {
+         auto node = this->lookup_node(key);
+
+         return (node != nullptr) ? &node->value().second : nullptr;
+      }
+
+      const Value *find(const IntervalType &key) const {
+         auto node = this->lookup_node(key);
+
+         return (node != nullptr) ? &node->value().second : nullptr;
+      }
+
+      Value &get(const IntervalType &key) {
+         return BaseType::get(key)->value().second;
+      }
+
+      const Value &get(const IntervalType &key) const {
+         return BaseType::get(key)->value().second;
+      }
+
+      /* Maps every point of interval to value, overriding what was mapped there: entries crossing
+       * its ends are trimmed in place, entries inside it are dropped and one of them is reused for
+       * the new entry. Coalesce::Adjacent also joins touching neighbours holding an equal value
+       * (Value needs operator== for that). With arena or heap nodes a painted map costs
+       * O(log n + k); with shared nodes each trimmed or dropped entry costs O(log n).
+       */
+      void assign(const IntervalType &interval, Value value, Coalesce coalesce=Coalesce::Overlapping) {
+         if (empty_interval(interval)) { return; }
+
+         NodeType *node = nullptr;
+
+         this->clip(interval, &node);
+         node = (node != nullptr) ? this->replace(node, interval, std::move(value)) : this->place(interval, std::move(value));
+
+         if (coalesce == Coalesce::Adjacent) { this->merge_neighbours(node); }
+      }
+
+      // Unmaps every point of interval, trimming or splitting the entries crossing it.
+      bool erase_range(const IntervalType &interval) {
+         if (empty_interval(interval)) { return false; }
+
+         return this->clip(interval, nullptr);
+      }
+   };
+
+   /* Joins between two trees or maps, or two ranges sorted by low (Interval::Compare order): both
+    * sides are merged in one sweep, so the cost is O(n + m + pairs) rather than a query per element.
+    * emit(left, right) receives the values themselves, or the range elements, which must stay put
+    * for the whole join. The two-argument forms collect pointers to the matched values instead.
+    */
+   template <typename Left, typename Right, typename Emit>
+   void overlap_join(const Left &left, const Right &right, Emit &&emit) {
+      detail::join_trees(left, right, detail::OverlapMatch(), emit);
+   }
+
+   template <typename LeftIterator, typename RightIterator, typename Emit>
+   void overlap_join(LeftIterator left, LeftIterator left_end, RightIterator right, RightIterator right_end, Emit &&emit) {
+      detail::join_ranges(left, left_end, right, right_end, detail::OverlapMatch(), emit);
+   }
+
+   template <typename Left, typename Right>
+   auto overlap_join(const Left &left, const Right &right) {
+      return detail::join_buffer(left, right, detail::OverlapMatch());
+   }
+
+   // Pairs where the left interval contains the right one.
+   template <typename Left, typename Right, typename Emit>
+   void containing_join(const Left &left, const Right &right, Emit &&emit) {
+      detail::join_trees(left, right, detail::ContainingMatch(), emit);
+   }
+
+   template <typename LeftIterator, typename RightIterator, typename Emit>
+   void containing_join(LeftIterator left, LeftIterator left_end, RightIterator right, RightIterator right_end, Emit &&emit) {
+      detail::join_ranges(left, left_end, right, right_end, detail::ContainingMatch(), emit);
+   }
+
+   template <typename Left, typename Right>
+   auto containing_join(const Left &left, const Right &right) {
+      return detail::join_buffer(left, right, detail::ContainingMatch());
+   }
+
+   // Pairs where the left interval is contained by the right one.
+   template <typename Left, typename Right, typename Emit>
+   void contained_by_join(const Left &left, const Right &right, Emit &&emit) {
+      detail::join_trees(left, right, detail::ContainedByMatch(), emit);
+   }
+
+   template <typename LeftIterator, typename RightIterator, typename Emit>
+   void contained_by_join(LeftIterator left, LeftIterator left_end, RightIterator right, RightIterator right_end, Emit &&emit) {
+      detail::join_ranges(left, left_end, right, right_end, detail::ContainedByMatch(), emit);
+   }
+
+   template <typename Left, typename Right>
+   auto contained_by_join(const Left &left, const Right &right) {
+      return detail::join_buffer(left, right, detail::ContainedByMatch());
+   }
 }
 
 #endif
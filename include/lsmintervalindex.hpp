@@ -0,0 +1,512 @@
+#ifndef __LSMINTERVALINDEX_H
+#define __LSMINTERVALINDEX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <set>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <intervaltree.hpp>
+#include <frozenintervalindex.hpp>
+
+namespace intervaltree
+{
+   namespace detail
+   {
+      // Matches every key; walks all entries of an index in key order.
+      template <typename IntervalType>
+      struct AnyIntervalQuery
+      {
+         static constexpr const char *name = "any_interval";
+
+         inline bool matches(const IntervalType &) const { return true; }
+         inline bool may_match_below(const typename IntervalType::ValueType &) const { return true; }
+         inline bool may_match_before(const IntervalType &) const { return true; }
+         inline bool may_match_after(const IntervalType &) const { return true; }
+      };
+
+      // Keys starting before interval, and keys reaching past its high end: those it does not contain.
+      template <typename IntervalType>
+      struct StartsBeforeQuery
+      {
+         static constexpr const char *name = "starts_before";
+
+         IntervalType interval;
+
+         inline bool matches(const IntervalType &key) const { return key.low < this->interval.low; }
+         inline bool may_match_below(const typename IntervalType::ValueType &) const { return true; }
+         inline bool may_match_before(const IntervalType &) const { return true; }
+         inline bool may_match_after(const IntervalType &key) const { return key.low < this->interval.low; }
+      };
+
+      template <typename IntervalType>
+      struct EndsAfterQuery
+      {
+         static constexpr const char *name = "ends_after";
+
+         IntervalType interval;
+
+         inline bool matches(const IntervalType &key) const { return this->interval.high < key.high; }
+         inline bool may_match_below(const typename IntervalType::ValueType &max) const { return this->interval.high < max; }
+         inline bool may_match_before(const IntervalType &) const { return true; }
+         inline bool may_match_after(const IntervalType &) const { return true; }
+      };
+   }
+
+   /* A write-optimized interval index in the manner of a log-structured merge tree. insert() and
+    * remove() only append to an unsorted buffer, so a write costs no rebalancing and no max
+    * updates. A full buffer is sorted into an immutable run: sorted columns with the implicit-tree
+    * max of FrozenIntervalIndex, plus a tombstone flag per entry. Runs are merged as in a binary
+    * counter, the newest two whenever the older is no larger, so each entry is rewritten
+    * O(log(n / buffer_size)) times and O(log(n / buffer_size)) runs exist at once. max_runs caps
+    * that further by merging the smallest adjacent pair, trading write cost for fewer runs per
+    * query. Merging into the oldest run drops tombstones and the entries they shadow.
+    *
+    * Queries consult the buffer and every run, newest first, and merge the hits in key order: the
+    * newest entry for a key wins, and a tombstone hides it. Results therefore match an
+    * IntervalTree (or, with a Value, an IntervalMap whose every write is insert_or_assign).
+    * Each query scans the buffer linearly, so call flush() or compact() before a read-heavy
+    * phase; compact() leaves one run that queries walk directly. overlapping_interval() returns
+    * every key when the query spans all live keys, as IntervalTree does; removed and overwritten
+    * entries still held do not widen that span.
+    *
+    * Writers must be serialized by the caller, and writes must not overlap queries.
+    */
+   template <typename IntervalType, typename Value=void>
+   class LsmIntervalIndex
+   {
+      static_assert(std::is_base_of<Interval<typename IntervalType::ValueType, IntervalType::Inclusive>, IntervalType>::value,
+                    "IntervalType template argument must derive the Interval structure.");
+
+   public:
+      using BoundType = typename IntervalType::ValueType;
+      using SetType = std::set<IntervalType, typename IntervalType::Compare>;
+      struct NoValue {};
+      using MappedType = typename std::conditional<std::is_void<Value>::value, NoValue, Value>::type;
+
+   protected:
+      struct Entry
+      {
+         IntervalType key;
+         MappedType value;
+         bool dead;
+      };
+
+      struct Run
+      {
+         WideKeyColumns<BoundType> keys;
+         std::vector<MappedType> values;
+         std::vector<char> dead;
+         std::size_t tombstones = 0;
+         int max_level = -1;
+
+         inline std::size_t size() const { return this->keys.size(); }
+
+         inline IntervalType key(std::size_t index) const {
+            IntervalType key;
+            key.low = this->keys.low(index);
+            key.high = this->keys.high(index);
+
+            return key;
+         }
+
+         void push_back(const IntervalType &key, MappedType &&value, bool dead) {
+            this->keys.push_back(key.low, key.high);
+            this->dead.push_back(dead ? 1 : 0);
+            if (dead) { ++this->tombstones; }
+            if constexpr (!std::is_void<Value>::value) { this->values.push_back(std::move(value)); }
+         }
+
+         void reserve(std::size_t count) {
+            this->keys.reserve(count);
+            this->dead.reserve(count);
+            if constexpr (!std::is_void<Value>::value) { this->values.reserve(count); }
+         }
+
+         // The position of key, or size() when it is absent.
+         std::size_t find(const IntervalType &key) const {
+            auto compare = typename IntervalType::Compare();
+            std::size_t first = 0;
+            std::size_t count = this->size();
+
+            while (count > 0)
+            {
+               auto half = count / 2;
+
+               if (compare(this->key(first + half), key))
+               {
+                  first += half + 1;
+                  count -= half + 1;
+               }
+               else { count = half; }
+            }
+
+            return (first < this->size() && this->key(first) == key) ? first : this->size();
+         }
+      };
+
+      // One matching entry of one level, for the merge in visit().
+      struct Hit
+      {
+         IntervalType key;
+         const MappedType *value;
+         bool dead;
+      };
+
+      std::vector<Entry> _buffer;
+      // Oldest first.
+      std::vector<Run> _runs;
+      std::size_t _buffer_size;
+      std::size_t _max_runs;
+
+      template <typename Visitor>
+      static inline bool invoke(Visitor &visitor, const IntervalType &key, const MappedType *value) {
+         if constexpr (std::is_void<Value>::value) { (void)value; return detail::invoke_visitor(visitor, key); }
+         else
+         {
+            if constexpr (std::is_void<decltype(visitor(key, *value))>::value) { visitor(key, *value); return true; }
+            else { return static_cast<bool>(visitor(key, *value)); }
+         }
+      }
+
+      // Merges runs [first, last) into one, the newest entry for each key winning.
+      void merge(std::size_t first, std::size_t last) {
+         auto compare = typename IntervalType::Compare();
+         auto drop_dead = (first == 0);
+         std::size_t total = 0;
+         std::vector<std::size_t> positions(last - first, 0);
+         Run merged;
+
+         for (auto index = first; index < last; ++index)
+            total += this->_runs[index].size();
+
+         merged.reserve(total);
+
+         for (;;)
+         {
+            std::size_t newest = positions.size();
+
+            // Walk newest to oldest, so the first run holding the smallest key is the newest one.
+            for (auto level = positions.size(); level-- > 0;)
+            {
+               auto &run = this->_runs[first + level];
+
+               if (positions[level] == run.size()) { continue; }
+               if (newest == positions.size() || compare(run.key(positions[level]), this->_runs[first + newest].key(positions[newest]))) { newest = level; }
+            }
+
+            if (newest == positions.size()) { break; }
+
+            auto &run = this->_runs[first + newest];
+            auto key = run.key(positions[newest]);
+            auto dead = (run.dead[positions[newest]] != 0);
+
+            if (!(dead && drop_dead))
+            {
+               auto value = MappedType();
+               if constexpr (!std::is_void<Value>::value) { value = std::move(run.values[positions[newest]]); }
+
+               merged.push_back(key, std::move(value), dead);
+            }
+
+            for (std::size_t level = 0; level < positions.size(); ++level)
+            {
+               auto &other = this->_runs[first + level];
+
+               if (positions[level] < other.size() && other.key(positions[level]) == key) { ++positions[level]; }
+            }
+         }
+
+         merged.max_level = detail::index_implicit(merged.keys);
+         this->_runs[first] = std::move(merged);
+         this->_runs.erase(this->_runs.begin() + static_cast<std::ptrdiff_t>(first + 1), this->_runs.begin() + static_cast<std::ptrdiff_t>(last));
+         if (this->_runs[first].size() == 0) { this->_runs.erase(this->_runs.begin() + static_cast<std::ptrdiff_t>(first)); }
+      }
+
+      template <typename Query, typename Visitor>
+      bool visit(const Query &query, Visitor &visitor) const {
+         if (this->_buffer.empty() && this->_runs.size() == 1 && this->_runs.front().tombstones == 0)
+         {
+            auto &run = this->_runs.front();
+            auto match = [&](std::size_t index) {
+               return invoke(visitor, run.key(index), std::is_void<Value>::value ? nullptr : &run.values[index]);
+            };
+
+            return detail::visit_implicit<IntervalType>(run.keys, run.max_level, query, match);
+         }
+
+         auto compare = typename IntervalType::Compare();
+         std::vector<std::vector<Hit>> levels(1);
+
+         for (auto &entry : this->_buffer)
+            if (query.matches(entry.key)) { levels.front().push_back(Hit{entry.key, &entry.value, entry.dead}); }
+
+         // Stable, so the last of equal keys is the newest write; keep only that one.
+         std::stable_sort(levels.front().begin(), levels.front().end(), [&](const Hit &left, const Hit &right) { return compare(left.key, right.key); });
+
+         std::size_t kept = 0;
+
+         for (std::size_t index = 0; index < levels.front().size(); ++index)
+         {
+            if (index + 1 < levels.front().size() && levels.front()[index + 1].key == levels.front()[index].key) { continue; }
+            levels.front()[kept++] = levels.front()[index];
+         }
+
+         levels.front().resize(kept);
+
+         for (auto run = this->_runs.rbegin(); run != this->_runs.rend(); ++run)
+         {
+            auto &hits = *levels.emplace(levels.end());
+            auto collect = [&](std::size_t index) {
+               hits.push_back(Hit{run->key(index), std::is_void<Value>::value ? nullptr : &run->values[index], run->dead[index] != 0});
+               return true;
+            };
+
+            detail::visit_implicit<IntervalType>(run->keys, run->max_level, query, collect);
+         }
+
+         std::vector<std::size_t> positions(levels.size(), 0);
+
+         for (;;)
+         {
+            std::size_t newest = levels.size();
+
+            for (std::size_t level = 0; level < levels.size(); ++level)
+            {
+               if (positions[level] == levels[level].size()) { continue; }
+               if (newest == levels.size() || compare(levels[level][positions[level]].key, levels[newest][positions[newest]].key)) { newest = level; }
+            }
+
+            if (newest == levels.size()) { return true; }
+
+            auto hit = levels[newest][positions[newest]];
+
+            for (std::size_t level = newest; level < levels.size(); ++level)
+               if (positions[level] < levels[level].size() && levels[level][positions[level]].key == hit.key) { ++positions[level]; }
+
+            if (!hit.dead && !invoke(visitor, hit.key, hit.value)) { return false; }
+         }
+      }
+
+      /* Whether interval spans every live key. A run it spans as a whole needs no look; otherwise
+       * the held entries outside it are walked until one proves live. Tombstones are skipped
+       * outright, so only entries shadowed by a newer write cost a lookup each.
+       */
+      bool spanned_by(const IntervalType &interval) const {
+         if (this->stored() == 0) { return false; }
+
+         auto live = [this](const IntervalType &key) {
+            const MappedType *value = nullptr;
+            return this->lookup(key, value) && value != nullptr;
+         };
+
+         for (auto &entry : this->_buffer)
+            if (!entry.dead && !entry.key.contained_by(interval) && live(entry.key)) { return false; }
+
+         for (auto &run : this->_runs)
+         {
+            if (detail::spans_implicit(run.keys, run.max_level, interval)) { continue; }
+
+            auto found = false;
+            auto check = [&](std::size_t index) {
+               found = run.dead[index] == 0 && live(run.key(index));
+               return !found;
+            };
+
+            detail::visit_implicit<IntervalType>(run.keys, run.max_level, detail::StartsBeforeQuery<IntervalType>{interval}, check);
+            if (!found) { detail::visit_implicit<IntervalType>(run.keys, run.max_level, detail::EndsAfterQuery<IntervalType>{interval}, check); }
+            if (found) { return false; }
+         }
+
+         return true;
+      }
+
+      template <typename Query>
+      SetType collect(const Query &query) const {
+         auto result = SetType();
+         auto insert = [&result](const IntervalType &key, auto &&...) { result.insert(key); };
+
+         this->visit(query, insert);
+
+         return result;
+      }
+
+      // The newest entry for key: false when there is none; value is null when it is a tombstone.
+      bool lookup(const IntervalType &key, const MappedType *&value) const {
+         for (auto entry = this->_buffer.rbegin(); entry != this->_buffer.rend(); ++entry)
+         {
+            if (entry->key != key) { continue; }
+
+            value = entry->dead ? nullptr : &entry->value;
+            return true;
+         }
+
+         for (auto run = this->_runs.rbegin(); run != this->_runs.rend(); ++run)
+         {
+            auto index = run->find(key);
+            if (index == run->size()) { continue; }
+
+            static const MappedType present = MappedType();
+
+            if (run->dead[index] != 0) { value = nullptr; }
+            else { value = std::is_void<Value>::value ? &present : &run->values[index]; }
+
+            return true;
+         }
+
+         return false;
+      }
+
+      void append(const IntervalType &key, MappedType &&value, bool dead) {
+         this->_buffer.push_back(Entry{key, std::move(value), dead});
+         if (this->_buffer.size() >= this->_buffer_size) { this->flush(); }
+      }
+
+   public:
+      /* buffer_size writes are gathered before each sort. max_runs, when not 0, bounds how many
+       * runs a query visits; a cap well below log2(n / buffer_size) makes merges much costlier.
+       */
+      explicit LsmIntervalIndex(std::size_t buffer_size=4096, std::size_t max_runs=0)
+         : _buffer_size(std::max<std::size_t>(buffer_size, 1)), _max_runs(max_runs) {
+         this->_buffer.reserve(this->_buffer_size);
+      }
+
+      template <typename V=Value, typename std::enable_if<std::is_void<V>::value, int>::type = 0>
+      void insert(const IntervalType &key) { this->append(key, MappedType(), false); }
+
+      // Overwrites any value key already has, as IntervalMap::insert_or_assign() does.
+      template <typename V=Value, typename std::enable_if<!std::is_void<V>::value, int>::type = 0>
+      void insert(const IntervalType &key, MappedType value) { this->append(key, std::move(value), false); }
+
+      // Writes a tombstone without looking key up; removing an absent key does nothing.
+      void remove(const IntervalType &key) { this->append(key, MappedType(), true); }
+
+      bool contains(const IntervalType &key) const {
+         const MappedType *value = nullptr;
+         return this->lookup(key, value) && value != nullptr;
+      }
+
+      // Valid until the next write.
+      template <typename V=Value, typename std::enable_if<!std::is_void<V>::value, int>::type = 0>
+      const V *find(const IntervalType &key) const {
+         const MappedType *value = nullptr;
+         return this->lookup(key, value) ? value : nullptr;
+      }
+
+      // Sorts the buffer into a run, then merges runs as the policy above requires.
+      void flush() {
+         if (this->_buffer.empty()) { return; }
+
+         auto compare = typename IntervalType::Compare();
+         Run run;
+
+         std::stable_sort(this->_buffer.begin(), this->_buffer.end(), [&](const Entry &left, const Entry &right) { return compare(left.key, right.key); });
+         run.reserve(this->_buffer.size());
+
+         for (std::size_t index = 0; index < this->_buffer.size(); ++index)
+         {
+            auto &entry = this->_buffer[index];
+
+            if (index + 1 < this->_buffer.size() && this->_buffer[index + 1].key == entry.key) { continue; }
+            if (entry.dead && this->_runs.empty()) { continue; }
+
+            run.push_back(entry.key, std::move(entry.value), entry.dead);
+         }
+
+         this->_buffer.clear();
+
+         if (run.size() == 0) { return; }
+
+         run.max_level = detail::index_implicit(run.keys);
+         this->_runs.push_back(std::move(run));
+
+         while (this->_runs.size() >= 2 && this->_runs[this->_runs.size() - 2].size() <= this->_runs.back().size())
+            this->merge(this->_runs.size() - 2, this->_runs.size());
+
+         // Over the cap, the cheapest merge is of the adjacent pair with the fewest entries.
+         while (this->_max_runs != 0 && this->_runs.size() > std::max<std::size_t>(this->_max_runs, 1))
+         {
+            std::size_t cheapest = 0;
+
+            for (std::size_t index = 1; index + 1 < this->_runs.size(); ++index)
+               if (this->_runs[index].size() + this->_runs[index + 1].size() < this->_runs[cheapest].size() + this->_runs[cheapest + 1].size()) { cheapest = index; }
+
+            this->merge(cheapest, cheapest + 2);
+         }
+      }
+
+      // Flushes and merges everything into one run without tombstones, the fastest shape to query.
+      void compact() {
+         this->flush();
+         if (!this->_runs.empty() && (this->_runs.size() > 1 || this->_runs.front().tombstones != 0)) { this->merge(0, this->_runs.size()); }
+      }
+
+      void clear() {
+         this->_buffer.clear();
+         this->_runs.clear();
+      }
+
+      inline std::size_t buffered() const { return this->_buffer.size(); }
+      inline std::size_t run_count() const { return this->_runs.size(); }
+
+      // Entries held across the buffer and runs, counting tombstones and overwritten versions.
+      std::size_t stored() const {
+         auto total = this->_buffer.size();
+
+         for (auto &run : this->_runs)
+            total += run.size();
+
+         return total;
+      }
+
+      SetType containing_point(const BoundType &point) const {
+         return this->collect(detail::ContainingPointQuery<IntervalType>{point});
+      }
+
+      SetType containing_interval(const IntervalType &interval) const {
+         return this->collect(detail::ContainingIntervalQuery<IntervalType>{interval});
+      }
+
+      SetType overlapping_interval(const IntervalType &interval) const {
+         if (this->spanned_by(interval)) { return this->collect(detail::ContainedByIntervalQuery<IntervalType>{interval}); }
+
+         return this->collect(detail::OverlappingIntervalQuery<IntervalType>{interval});
+      }
+
+      SetType contained_by_interval(const IntervalType &interval) const {
+         return this->collect(detail::ContainedByIntervalQuery<IntervalType>{interval});
+      }
+
+      // Visitors receive (key) for a set and (key, value) for a map, in key order.
+      template <typename Visitor>
+      bool for_each_value(Visitor &&visitor) const {
+         return this->visit(detail::AnyIntervalQuery<IntervalType>(), visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_point(const BoundType &point, Visitor &&visitor) const {
+         return this->visit(detail::ContainingPointQuery<IntervalType>{point}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_interval(const IntervalType &interval, Visitor &&visitor) const {
+         return this->visit(detail::ContainingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_overlapping_interval(const IntervalType &interval, Visitor &&visitor) const {
+         if (this->spanned_by(interval)) { return this->visit(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor); }
+
+         return this->visit(detail::OverlappingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_contained_by_interval(const IntervalType &interval, Visitor &&visitor) const {
+         return this->visit(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor);
+      }
+   };
+}
+
+#endif
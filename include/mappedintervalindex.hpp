@@ -0,0 +1,499 @@
+#ifndef __MAPPEDINTERVALINDEX_H
+#define __MAPPEDINTERVALINDEX_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <intervaltree.hpp>
+#include <frozenintervalindex.hpp>
+
+namespace intervaltree
+{
+   namespace exception {
+      class BadIndexFile : public std::exception
+      {
+      public:
+         const char *what() const noexcept { return "File is not an interval index of this type, version or byte order."; }
+      };
+
+      class IndexOutOfOrder : public std::exception
+      {
+      public:
+         const char *what() const noexcept { return "Intervals must be written in strictly increasing order."; }
+      };
+   }
+
+   /* On-disk layout, in the writer's byte order: a 64-byte IndexFileHeader, then `count` fixed-size
+    * entries in Interval::Compare order, each holding low, high, the implicit-tree max (see
+    * FrozenIntervalIndex) and, for maps, the trivially copyable value. The header records the
+    * sizes and layout it was written with, so a mismatched reader rejects the file instead of
+    * misreading it.
+    */
+   struct IndexFileHeader
+   {
+      static constexpr std::uint32_t Version = 1;
+      static constexpr std::uint32_t ByteOrder = 0x01020304;
+
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t byte_order;
+      std::uint32_t bound_size;
+      std::uint32_t bound_kind;
+      std::uint32_t value_size;
+      std::uint32_t value_offset;
+      std::uint32_t entry_size;
+      std::uint32_t inclusive;
+      std::uint64_t count;
+      std::int64_t max_level;
+      std::uint64_t entries_offset;
+   };
+
+   static_assert(sizeof(IndexFileHeader) == 64, "IndexFileHeader must stay 64 bytes.");
+
+   namespace detail
+   {
+      static constexpr char IndexMagic[8] = { 'I', 'V', 'T', 'R', 'E', 'E', 'I', 'X' };
+
+      template <typename BoundType, typename Value>
+      struct IndexEntry
+      {
+         BoundType low;
+         BoundType high;
+         BoundType max;
+         Value value;
+      };
+
+      template <typename BoundType>
+      struct IndexEntry<BoundType, void>
+      {
+         BoundType low;
+         BoundType high;
+         BoundType max;
+      };
+
+      // The top level index_implicit() builds over count keys: floor(log2(count)), or -1 when empty.
+      inline std::int64_t implicit_max_level(std::uint64_t count) {
+         std::int64_t level = -1;
+
+         for (; count != 0; count >>= 1)
+            ++level;
+
+         return level;
+      }
+
+      template <typename IntervalType, typename Value>
+      IndexFileHeader index_header(std::uint64_t count, int max_level) {
+         using BoundType = typename IntervalType::ValueType;
+         using Entry = IndexEntry<BoundType, Value>;
+
+         IndexFileHeader header;
+
+         std::memset(&header, 0, sizeof(header));
+         std::memcpy(header.magic, IndexMagic, sizeof(header.magic));
+         header.version = IndexFileHeader::Version;
+         header.byte_order = IndexFileHeader::ByteOrder;
+         header.bound_size = sizeof(BoundType);
+         header.bound_kind = std::is_floating_point<BoundType>::value ? 2 : (std::is_signed<BoundType>::value ? 1 : 0);
+         header.entry_size = sizeof(Entry);
+         header.inclusive = IntervalType::Inclusive ? 1 : 0;
+         header.count = count;
+         header.max_level = max_level;
+         header.entries_offset = sizeof(IndexFileHeader);
+
+         if constexpr (!std::is_void<Value>::value)
+         {
+            header.value_size = sizeof(Value);
+            header.value_offset = offsetof(Entry, value);
+         }
+
+         return header;
+      }
+
+      // Entry array as the column interface index_implicit() and visit_implicit() expect.
+      template <typename Entry>
+      class EntryColumns
+      {
+         Entry *_entries;
+         std::size_t _count;
+
+      public:
+         EntryColumns(Entry *entries, std::size_t count) : _entries(entries), _count(count) {}
+
+         inline std::size_t size() const { return this->_count; }
+         inline auto low(std::size_t index) const { return this->_entries[index].low; }
+         inline auto high(std::size_t index) const { return this->_entries[index].high; }
+         inline auto max(std::size_t index) const { return this->_entries[index].max; }
+
+         template <typename BoundType>
+         inline void set_max(std::size_t index, const BoundType &max) { this->_entries[index].max = max; }
+      };
+
+      // A whole file mapped into memory, read-only or shared read-write.
+      class MappedFile
+      {
+         void *_data;
+         std::size_t _size;
+#if defined(_WIN32)
+         HANDLE _file;
+         HANDLE _mapping;
+#endif
+
+         [[noreturn]] static void fail() {
+#if defined(_WIN32)
+            throw std::system_error(static_cast<int>(GetLastError()), std::system_category());
+#else
+            throw std::system_error(errno, std::generic_category());
+#endif
+         }
+
+      public:
+         MappedFile(const std::string &path, bool writable) : _data(nullptr), _size(0) {
+#if defined(_WIN32)
+            this->_mapping = nullptr;
+            this->_file = CreateFileA(path.c_str(), writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ,
+                                      nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (this->_file == INVALID_HANDLE_VALUE) { fail(); }
+
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(this->_file, &size)) { auto error = GetLastError(); CloseHandle(this->_file); SetLastError(error); fail(); }
+
+            this->_size = static_cast<std::size_t>(size.QuadPart);
+            if (this->_size == 0) { return; }
+
+            this->_mapping = CreateFileMappingA(this->_file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+            if (this->_mapping == nullptr) { auto error = GetLastError(); CloseHandle(this->_file); SetLastError(error); fail(); }
+
+            this->_data = MapViewOfFile(this->_mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+            if (this->_data == nullptr)
+            {
+               auto error = GetLastError();
+               CloseHandle(this->_mapping);
+               CloseHandle(this->_file);
+               SetLastError(error);
+               fail();
+            }
+#else
+            auto descriptor = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+            if (descriptor < 0) { fail(); }
+
+            struct stat status;
+            if (::fstat(descriptor, &status) != 0) { auto error = errno; ::close(descriptor); errno = error; fail(); }
+
+            this->_size = static_cast<std::size_t>(status.st_size);
+
+            if (this->_size != 0)
+            {
+               this->_data = ::mmap(nullptr, this->_size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, descriptor, 0);
+
+               if (this->_data == MAP_FAILED)
+               {
+                  auto error = errno;
+                  this->_data = nullptr;
+                  ::close(descriptor);
+                  errno = error;
+                  fail();
+               }
+            }
+
+            ::close(descriptor);
+#endif
+         }
+
+         MappedFile(const MappedFile &other) = delete;
+         MappedFile(MappedFile &&other) noexcept : _data(other._data), _size(other._size) {
+#if defined(_WIN32)
+            this->_file = other._file;
+            this->_mapping = other._mapping;
+            other._file = INVALID_HANDLE_VALUE;
+            other._mapping = nullptr;
+#endif
+            other._data = nullptr;
+            other._size = 0;
+         }
+
+         MappedFile &operator=(const MappedFile &other) = delete;
+         MappedFile &operator=(MappedFile &&other) = delete;
+
+         ~MappedFile() {
+#if defined(_WIN32)
+            if (this->_data != nullptr) { UnmapViewOfFile(this->_data); }
+            if (this->_mapping != nullptr) { CloseHandle(this->_mapping); }
+            if (this->_file != INVALID_HANDLE_VALUE) { CloseHandle(this->_file); }
+#else
+            if (this->_data != nullptr) { ::munmap(this->_data, this->_size); }
+#endif
+         }
+
+         inline void *data() const { return this->_data; }
+         inline std::size_t size() const { return this->_size; }
+      };
+   }
+
+   /* Streams intervals, already in strictly increasing Interval::Compare order, into an index
+    * file. Entries go straight to disk. finish() then maps the file once to fill in the subtree
+    * maxima, and writes the header last, so an unfinished file is never accepted by a reader.
+    */
+   template <typename IntervalType, typename Value=void>
+   class IntervalIndexWriter
+   {
+      static_assert(std::is_void<Value>::value || std::is_trivially_copyable<Value>::value,
+                    "Mapped index values must be trivially copyable.");
+
+   public:
+      using BoundType = typename IntervalType::ValueType;
+      using Entry = detail::IndexEntry<BoundType, Value>;
+
+   protected:
+      std::string _path;
+      std::FILE *_file;
+      std::uint64_t _count;
+      IntervalType _last;
+
+      void write(const void *data, std::size_t size) {
+         if (std::fwrite(data, 1, size, this->_file) != size) { throw std::system_error(errno, std::generic_category()); }
+      }
+
+      void push(const IntervalType &key, Entry &entry) {
+         if (this->_count != 0 && !typename IntervalType::Compare()(this->_last, key)) { throw exception::IndexOutOfOrder(); }
+
+         entry.low = key.low;
+         entry.high = key.high;
+         entry.max = key.high;
+
+         this->write(&entry, sizeof(entry));
+         this->_last = key;
+         ++this->_count;
+      }
+
+   public:
+      explicit IntervalIndexWriter(const std::string &path) : _path(path), _file(std::fopen(path.c_str(), "wb")), _count(0) {
+         if (this->_file == nullptr) { throw std::system_error(errno, std::generic_category()); }
+
+         IndexFileHeader placeholder;
+
+         std::memset(&placeholder, 0, sizeof(placeholder));
+         this->write(&placeholder, sizeof(placeholder));
+      }
+
+      IntervalIndexWriter(const IntervalIndexWriter &other) = delete;
+      IntervalIndexWriter &operator=(const IntervalIndexWriter &other) = delete;
+
+      ~IntervalIndexWriter() {
+         if (this->_file != nullptr) { std::fclose(this->_file); }
+      }
+
+      template <typename V=Value, typename std::enable_if<std::is_void<V>::value, int>::type = 0>
+      void append(const IntervalType &key) {
+         Entry entry;
+         std::memset(&entry, 0, sizeof(entry));
+
+         this->push(key, entry);
+      }
+
+      template <typename V=Value, typename std::enable_if<!std::is_void<V>::value, int>::type = 0>
+      void append(const IntervalType &key, const V &value) {
+         Entry entry;
+         std::memset(&entry, 0, sizeof(entry));
+         entry.value = value;
+
+         this->push(key, entry);
+      }
+
+      inline std::uint64_t count() const { return this->_count; }
+
+      void finish() {
+         if (this->_file == nullptr) { return; }
+
+         auto closed = std::fclose(this->_file);
+         this->_file = nullptr;
+
+         if (closed != 0) { throw std::system_error(errno, std::generic_category()); }
+
+         detail::MappedFile file(this->_path, true);
+         auto bytes = static_cast<char *>(file.data());
+         auto columns = detail::EntryColumns<Entry>(reinterpret_cast<Entry *>(bytes + sizeof(IndexFileHeader)), static_cast<std::size_t>(this->_count));
+         auto header = detail::index_header<IntervalType, Value>(this->_count, detail::index_implicit(columns));
+
+         std::memcpy(bytes, &header, sizeof(header));
+      }
+   };
+
+   /* Queries an index file in place: the file is mapped read-only and never copied or parsed
+    * beyond its header, so opening is O(1) whatever its size. Matches the FrozenIntervalIndex
+    * query API; visitors receive (key) for a set and (key, value) for a map.
+    */
+   template <typename IntervalType, typename Value=void>
+   class MappedIntervalIndex
+   {
+      static_assert(std::is_void<Value>::value || std::is_trivially_copyable<Value>::value,
+                    "Mapped index values must be trivially copyable.");
+
+   public:
+      using BoundType = typename IntervalType::ValueType;
+      using SetType = std::set<IntervalType, typename IntervalType::Compare>;
+      using Entry = detail::IndexEntry<BoundType, Value>;
+
+   protected:
+      detail::MappedFile _file;
+      const Entry *_entries;
+      std::size_t _count;
+      int _max_level;
+
+      template <typename Visitor>
+      inline bool invoke(Visitor &visitor, std::size_t index) const {
+         auto key = this->key(index);
+
+         if constexpr (std::is_void<Value>::value) { return detail::invoke_visitor(visitor, key); }
+         else
+         {
+            auto &value = this->_entries[index].value;
+
+            if constexpr (std::is_void<decltype(visitor(key, value))>::value) { visitor(key, value); return true; }
+            else { return static_cast<bool>(visitor(key, value)); }
+         }
+      }
+
+      template <typename Query, typename Visitor>
+      bool visit(const Query &query, Visitor &visitor) const {
+         auto columns = detail::EntryColumns<const Entry>(this->_entries, this->_count);
+         auto invoke = [this, &visitor](std::size_t index) { return this->invoke(visitor, index); };
+
+         return detail::visit_implicit<IntervalType>(columns, this->_max_level, query, invoke);
+      }
+
+      inline bool spanned_by(const IntervalType &interval) const {
+         return detail::spans_implicit(detail::EntryColumns<const Entry>(this->_entries, this->_count), this->_max_level, interval);
+      }
+
+      template <typename Query>
+      SetType collect(const Query &query) const {
+         auto result = SetType();
+         auto insert = [&result](const IntervalType &key, auto &&...) { result.insert(key); };
+
+         this->visit(query, insert);
+
+         return result;
+      }
+
+   public:
+      explicit MappedIntervalIndex(const std::string &path) : _file(path, false), _entries(nullptr), _count(0), _max_level(-1) {
+         auto expected = detail::index_header<IntervalType, Value>(0, -1);
+         IndexFileHeader header;
+
+         if (this->_file.size() < sizeof(header)) { throw exception::BadIndexFile(); }
+
+         std::memcpy(&header, this->_file.data(), sizeof(header));
+
+         if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+             || header.version != expected.version
+             || header.byte_order != expected.byte_order
+             || header.bound_size != expected.bound_size
+             || header.bound_kind != expected.bound_kind
+             || header.value_size != expected.value_size
+             || header.value_offset != expected.value_offset
+             || header.entry_size != expected.entry_size
+             || header.inclusive != expected.inclusive
+             || header.entries_offset != expected.entries_offset
+             || (this->_file.size() - header.entries_offset) / sizeof(Entry) < header.count
+             || header.max_level != detail::implicit_max_level(header.count))
+            throw exception::BadIndexFile();
+
+         this->_entries = reinterpret_cast<const Entry *>(static_cast<const char *>(this->_file.data()) + header.entries_offset);
+         this->_count = static_cast<std::size_t>(header.count);
+         this->_max_level = static_cast<int>(header.max_level);
+      }
+
+      inline std::size_t size() const { return this->_count; }
+      inline bool empty() const { return this->_count == 0; }
+
+      inline IntervalType key(std::size_t index) const {
+         IntervalType key;
+         key.low = this->_entries[index].low;
+         key.high = this->_entries[index].high;
+
+         return key;
+      }
+
+      template <typename V=Value, typename std::enable_if<!std::is_void<V>::value, int>::type = 0>
+      inline const V &value(std::size_t index) const { return this->_entries[index].value; }
+
+      SetType containing_point(const BoundType &point) const {
+         return this->collect(detail::ContainingPointQuery<IntervalType>{point});
+      }
+
+      SetType containing_interval(const IntervalType &interval) const {
+         return this->collect(detail::ContainingIntervalQuery<IntervalType>{interval});
+      }
+
+      // Returns every key when interval spans them all, as IntervalTree does.
+      SetType overlapping_interval(const IntervalType &interval) const {
+         if (this->spanned_by(interval)) { return this->collect(detail::ContainedByIntervalQuery<IntervalType>{interval}); }
+
+         return this->collect(detail::OverlappingIntervalQuery<IntervalType>{interval});
+      }
+
+      SetType contained_by_interval(const IntervalType &interval) const {
+         return this->collect(detail::ContainedByIntervalQuery<IntervalType>{interval});
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_point(const BoundType &point, Visitor &&visitor) const {
+         return this->visit(detail::ContainingPointQuery<IntervalType>{point}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_interval(const IntervalType &interval, Visitor &&visitor) const {
+         return this->visit(detail::ContainingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_overlapping_interval(const IntervalType &interval, Visitor &&visitor) const {
+         if (this->spanned_by(interval)) { return this->visit(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor); }
+
+         return this->visit(detail::OverlappingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_contained_by_interval(const IntervalType &interval, Visitor &&visitor) const {
+         return this->visit(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor);
+      }
+   };
+
+   // Writes any tree or map in this library; its in-order walk is already sorted.
+   template <typename IntervalType, typename Storage>
+   void write_index(const IntervalTree<IntervalType, Storage> &tree, const std::string &path) {
+      IntervalIndexWriter<IntervalType> writer(path);
+
+      tree.for_each_value([&writer](const IntervalType &key) { writer.append(key); });
+      writer.finish();
+   }
+
+   template <typename IntervalType, typename Value, typename Storage>
+   void write_index(const IntervalMap<IntervalType, Value, Storage> &map, const std::string &path) {
+      IntervalIndexWriter<IntervalType, Value> writer(path);
+
+      map.for_each_value([&writer](const std::pair<const IntervalType, Value> &entry) { writer.append(entry.first, entry.second); });
+      writer.finish();
+   }
+}
+
+#endif
@@ -0,0 +1,434 @@
+#ifndef __PERSISTENTINTERVALTREE_H
+#define __PERSISTENTINTERVALTREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <intervaltree.hpp>
+
+namespace intervaltree
+{
+   /* A path-copying AVL interval tree. Nodes are immutable once built: insert and remove copy
+    * only the O(log n) nodes on the path to the change and share every other subtree with the
+    * previous version, then publish the new version with an atomic store. snapshot() hands out
+    * an immutable Snapshot that readers query without locks while the writer moves on; a
+    * version's nodes are freed when the last snapshot and tree referring to them are dropped.
+    *
+    * Writers must be serialized by the caller; any number of threads may take snapshots and
+    * query them concurrently with a writer.
+    */
+   template <typename IntervalType, typename _ValueType, typename KeyOfValue>
+   class PersistentIntervalTreeBase
+   {
+      static_assert(std::is_base_of<Interval<typename IntervalType::ValueType, IntervalType::Inclusive>, IntervalType>::value,
+                    "IntervalType template argument must derive the Interval structure.");
+
+   public:
+      using KeyType = IntervalType;
+      using ValueType = _ValueType;
+      using BoundType = typename IntervalType::ValueType;
+      using SetType = std::set<IntervalType, typename IntervalType::Compare>;
+
+      class IntervalNode
+      {
+         friend class PersistentIntervalTreeBase;
+
+         ValueType _value;
+         BoundType _max;
+         std::int8_t _height;
+         std::shared_ptr<const IntervalNode> _left;
+         std::shared_ptr<const IntervalNode> _right;
+
+      public:
+         IntervalNode(const ValueType &value, std::shared_ptr<const IntervalNode> left, std::shared_ptr<const IntervalNode> right)
+            : _value(value), _max(KeyOfValue()(value).high), _height(1), _left(std::move(left)), _right(std::move(right))
+         {
+            if (this->_left != nullptr)
+            {
+               this->_height = this->_left->_height + 1;
+               if (this->_max < this->_left->_max) { this->_max = this->_left->_max; }
+            }
+
+            if (this->_right != nullptr)
+            {
+               if (this->_height < this->_right->_height + 1) { this->_height = this->_right->_height + 1; }
+               if (this->_max < this->_right->_max) { this->_max = this->_right->_max; }
+            }
+         }
+
+         inline const IntervalType &key() const { return KeyOfValue()(this->_value); }
+         inline const ValueType &value() const { return this->_value; }
+         inline const BoundType &max() const { return this->_max; }
+         inline const IntervalNode *left_node() const { return this->_left.get(); }
+         inline const IntervalNode *right_node() const { return this->_right.get(); }
+      };
+
+      using NodePointer = std::shared_ptr<const IntervalNode>;
+
+   protected:
+      struct Version
+      {
+         NodePointer root;
+         std::size_t size;
+      };
+
+      using VersionPointer = std::shared_ptr<const Version>;
+
+      VersionPointer _current;
+
+      static inline int height(const NodePointer &node) { return (node == nullptr) ? 0 : node->_height; }
+
+      static NodePointer make_node(const ValueType &value, NodePointer left, NodePointer right) {
+         return std::make_shared<const IntervalNode>(value, std::move(left), std::move(right));
+      }
+
+      // Builds a node over two subtrees whose heights differ by at most two, rotating if needed.
+      static NodePointer balance(const ValueType &value, NodePointer left, NodePointer right) {
+         auto left_height = height(left), right_height = height(right);
+
+         if (left_height > right_height + 1)
+         {
+            if (height(left->_left) >= height(left->_right))
+               return make_node(left->_value, left->_left, make_node(value, left->_right, std::move(right)));
+
+            auto &pivot = left->_right;
+
+            return make_node(pivot->_value,
+                             make_node(left->_value, left->_left, pivot->_left),
+                             make_node(value, pivot->_right, std::move(right)));
+         }
+
+         if (right_height > left_height + 1)
+         {
+            if (height(right->_right) >= height(right->_left))
+               return make_node(right->_value, make_node(value, std::move(left), right->_left), right->_right);
+
+            auto &pivot = right->_left;
+
+            return make_node(pivot->_value,
+                             make_node(value, std::move(left), pivot->_left),
+                             make_node(right->_value, pivot->_right, right->_right));
+         }
+
+         return make_node(value, std::move(left), std::move(right));
+      }
+
+      // Returns node itself when nothing changed so that untouched versions stay shared.
+      template <bool Replace>
+      static NodePointer insert_into(const NodePointer &node, const ValueType &value, bool &inserted) {
+         if (node == nullptr)
+         {
+            inserted = true;
+            return make_node(value, nullptr, nullptr);
+         }
+
+         auto compare = typename IntervalType::Compare();
+         const auto &key = KeyOfValue()(value);
+
+         if (compare(key, node->key()))
+         {
+            auto left = insert_into<Replace>(node->_left, value, inserted);
+            return (left == node->_left) ? node : balance(node->_value, std::move(left), node->_right);
+         }
+
+         if (compare(node->key(), key))
+         {
+            auto right = insert_into<Replace>(node->_right, value, inserted);
+            return (right == node->_right) ? node : balance(node->_value, node->_left, std::move(right));
+         }
+
+         inserted = false;
+
+         if constexpr (Replace) { return make_node(value, node->_left, node->_right); }
+         else { return node; }
+      }
+
+      static NodePointer remove_min(const NodePointer &node, const IntervalNode *&min) {
+         if (node->_left == nullptr)
+         {
+            min = node.get();
+            return node->_right;
+         }
+
+         return balance(node->_value, remove_min(node->_left, min), node->_right);
+      }
+
+      static NodePointer remove_from(const NodePointer &node, const IntervalType &key, bool &removed) {
+         if (node == nullptr)
+         {
+            removed = false;
+            return nullptr;
+         }
+
+         auto compare = typename IntervalType::Compare();
+
+         if (compare(key, node->key()))
+         {
+            auto left = remove_from(node->_left, key, removed);
+            return removed ? balance(node->_value, std::move(left), node->_right) : node;
+         }
+
+         if (compare(node->key(), key))
+         {
+            auto right = remove_from(node->_right, key, removed);
+            return removed ? balance(node->_value, node->_left, std::move(right)) : node;
+         }
+
+         removed = true;
+
+         if (node->_left == nullptr) { return node->_right; }
+         if (node->_right == nullptr) { return node->_left; }
+
+         const IntervalNode *min = nullptr;
+         auto right = remove_min(node->_right, min);
+
+         return balance(min->_value, node->_left, std::move(right));
+      }
+
+      static NodePointer build(const ValueType *const *values, std::size_t count) {
+         if (count == 0) { return nullptr; }
+
+         auto middle = count / 2;
+
+         return make_node(*values[middle], build(values, middle), build(values + middle + 1, count - middle - 1));
+      }
+
+      inline VersionPointer load() const { return std::atomic_load(&this->_current); }
+      inline void publish(NodePointer root, std::size_t size) {
+         std::atomic_store(&this->_current, VersionPointer(std::make_shared<const Version>(Version{std::move(root), size})));
+      }
+
+      template <bool Replace>
+      bool insert_value(const ValueType &value) {
+         auto version = this->load();
+         auto inserted = false;
+         auto root = insert_into<Replace>(version->root, value, inserted);
+
+         if (root != version->root) { this->publish(std::move(root), version->size + (inserted ? 1 : 0)); }
+
+         return inserted;
+      }
+
+   public:
+      // An immutable version of the tree. Copying a snapshot is a reference count increment.
+      class Snapshot
+      {
+         friend class PersistentIntervalTreeBase;
+
+         VersionPointer _version;
+
+         template <typename Query, typename Visitor>
+         bool visit(const Query &query, Visitor &visitor) const {
+            auto forward = [&visitor](const ValueType &value) { return detail::invoke_visitor(visitor, value); };
+            return detail::visit_query(this->root_node(), query, forward) != detail::Visit::Stopped;
+         }
+
+         template <typename Query>
+         SetType collect(const Query &query) const {
+            auto result = SetType();
+            auto insert = [&result](const ValueType &value) { result.insert(KeyOfValue()(value)); return true; };
+
+            detail::visit_query(this->root_node(), query, insert);
+
+            return result;
+         }
+
+         // The leftmost node holds the lowest low and the root's max the highest high.
+         bool spanned_by(const IntervalType &interval) const {
+            auto node = this->root_node();
+            if (node == nullptr) { return false; }
+
+            auto highest = node->max();
+
+            while (node->left_node() != nullptr)
+               node = node->left_node();
+
+            return detail::spans_keys(interval, node->key().low, highest);
+         }
+
+      public:
+         using ValueType = typename PersistentIntervalTreeBase::ValueType;
+         using SetType = typename PersistentIntervalTreeBase::SetType;
+
+         Snapshot(VersionPointer version) : _version(std::move(version)) {}
+
+         inline const IntervalNode *root_node() const { return this->_version->root.get(); }
+         inline std::size_t size() const { return this->_version->size; }
+         inline bool empty() const { return this->_version->size == 0; }
+
+         const IntervalNode *lookup_node(const IntervalType &key) const {
+            auto node = this->root_node();
+            auto compare = typename IntervalType::Compare();
+
+            while (node != nullptr)
+            {
+               if (compare(key, node->key())) { node = node->left_node(); }
+               else if (compare(node->key(), key)) { node = node->right_node(); }
+               else { break; }
+            }
+
+            return node;
+         }
+
+         inline bool contains(const IntervalType &key) const { return this->lookup_node(key) != nullptr; }
+
+         const ValueType &get(const IntervalType &key) const {
+            auto node = this->lookup_node(key);
+            if (node == nullptr) { throw exception::IntervalNotFound(); }
+
+            return node->value();
+         }
+
+         std::vector<ValueType> to_vec() const {
+            std::vector<ValueType> result;
+
+            result.reserve(this->size());
+            this->for_each_value([&result](const ValueType &value) { result.push_back(value); });
+
+            return result;
+         }
+
+         SetType containing_point(const BoundType &point) const {
+            return this->collect(detail::ContainingPointQuery<IntervalType>{point});
+         }
+
+         SetType containing_interval(const IntervalType &interval) const {
+            return this->collect(detail::ContainingIntervalQuery<IntervalType>{interval});
+         }
+
+         // Returns every key when interval spans them all, as IntervalTree does.
+         SetType overlapping_interval(const IntervalType &interval) const {
+            if (this->spanned_by(interval)) { return this->collect(detail::ContainedByIntervalQuery<IntervalType>{interval}); }
+
+            return this->collect(detail::OverlappingIntervalQuery<IntervalType>{interval});
+         }
+
+         SetType contained_by_interval(const IntervalType &interval) const {
+            return this->collect(detail::ContainedByIntervalQuery<IntervalType>{interval});
+         }
+
+         template <typename Visitor>
+         bool for_each_value(Visitor &&visitor) const {
+            auto forward = [&visitor](const ValueType &value) { return detail::invoke_visitor(visitor, value); };
+            return detail::visit_nodes(this->root_node(), forward);
+         }
+
+         template <typename Visitor>
+         bool for_each_containing_point(const BoundType &point, Visitor &&visitor) const {
+            return this->visit(detail::ContainingPointQuery<IntervalType>{point}, visitor);
+         }
+
+         template <typename Visitor>
+         bool for_each_containing_interval(const IntervalType &interval, Visitor &&visitor) const {
+            return this->visit(detail::ContainingIntervalQuery<IntervalType>{interval}, visitor);
+         }
+
+         template <typename Visitor>
+         bool for_each_overlapping_interval(const IntervalType &interval, Visitor &&visitor) const {
+            if (this->spanned_by(interval)) { return this->visit(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor); }
+
+            return this->visit(detail::OverlappingIntervalQuery<IntervalType>{interval}, visitor);
+         }
+
+         template <typename Visitor>
+         bool for_each_contained_by_interval(const IntervalType &interval, Visitor &&visitor) const {
+            return this->visit(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor);
+         }
+      };
+
+      PersistentIntervalTreeBase() : _current(std::make_shared<const Version>(Version{nullptr, 0})) {}
+
+      template <typename Iterator>
+      PersistentIntervalTreeBase(Iterator first, Iterator last, BulkOrder order=BulkOrder::Unsorted) : PersistentIntervalTreeBase() {
+         auto sorted = detail::bulk_order<IntervalType, KeyOfValue>(first, last, order);
+
+         this->publish(build(sorted.data(), sorted.size()), sorted.size());
+      }
+
+      // Copies share every node with the source; the two trees diverge on their next write.
+      PersistentIntervalTreeBase(const PersistentIntervalTreeBase &other) : _current(other.load()) {}
+
+      PersistentIntervalTreeBase &operator=(const PersistentIntervalTreeBase &other) {
+         std::atomic_store(&this->_current, other.load());
+         return *this;
+      }
+
+      inline Snapshot snapshot() const { return Snapshot(this->load()); }
+
+      // Makes a snapshot the current version again, e.g. to roll back a failed batch of writes.
+      inline void restore(const Snapshot &snapshot) { std::atomic_store(&this->_current, snapshot._version); }
+
+      inline std::size_t size() const { return this->load()->size; }
+      inline bool empty() const { return this->size() == 0; }
+
+      inline void clear() { this->publish(nullptr, 0); }
+
+      // Returns false and keeps the stored value when the key is already present.
+      bool insert(const ValueType &value) { return this->insert_value<false>(value); }
+
+      void remove(const IntervalType &key) {
+         auto version = this->load();
+         auto removed = false;
+         auto root = remove_from(version->root, key, removed);
+
+         if (!removed) { throw exception::IntervalNotFound(); }
+
+         this->publish(std::move(root), version->size - 1);
+      }
+
+      inline bool contains(const IntervalType &key) const { return this->snapshot().contains(key); }
+
+      SetType containing_point(const BoundType &point) const { return this->snapshot().containing_point(point); }
+      SetType containing_interval(const IntervalType &interval) const { return this->snapshot().containing_interval(interval); }
+      SetType overlapping_interval(const IntervalType &interval) const { return this->snapshot().overlapping_interval(interval); }
+      SetType contained_by_interval(const IntervalType &interval) const { return this->snapshot().contained_by_interval(interval); }
+   };
+
+   template <typename IntervalType>
+   class PersistentIntervalTree : public PersistentIntervalTreeBase<IntervalType, IntervalType, avltree::KeyIsValue<IntervalType>>
+   {
+   public:
+      using BaseType = PersistentIntervalTreeBase<IntervalType, IntervalType, avltree::KeyIsValue<IntervalType>>;
+
+      PersistentIntervalTree() : BaseType() {}
+      PersistentIntervalTree(const std::vector<IntervalType> &intervals, BulkOrder order=BulkOrder::Unsorted)
+         : BaseType(intervals.begin(), intervals.end(), order) {}
+      template <typename Iterator>
+      PersistentIntervalTree(Iterator first, Iterator last, BulkOrder order=BulkOrder::Unsorted) : BaseType(first, last, order) {}
+   };
+
+   template <typename IntervalType, typename Value>
+   class PersistentIntervalMap : public PersistentIntervalTreeBase<IntervalType, std::pair<const IntervalType, Value>, avltree::KeyOfPair<IntervalType, Value>>
+   {
+   public:
+      using BaseType = PersistentIntervalTreeBase<IntervalType, std::pair<const IntervalType, Value>, avltree::KeyOfPair<IntervalType, Value>>;
+
+      PersistentIntervalMap() : BaseType() {}
+      PersistentIntervalMap(const std::vector<typename BaseType::ValueType> &entries, BulkOrder order=BulkOrder::Unsorted)
+         : BaseType(entries.begin(), entries.end(), order) {}
+      template <typename Iterator>
+      PersistentIntervalMap(Iterator first, Iterator last, BulkOrder order=BulkOrder::Unsorted) : BaseType(first, last, order) {}
+
+      bool insert(const IntervalType &key, const Value &value) {
+         return BaseType::insert(std::make_pair(key, value));
+      }
+
+      // Publishes a version with the key mapped to value; returns true when the key was new.
+      bool insert_or_assign(const IntervalType &key, const Value &value) {
+         return this->template insert_value<true>(std::make_pair(key, value));
+      }
+
+      // Returned by value: the node may be released by a concurrent write once the call returns.
+      Value get(const IntervalType &key) const {
+         return this->snapshot().get(key).second;
+      }
+   };
+}
+
+#endif
@@ -0,0 +1,844 @@
+#ifndef __WIDEINTERVALTREE_H
+#define __WIDEINTERVALTREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if !defined(INTERVALTREE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || defined(__AVX2__))
+#define INTERVALTREE_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include <intervaltree.hpp>
+
+namespace intervaltree
+{
+   namespace detail
+   {
+      namespace simd
+      {
+         inline unsigned lowest_bit(std::uint64_t mask) {
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward64(&index, mask);
+            return static_cast<unsigned>(index);
+#else
+            return static_cast<unsigned>(__builtin_ctzll(mask));
+#endif
+         }
+
+         inline std::uint64_t low_bits(std::size_t count) {
+            return (count >= 64) ? ~std::uint64_t(0) : (std::uint64_t(1) << count) - 1;
+         }
+
+         template <typename T>
+         inline bool compare(const T &value, BoundOp op, const T &bound) {
+            switch (op)
+            {
+            case BoundOp::Less: return value < bound;
+            case BoundOp::LessEqual: return value <= bound;
+            case BoundOp::Greater: return value > bound;
+            default: return value >= bound;
+            }
+         }
+
+         template <typename T>
+         std::uint64_t scalar_mask(const T *values, std::size_t count, BoundOp op, const T &bound) {
+            std::uint64_t mask = 0;
+
+            for (std::size_t i = 0; i < count; ++i)
+               mask |= std::uint64_t(compare(values[i], op, bound)) << i;
+
+            return mask;
+         }
+
+#if defined(INTERVALTREE_SIMD_X86)
+         /* Every op is built from a signed greater-than: a < b is b > a, and <= / >= are the
+          * negations of > / <. Unsigned lanes are biased by the sign bit first. Lanes are read
+          * up to the next multiple of the vector width, so columns must be padded to it.
+          */
+         inline bool swapped(BoundOp op) { return op == BoundOp::Less || op == BoundOp::GreaterEqual; }
+         inline bool negated(BoundOp op) { return op == BoundOp::LessEqual || op == BoundOp::GreaterEqual; }
+
+#if defined(__AVX2__)
+         inline std::uint64_t mask64(const std::int64_t *values, std::size_t count, BoundOp op, std::int64_t bound, std::int64_t bias) {
+            const __m256i flip = _mm256_set1_epi64x(bias);
+            const __m256i limit = _mm256_xor_si256(_mm256_set1_epi64x(bound), flip);
+            const bool swap = swapped(op), negate = negated(op);
+            std::uint64_t mask = 0;
+
+            for (std::size_t i = 0; i < count; i += 4)
+            {
+               auto lane = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i)), flip);
+               auto greater = swap ? _mm256_cmpgt_epi64(limit, lane) : _mm256_cmpgt_epi64(lane, limit);
+               auto bits = static_cast<std::uint64_t>(_mm256_movemask_pd(_mm256_castsi256_pd(greater)));
+
+               mask |= (negate ? (~bits & 0xF) : bits) << i;
+            }
+
+            return mask & low_bits(count);
+         }
+
+         inline std::uint64_t mask32(const std::int32_t *values, std::size_t count, BoundOp op, std::int32_t bound, std::int32_t bias) {
+            const __m256i flip = _mm256_set1_epi32(bias);
+            const __m256i limit = _mm256_xor_si256(_mm256_set1_epi32(bound), flip);
+            const bool swap = swapped(op), negate = negated(op);
+            std::uint64_t mask = 0;
+
+            for (std::size_t i = 0; i < count; i += 8)
+            {
+               auto lane = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i)), flip);
+               auto greater = swap ? _mm256_cmpgt_epi32(limit, lane) : _mm256_cmpgt_epi32(lane, limit);
+               auto bits = static_cast<std::uint64_t>(_mm256_movemask_ps(_mm256_castsi256_ps(greater)));
+
+               mask |= (negate ? (~bits & 0xFF) : bits) << i;
+            }
+
+            return mask & low_bits(count);
+         }
+#else
+#if defined(__SSE4_2__)
+         inline std::uint64_t mask64(const std::int64_t *values, std::size_t count, BoundOp op, std::int64_t bound, std::int64_t bias) {
+            const __m128i flip = _mm_set1_epi64x(bias);
+            const __m128i limit = _mm_xor_si128(_mm_set1_epi64x(bound), flip);
+            const bool swap = swapped(op), negate = negated(op);
+            std::uint64_t mask = 0;
+
+            for (std::size_t i = 0; i < count; i += 2)
+            {
+               auto lane = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i)), flip);
+               auto greater = swap ? _mm_cmpgt_epi64(limit, lane) : _mm_cmpgt_epi64(lane, limit);
+               auto bits = static_cast<std::uint64_t>(_mm_movemask_pd(_mm_castsi128_pd(greater)));
+
+               mask |= (negate ? (~bits & 0x3) : bits) << i;
+            }
+
+            return mask & low_bits(count);
+         }
+#endif
+
+         inline std::uint64_t mask32(const std::int32_t *values, std::size_t count, BoundOp op, std::int32_t bound, std::int32_t bias) {
+            const __m128i flip = _mm_set1_epi32(bias);
+            const __m128i limit = _mm_xor_si128(_mm_set1_epi32(bound), flip);
+            const bool swap = swapped(op), negate = negated(op);
+            std::uint64_t mask = 0;
+
+            for (std::size_t i = 0; i < count; i += 4)
+            {
+               auto lane = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i)), flip);
+               auto greater = swap ? _mm_cmpgt_epi32(limit, lane) : _mm_cmpgt_epi32(lane, limit);
+               auto bits = static_cast<std::uint64_t>(_mm_movemask_ps(_mm_castsi128_ps(greater)));
+
+               mask |= (negate ? (~bits & 0xF) : bits) << i;
+            }
+
+            return mask & low_bits(count);
+         }
+#endif
+#endif
+
+         // Bit i of the result is set when values[i] <op> bound holds, for i < count <= 64.
+         template <typename T>
+         inline std::uint64_t mask(const T *values, std::size_t count, BoundOp op, const T &bound) {
+#if defined(INTERVALTREE_SIMD_X86)
+            if constexpr (std::is_integral<T>::value && sizeof(T) == 4)
+            {
+               const std::int32_t bias = std::is_signed<T>::value ? 0 : INT32_MIN;
+               return mask32(reinterpret_cast<const std::int32_t *>(values), count, op, static_cast<std::int32_t>(bound), bias);
+            }
+#if defined(__AVX2__) || defined(__SSE4_2__)
+            else if constexpr (std::is_integral<T>::value && sizeof(T) == 8)
+            {
+               const std::int64_t bias = std::is_signed<T>::value ? 0 : INT64_MIN;
+               return mask64(reinterpret_cast<const std::int64_t *>(values), count, op, static_cast<std::int64_t>(bound), bias);
+            }
+#endif
+            else { return scalar_mask(values, count, op, bound); }
+#else
+            return scalar_mask(values, count, op, bound);
+#endif
+         }
+      }
+   }
+
+   /* A B+-tree over interval keys. Leaves hold up to Fanout keys as separate low and high columns;
+    * inner nodes hold the first key and the max high of each child. Queries test a whole node's
+    * column against the query bound at once (AVX2/SSE for 32- and 64-bit integral bounds, scalar
+    * otherwise) instead of chasing one pointer per key. Entries move on splits and merges, so
+    * unlike IntervalTree no stable node handles are handed out.
+    */
+   template <typename IntervalType, typename Value, std::size_t Fanout>
+   class WideIntervalTreeBase
+   {
+      static_assert(std::is_base_of<Interval<typename IntervalType::ValueType, IntervalType::Inclusive>, IntervalType>::value,
+                    "IntervalType template argument must derive the Interval structure.");
+      static_assert(Fanout >= 8 && Fanout <= 64 && Fanout % 8 == 0, "Fanout must be a multiple of 8 between 8 and 64.");
+
+   public:
+      using BoundType = typename IntervalType::ValueType;
+      using SetType = std::set<IntervalType, typename IntervalType::Compare>;
+      struct NoValue {};
+      using MappedType = typename std::conditional<std::is_void<Value>::value, NoValue, Value>::type;
+      using ValueType = typename std::conditional<std::is_void<Value>::value, IntervalType, std::pair<IntervalType, MappedType>>::type;
+
+   protected:
+      struct Node
+      {
+         bool leaf;
+         std::uint32_t count;
+         BoundType lows[Fanout];
+         BoundType highs[Fanout];
+
+         Node(bool leaf) : leaf(leaf), count(0), lows(), highs() {}
+      };
+
+      struct Leaf : public Node
+      {
+         MappedType values[Fanout];
+
+         Leaf() : Node(true), values() {}
+      };
+
+      struct Inner : public Node
+      {
+         BoundType maxes[Fanout];
+         Node *children[Fanout];
+
+         Inner() : Node(false), maxes(), children() {}
+      };
+
+      Node *_root;
+      std::size_t _size;
+
+      static inline Leaf *as_leaf(Node *node) { return static_cast<Leaf *>(node); }
+      static inline const Leaf *as_leaf(const Node *node) { return static_cast<const Leaf *>(node); }
+      static inline Inner *as_inner(Node *node) { return static_cast<Inner *>(node); }
+      static inline const Inner *as_inner(const Node *node) { return static_cast<const Inner *>(node); }
+
+      static inline IntervalType key_of(const Node *node, std::size_t index) {
+         IntervalType key;
+         key.low = node->lows[index];
+         key.high = node->highs[index];
+
+         return key;
+      }
+
+      static void free_node(Node *node) {
+         if (node->leaf) { delete as_leaf(node); }
+         else { delete as_inner(node); }
+      }
+
+      static void destroy(Node *node) {
+         if (node == nullptr) { return; }
+
+         if (!node->leaf)
+         {
+            for (std::uint32_t i = 0; i < node->count; ++i)
+               destroy(as_inner(node)->children[i]);
+         }
+
+         free_node(node);
+      }
+
+      static Node *clone(const Node *node) {
+         if (node == nullptr) { return nullptr; }
+
+         if (node->leaf) { return new Leaf(*as_leaf(node)); }
+
+         auto copy = new Inner(*as_inner(node));
+
+         for (std::uint32_t i = 0; i < copy->count; ++i)
+            copy->children[i] = clone(copy->children[i]);
+
+         return copy;
+      }
+
+      static BoundType subtree_max(const Node *node) {
+         auto column = node->leaf ? node->highs : as_inner(node)->maxes;
+         return *std::max_element(column, column + node->count);
+      }
+
+      static void refresh(Inner *inner, std::size_t index) {
+         auto child = inner->children[index];
+
+         inner->lows[index] = child->lows[0];
+         inner->highs[index] = child->highs[0];
+         inner->maxes[index] = subtree_max(child);
+      }
+
+      // Applies fn to each column of a node, or to matching column pairs of two nodes.
+      template <typename Function>
+      static void columns(Node *node, Function &&fn) {
+         fn(node->lows);
+         fn(node->highs);
+
+         if (node->leaf) { fn(as_leaf(node)->values); }
+         else { fn(as_inner(node)->maxes); fn(as_inner(node)->children); }
+      }
+
+      template <typename Function>
+      static void columns(Node *from, Node *to, Function &&fn) {
+         fn(from->lows, to->lows);
+         fn(from->highs, to->highs);
+
+         if (from->leaf) { fn(as_leaf(from)->values, as_leaf(to)->values); }
+         else
+         {
+            fn(as_inner(from)->maxes, as_inner(to)->maxes);
+            fn(as_inner(from)->children, as_inner(to)->children);
+         }
+      }
+
+      static void open_gap(Node *node, std::size_t index) {
+         columns(node, [&](auto *column) { std::move_backward(column + index, column + node->count, column + node->count + 1); });
+         ++node->count;
+      }
+
+      static void close_gap(Node *node, std::size_t index, std::size_t width) {
+         columns(node, [&](auto *column) { std::move(column + index + width, column + node->count, column + index); });
+         node->count -= static_cast<std::uint32_t>(width);
+      }
+
+      // Moves entries [from_index, from_index + width) of one node to the end of another.
+      static void transfer(Node *from, std::size_t from_index, Node *to, std::size_t width) {
+         auto to_index = to->count;
+
+         columns(from, to, [&](auto *source, auto *target) {
+            std::move(source + from_index, source + from_index + width, target + to_index);
+         });
+         to->count += static_cast<std::uint32_t>(width);
+      }
+
+      static Node *split(Node *node) {
+         Node *right = node->leaf ? static_cast<Node *>(new Leaf()) : static_cast<Node *>(new Inner());
+         auto half = node->count / 2;
+
+         transfer(node, half, right, node->count - half);
+         node->count = half;
+
+         return right;
+      }
+
+      // Index of the first key that does not sort before key.
+      static std::size_t lower_bound(const Node *node, const IntervalType &key) {
+         auto compare = typename IntervalType::Compare();
+         std::size_t low = 0, high = node->count;
+
+         while (low < high)
+         {
+            auto mid = low + (high - low) / 2;
+
+            if (compare(key_of(node, mid), key)) { low = mid + 1; }
+            else { high = mid; }
+         }
+
+         return low;
+      }
+
+      // Child whose key range covers key: the last child whose first key is not after it.
+      static std::size_t route(const Node *node, const IntervalType &key) {
+         auto index = lower_bound(node, key);
+
+         if (index < node->count && key_of(node, index) == key) { return index; }
+
+         return (index == 0) ? 0 : index - 1;
+      }
+
+      struct InsertResult
+      {
+         Node *split;
+         MappedType *slot;
+         bool inserted;
+      };
+
+      template <typename V>
+      InsertResult insert_into(Node *node, const IntervalType &key, V &&value) {
+         if (node->leaf)
+         {
+            auto index = lower_bound(node, key);
+
+            if (index < node->count && key_of(node, index) == key)
+               return { nullptr, &as_leaf(node)->values[index], false };
+
+            Node *right = nullptr;
+
+            if (node->count == Fanout)
+            {
+               right = split(node);
+
+               if (index > node->count) { index -= node->count; node = right; }
+            }
+
+            open_gap(node, index);
+            node->lows[index] = key.low;
+            node->highs[index] = key.high;
+            as_leaf(node)->values[index] = std::forward<V>(value);
+
+            return { right, &as_leaf(node)->values[index], true };
+         }
+
+         auto inner = as_inner(node);
+         auto index = route(inner, key);
+         auto result = this->insert_into(inner->children[index], key, std::forward<V>(value));
+
+         refresh(inner, index);
+
+         if (result.split == nullptr) { return result; }
+
+         auto child = result.split;
+         Node *right = nullptr;
+
+         ++index;
+
+         if (inner->count == Fanout)
+         {
+            right = split(inner);
+
+            if (index > inner->count) { index -= inner->count; inner = as_inner(right); }
+         }
+
+         open_gap(inner, index);
+         inner->children[index] = child;
+         refresh(inner, index);
+
+         result.split = right;
+
+         return result;
+      }
+
+      template <typename V>
+      InsertResult insert_root(const IntervalType &key, V &&value) {
+         if (this->_root == nullptr) { this->_root = new Leaf(); }
+
+         auto result = this->insert_into(this->_root, key, std::forward<V>(value));
+
+         if (result.split != nullptr)
+         {
+            auto root = new Inner();
+
+            root->children[0] = this->_root;
+            root->children[1] = result.split;
+            root->count = 2;
+            refresh(root, 0);
+            refresh(root, 1);
+
+            this->_root = root;
+         }
+
+         if (result.inserted) { ++this->_size; }
+
+         return result;
+      }
+
+      // Refills an underfull child from a neighbour, merging the two when they fit in one node.
+      static void rebalance(Inner *inner, std::size_t index) {
+         auto left_index = (index + 1 < inner->count) ? index : index - 1;
+         auto left = inner->children[left_index];
+         auto right = inner->children[left_index + 1];
+
+         if (left->count + right->count <= Fanout)
+         {
+            transfer(right, 0, left, right->count);
+            free_node(right);
+            close_gap(inner, left_index + 1, 1);
+         }
+         else if (left->count < right->count)
+         {
+            auto width = (right->count - left->count) / 2;
+
+            transfer(right, 0, left, width);
+            close_gap(right, 0, width);
+            refresh(inner, left_index + 1);
+         }
+         else
+         {
+            auto width = (left->count - right->count) / 2;
+
+            columns(right, [&](auto *column) { std::move_backward(column, column + right->count, column + right->count + width); });
+            columns(left, right, [&](auto *source, auto *target) {
+               std::move(source + left->count - width, source + left->count, target);
+            });
+            left->count -= static_cast<std::uint32_t>(width);
+            right->count += static_cast<std::uint32_t>(width);
+            refresh(inner, left_index + 1);
+         }
+
+         refresh(inner, left_index);
+      }
+
+      static bool remove_from(Node *node, const IntervalType &key) {
+         if (node->leaf)
+         {
+            auto index = lower_bound(node, key);
+
+            if (index == node->count || key_of(node, index) != key) { return false; }
+
+            close_gap(node, index, 1);
+
+            return true;
+         }
+
+         auto inner = as_inner(node);
+         auto index = route(inner, key);
+
+         if (!remove_from(inner->children[index], key)) { return false; }
+
+         if (inner->children[index]->count < Fanout / 2 && inner->count > 1) { rebalance(inner, index); }
+         else if (inner->children[index]->count > 0) { refresh(inner, index); }
+
+         return true;
+      }
+
+      const MappedType *find_slot(const IntervalType &key) const {
+         auto node = this->_root;
+
+         if (node == nullptr) { return nullptr; }
+
+         while (!node->leaf)
+            node = as_inner(node)->children[route(node, key)];
+
+         auto index = lower_bound(node, key);
+
+         if (index == node->count || key_of(node, index) != key) { return nullptr; }
+
+         return &as_leaf(node)->values[index];
+      }
+
+      template <typename Query, typename Visitor>
+      static detail::Visit visit(const Node *node, const Query &query, Visitor &visitor) {
+         if (node->leaf)
+         {
+            auto low_test = query.low_test();
+            auto high_test = query.high_test();
+            auto hits = detail::simd::mask(node->lows, node->count, low_test.op, low_test.value)
+                      & detail::simd::mask(node->highs, node->count, high_test.op, high_test.value);
+
+            while (hits != 0)
+            {
+               auto index = detail::simd::lowest_bit(hits);
+               hits &= hits - 1;
+
+               if (!visitor(as_leaf(node), index)) { return detail::Visit::Stopped; }
+            }
+
+            if (!query.may_match_after(key_of(node, node->count - 1))) { return detail::Visit::Exhausted; }
+
+            return detail::Visit::Continue;
+         }
+
+         auto inner = as_inner(node);
+         auto max_test = query.max_test();
+         auto below = detail::simd::mask(inner->maxes, inner->count, max_test.op, max_test.value);
+
+         for (std::uint32_t i = 0; i < inner->count; ++i)
+         {
+            if (!query.may_match_after(key_of(inner, i))) { return detail::Visit::Exhausted; }
+            if (((below >> i) & 1) == 0) { continue; }
+            if (i + 1 < inner->count && !query.may_match_before(key_of(inner, i + 1))) { continue; }
+
+            auto result = visit(inner->children[i], query, visitor);
+
+            if (result != detail::Visit::Continue) { return result; }
+         }
+
+         return detail::Visit::Continue;
+      }
+
+      template <typename Query, typename Visitor>
+      bool run(const Query &query, Visitor &visitor) const {
+         if (this->_root == nullptr) { return true; }
+
+         return visit(this->_root, query, visitor) != detail::Visit::Stopped;
+      }
+
+      // Visitors receive (key) for a tree and (key, value) for a map.
+      template <typename Query, typename Visitor>
+      bool visit_query(const Query &query, Visitor &visitor) const {
+         auto invoke = [&visitor](const Leaf *leaf, std::size_t index) {
+            auto key = key_of(leaf, index);
+
+            if constexpr (std::is_void<Value>::value) { return detail::invoke_visitor(visitor, key); }
+            else
+            {
+               auto &value = leaf->values[index];
+
+               if constexpr (std::is_void<decltype(visitor(key, value))>::value) { visitor(key, value); return true; }
+               else { return static_cast<bool>(visitor(key, value)); }
+            }
+         };
+
+         return this->run(query, invoke);
+      }
+
+      template <typename Query, typename Visitor>
+      bool visit_query(const Query &query, Visitor &visitor) {
+         auto invoke = [&visitor](const Leaf *leaf, std::size_t index) {
+            auto key = key_of(leaf, index);
+
+            if constexpr (std::is_void<Value>::value) { return detail::invoke_visitor(visitor, key); }
+            else
+            {
+               auto &value = const_cast<Leaf *>(leaf)->values[index];
+
+               if constexpr (std::is_void<decltype(visitor(key, value))>::value) { visitor(key, value); return true; }
+               else { return static_cast<bool>(visitor(key, value)); }
+            }
+         };
+
+         return this->run(query, invoke);
+      }
+
+      // The leftmost leaf holds the lowest low; the root's highs or child maxes hold the highest high.
+      bool spanned_by(const IntervalType &interval) const {
+         auto node = this->_root;
+         if (node == nullptr) { return false; }
+
+         auto highs = node->leaf ? node->highs : as_inner(node)->maxes;
+         auto highest = *std::max_element(highs, highs + node->count);
+
+         while (!node->leaf)
+            node = as_inner(node)->children[0];
+
+         return detail::spans_keys(interval, node->lows[0], highest);
+      }
+
+      template <typename Query>
+      SetType collect(const Query &query) const {
+         auto result = SetType();
+         auto insert = [&result](const IntervalType &key, auto &&...) { result.insert(key); };
+
+         this->visit_query(query, insert);
+
+         return result;
+      }
+
+      template <typename Function>
+      static void walk(const Node *node, Function &fn) {
+         if (node->leaf)
+         {
+            for (std::uint32_t i = 0; i < node->count; ++i)
+               fn(as_leaf(node), i);
+         }
+         else
+         {
+            for (std::uint32_t i = 0; i < node->count; ++i)
+               walk(as_inner(node)->children[i], fn);
+         }
+      }
+
+   public:
+      WideIntervalTreeBase() : _root(nullptr), _size(0) {}
+      WideIntervalTreeBase(const WideIntervalTreeBase &other) : _root(clone(other._root)), _size(other._size) {}
+      WideIntervalTreeBase(WideIntervalTreeBase &&other) noexcept : _root(other._root), _size(other._size) {
+         other._root = nullptr;
+         other._size = 0;
+      }
+      ~WideIntervalTreeBase() { destroy(this->_root); }
+
+      WideIntervalTreeBase &operator=(const WideIntervalTreeBase &other) {
+         if (this != &other)
+         {
+            auto root = clone(other._root);
+
+            destroy(this->_root);
+            this->_root = root;
+            this->_size = other._size;
+         }
+
+         return *this;
+      }
+
+      WideIntervalTreeBase &operator=(WideIntervalTreeBase &&other) noexcept {
+         std::swap(this->_root, other._root);
+         std::swap(this->_size, other._size);
+
+         return *this;
+      }
+
+      inline std::size_t size() const { return this->_size; }
+      inline bool empty() const { return this->_size == 0; }
+
+      void clear() {
+         destroy(this->_root);
+         this->_root = nullptr;
+         this->_size = 0;
+      }
+
+      inline bool contains(const IntervalType &key) const { return this->find_slot(key) != nullptr; }
+
+      void remove(const IntervalType &key) {
+         if (this->_root == nullptr || !remove_from(this->_root, key)) { throw exception::IntervalNotFound(); }
+
+         --this->_size;
+
+         if (!this->_root->leaf && this->_root->count == 1)
+         {
+            auto root = this->_root;
+
+            this->_root = as_inner(root)->children[0];
+            free_node(root);
+         }
+         else if (this->_root->count == 0) { this->clear(); }
+      }
+
+      std::vector<ValueType> to_vec() const {
+         std::vector<ValueType> result;
+
+         result.reserve(this->_size);
+         this->for_each_value([&result](const ValueType &value) { result.push_back(value); });
+
+         return result;
+      }
+
+      template <typename Visitor>
+      void for_each_value(Visitor &&visitor) const {
+         if (this->_root == nullptr) { return; }
+
+         auto invoke = [&visitor](const Leaf *leaf, std::size_t index) {
+            if constexpr (std::is_void<Value>::value) { visitor(key_of(leaf, index)); }
+            else { visitor(ValueType(key_of(leaf, index), leaf->values[index])); }
+         };
+
+         walk(this->_root, invoke);
+      }
+
+      SetType containing_point(const BoundType &point) const {
+         return this->collect(detail::ContainingPointQuery<IntervalType>{point});
+      }
+
+      SetType containing_interval(const IntervalType &interval) const {
+         return this->collect(detail::ContainingIntervalQuery<IntervalType>{interval});
+      }
+
+      // Returns every key when interval spans them all, as IntervalTree does.
+      SetType overlapping_interval(const IntervalType &interval) const {
+         if (this->spanned_by(interval)) { return this->collect(detail::ContainedByIntervalQuery<IntervalType>{interval}); }
+
+         return this->collect(detail::OverlappingIntervalQuery<IntervalType>{interval});
+      }
+
+      SetType contained_by_interval(const IntervalType &interval) const {
+         return this->collect(detail::ContainedByIntervalQuery<IntervalType>{interval});
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_point(const BoundType &point, Visitor &&visitor) const {
+         return this->visit_query(detail::ContainingPointQuery<IntervalType>{point}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_point(const BoundType &point, Visitor &&visitor) {
+         return this->visit_query(detail::ContainingPointQuery<IntervalType>{point}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_interval(const IntervalType &interval, Visitor &&visitor) const {
+         return this->visit_query(detail::ContainingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_containing_interval(const IntervalType &interval, Visitor &&visitor) {
+         return this->visit_query(detail::ContainingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_overlapping_interval(const IntervalType &interval, Visitor &&visitor) const {
+         if (this->spanned_by(interval)) { return this->visit_query(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor); }
+
+         return this->visit_query(detail::OverlappingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_overlapping_interval(const IntervalType &interval, Visitor &&visitor) {
+         if (this->spanned_by(interval)) { return this->visit_query(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor); }
+
+         return this->visit_query(detail::OverlappingIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_contained_by_interval(const IntervalType &interval, Visitor &&visitor) const {
+         return this->visit_query(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor);
+      }
+
+      template <typename Visitor>
+      bool for_each_contained_by_interval(const IntervalType &interval, Visitor &&visitor) {
+         return this->visit_query(detail::ContainedByIntervalQuery<IntervalType>{interval}, visitor);
+      }
+   };
+
+   template <typename IntervalType, std::size_t Fanout=32>
+   class WideIntervalTree : public WideIntervalTreeBase<IntervalType, void, Fanout>
+   {
+   public:
+      using BaseType = WideIntervalTreeBase<IntervalType, void, Fanout>;
+
+      WideIntervalTree() : BaseType() {}
+      WideIntervalTree(const std::vector<IntervalType> &intervals) : BaseType() {
+         for (auto &interval : intervals)
+            this->insert(interval);
+      }
+      template <typename InputIterator>
+      WideIntervalTree(InputIterator first, InputIterator last) : BaseType() {
+         for (; first != last; ++first)
+            this->insert(*first);
+      }
+
+      // Returns false when the interval was already present.
+      bool insert(const IntervalType &interval) {
+         return this->insert_root(interval, typename BaseType::NoValue()).inserted;
+      }
+   };
+
+   template <typename IntervalType, typename Value, std::size_t Fanout=32>
+   class WideIntervalMap : public WideIntervalTreeBase<IntervalType, Value, Fanout>
+   {
+   public:
+      using BaseType = WideIntervalTreeBase<IntervalType, Value, Fanout>;
+
+      WideIntervalMap() : BaseType() {}
+      WideIntervalMap(const std::vector<std::pair<IntervalType, Value>> &entries) : BaseType() {
+         for (auto &entry : entries)
+            this->insert(entry.first, entry.second);
+      }
+
+      // Keeps the existing value and returns false when the key was already present.
+      bool insert(const IntervalType &key, const Value &value) {
+         return this->insert_root(key, value).inserted;
+      }
+
+      Value &operator[](const IntervalType &key) {
+         auto slot = const_cast<Value *>(this->find_slot(key));
+
+         if (slot != nullptr) { return *slot; }
+
+         return *this->insert_root(key, Value()).slot;
+      }
+
+      Value &get(const IntervalType &key) {
+         auto slot = this->find_slot(key);
+
+         if (slot == nullptr) { throw exception::IntervalNotFound(); }
+
+         return *const_cast<Value *>(slot);
+      }
+
+      const Value &get(const IntervalType &key) const {
+         auto slot = this->find_slot(key);
+
+         if (slot == nullptr) { throw exception::IntervalNotFound(); }
+
+         return *slot;
+      }
+   };
+}
+
+#endif
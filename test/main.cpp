@@ -1,11 +1,68 @@
 #include <framework.hpp>
 #include <intervaltree.hpp>
+#include <frozenintervalindex.hpp>
+#include <wideintervaltree.hpp>
+#include <persistentintervaltree.hpp>
+#include <intervalset.hpp>
+#include <mappedintervalindex.hpp>
+#include <concurrentintervalmap.hpp>
+#include <lsmintervalindex.hpp>
 
 #include <cstdint>
 #include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 using namespace intervaltree;
 
+/* Keys that the query [5,10) spans. The empty exclusive key [5,5) only overlaps it under the
+ * whole-tree overlap rule; [6,10) spans nothing, so it leaves that key out.
+ */
+template <typename IntervalType>
+std::vector<IntervalType>
+spanned_fixture
+()
+{
+   return {IntervalType(5,5), IntervalType(5,10), IntervalType(6,8)};
+}
+
+// Whether index answers both queries over spanned_fixture() as an IntervalTree of those keys does.
+template <typename IntervalType, typename Index>
+bool
+overlaps_as_tree
+(const Index &index)
+{
+   IntervalTree<IntervalType> tree(spanned_fixture<IntervalType>());
+
+   return tree.overlapping_interval(IntervalType(5,10)).size() == 3
+      && index.overlapping_interval(IntervalType(5,10)) == tree.overlapping_interval(IntervalType(5,10))
+      && index.overlapping_interval(IntervalType(6,10)) == tree.overlapping_interval(IntervalType(6,10));
+}
+
+// A mapped value whose copies and moves throw once budget runs out. Copies are counted.
+struct Fragile
+{
+   static inline std::size_t budget = SIZE_MAX;
+   static inline std::size_t copies = 0;
+
+   std::size_t value;
+
+   Fragile(std::size_t value=0) : value(value) {}
+   Fragile(const Fragile &other) : value(other.value) { spend(); ++copies; }
+   Fragile(Fragile &&other) : value(other.value) { spend(); }
+   Fragile &operator=(const Fragile &other) = default;
+
+   static void spend() {
+      if (budget == 0) { throw std::runtime_error("Fragile budget spent."); }
+      --budget;
+   }
+
+   bool operator==(const Fragile &other) const { return this->value == other.value; }
+};
+
 int
 test_interval
 ()
@@ -95,6 +152,115 @@ test_intervaltree
    ASSERT(wiki_tree.overlapping_interval(IntervalType(0,25)) == TreeType::SetType({IntervalType(20,36), IntervalType(3,41), IntervalType(0,1), IntervalType(10,15)}));
    ASSERT(wiki_tree.contained_by_interval(IntervalType(0,41)) == TreeType::SetType({IntervalType(0,1), IntervalType(3,41), IntervalType(10,15), IntervalType(20,36)}));
 
+   std::vector<IntervalType> visited;
+   auto record = [&visited](const IntervalType &interval) { visited.push_back(interval); };
+   ASSERT(wiki_tree.for_each_containing_point(35, record) == true);
+   ASSERT(visited == std::vector<IntervalType>({IntervalType(3,41), IntervalType(20,36), IntervalType(29,99)}));
+
+   std::size_t seen = 0;
+   auto first_two = [&seen](const IntervalType &) { return ++seen < 2; };
+   ASSERT(wiki_tree.for_each_overlapping_interval(IntervalType(0,25), first_two) == false);
+   ASSERT(seen == 2);
+
+   auto spanned_keys = spanned_fixture<IntervalType>();
+   TreeType spanned_tree(spanned_keys);
+   IntervalTree<IntervalType, ArenaStorage> arena_spanned(spanned_keys);
+   std::size_t spanned_hits = 0;
+   auto count_hit = [&spanned_hits](const IntervalType &) { ++spanned_hits; };
+   ASSERT(overlaps_as_tree<IntervalType>(arena_spanned));
+   spanned_tree.for_each_overlapping_interval(IntervalType(5,10), count_hit);
+   arena_spanned.for_each_overlapping_interval(IntervalType(5,10), count_hit);
+   ASSERT(spanned_hits == 6);
+
+   auto overlapping = wiki_tree.overlapping_interval_range(IntervalType(0,25));
+   ASSERT(std::vector<IntervalType>(overlapping.begin(), overlapping.end()) == std::vector<IntervalType>({IntervalType(0,1), IntervalType(3,41), IntervalType(10,15), IntervalType(20,36)}));
+   ASSERT(*std::next(overlapping.begin()) == IntervalType(3,41));
+   ASSERT(wiki_tree.containing_point_range(100).empty());
+
+   auto spanned_range = spanned_tree.overlapping_interval_range(IntervalType(5,10));
+   auto arena_spanned_range = arena_spanned.overlapping_interval_range(IntervalType(5,10));
+   ASSERT(std::vector<IntervalType>(spanned_range.begin(), spanned_range.end()) == spanned_keys);
+   ASSERT(std::vector<IntervalType>(arena_spanned_range.begin(), arena_spanned_range.end()) == spanned_keys);
+   ASSERT(spanned_tree.overlapping_interval_range(IntervalType(6,10)).begin()->low == 5);
+
+   auto stabbed = wiki_tree.containing_points(std::vector<std::size_t>({35, 100, 0, 12}));
+   ASSERT(stabbed.size() == 4);
+   ASSERT(stabbed[0].size() == 3 && *stabbed[0][0] == IntervalType(3,41) && *stabbed[0][2] == IntervalType(29,99));
+   ASSERT(stabbed[1].empty());
+   ASSERT(stabbed[2].size() == 1 && *stabbed[2][0] == IntervalType(0,1));
+   ASSERT(stabbed[3].size() == 2);
+
+   auto overlapped = wiki_tree.overlapping_intervals(std::vector<IntervalType>({IntervalType(0,25), IntervalType(98,120), IntervalType(100,120)}));
+   ASSERT(overlapped[0].size() == 4 && *overlapped[0][0] == IntervalType(0,1) && *overlapped[0][3] == IntervalType(20,36));
+   ASSERT(overlapped[1].size() == 1 && *overlapped[1][0] == IntervalType(29,99));
+   ASSERT(overlapped[2].empty());
+
+   auto far_apart = wiki_tree.overlapping_intervals(std::vector<IntervalType>({IntervalType(95,97), IntervalType(0,2), IntervalType(35,37)}));
+   ASSERT(far_apart[0].size() == 1 && *far_apart[0][0] == IntervalType(29,99));
+   ASSERT(far_apart[1].size() == 1 && *far_apart[1][0] == IntervalType(0,1));
+   ASSERT(far_apart[2].size() == 3 && *far_apart[2][1] == IntervalType(20,36));
+
+   auto spanned_queries = std::vector<IntervalType>({IntervalType(6,10), IntervalType(5,10), IntervalType(0,3)});
+   auto spanned_batch = spanned_tree.overlapping_intervals(spanned_queries);
+   auto arena_spanned_batch = arena_spanned.overlapping_intervals(spanned_queries);
+   auto heap_spanned_batch = IntervalTree<IntervalType, HeapStorage>(spanned_keys).overlapping_intervals(spanned_queries);
+   ASSERT(spanned_tree.overlapping_intervals(std::vector<IntervalType>({IntervalType(5,10)}))[0].size() == 3);
+   ASSERT(spanned_batch[0].size() == 2 && spanned_batch[1].size() == 3 && *spanned_batch[1][0] == IntervalType(5,5) && spanned_batch[2].empty());
+   ASSERT(arena_spanned_batch[1].size() == 3 && arena_spanned_batch[0].size() == 2);
+   ASSERT(heap_spanned_batch[1].size() == 3 && heap_spanned_batch[0].size() == 2);
+
+   IntervalTree<IntervalType, ArenaStorage> probes(std::vector<IntervalType>({IntervalType(12,14), IntervalType(35,40)}));
+   std::vector<std::pair<IntervalType, IntervalType>> joined;
+   overlap_join(wiki_tree, probes, [&joined](const IntervalType &left, const IntervalType &right) { joined.emplace_back(left, right); });
+   ASSERT(joined.size() == 5);
+   ASSERT(std::count(joined.begin(), joined.end(), std::make_pair(IntervalType(29,99), IntervalType(35,40))) == 1);
+   ASSERT(std::count(joined.begin(), joined.end(), std::make_pair(IntervalType(0,1), IntervalType(12,14))) == 0);
+   ASSERT(containing_join(wiki_tree, probes).size() == 4);
+   ASSERT(contained_by_join(probes, wiki_tree).size() == 4);
+
+   auto sorted_wiki = wiki_tree.to_vec();
+   auto sorted_probes = probes.to_vec();
+   std::size_t range_pairs = 0;
+   overlap_join(sorted_wiki.begin(), sorted_wiki.end(), sorted_probes.begin(), sorted_probes.end(), [&range_pairs](const IntervalType &, const IntervalType &) { ++range_pairs; });
+   ASSERT(range_pairs == 5);
+
+   ASSERT(wiki_tree.any_containing_point(35) && !wiki_tree.any_containing_point(100));
+   ASSERT(wiki_tree.any_contained_by_interval(IntervalType(0,20)) && !wiki_tree.any_containing_interval(IntervalType(0,5)));
+   ASSERT(wiki_tree.count_containing_point(35) == 3);
+   ASSERT(wiki_tree.count_overlapping_interval(IntervalType(0,25)) == 4);
+   ASSERT(spanned_tree.count_overlapping_interval(IntervalType(5,10)) == 3 && arena_spanned.count_overlapping_interval(IntervalType(5,10)) == 3);
+   ASSERT(spanned_tree.count_overlapping_interval(IntervalType(6,10)) == spanned_tree.overlapping_interval(IntervalType(6,10)).size());
+   ASSERT(TreeType(std::vector<IntervalType>({IntervalType(5,5)})).any_overlapping_interval(IntervalType(5,5)));
+   ASSERT(wiki_tree.count_contained_by_interval(IntervalType(0,41)) == 4);
+   ASSERT(wiki_tree.count_starting_in(IntervalType(3,29)) == 3);
+   ASSERT(wiki_tree.rank(IntervalType(10,15)) == 2 && wiki_tree.rank(IntervalType(11,12)) == 3);
+   ASSERT(wiki_tree.select(2) == IntervalType(10,15));
+   ASSERT_THROWS(wiki_tree.select(5), exception::IndexOutOfRange);
+
+   IntervalTree<IntervalType, ArenaStorage> arena_tree(wiki_nodes);
+   ASSERT(arena_tree.containing_point(35) == wiki_tree.containing_point(35));
+   ASSERT(arena_tree.overlapping_interval(IntervalType(0,25)) == wiki_tree.overlapping_interval(IntervalType(0,25)));
+   ASSERT(arena_tree.contained_by_interval(IntervalType(0,41)) == wiki_tree.contained_by_interval(IntervalType(0,41)));
+   ASSERT_SUCCESS(arena_tree.remove(IntervalType(3,41)));
+   ASSERT_THROWS(arena_tree.remove(IntervalType(3,41)), exception::IntervalNotFound);
+   ASSERT_THROWS(arena_tree.remove(IntervalType(3,41)), exception::KeyNotFound);
+   ASSERT(arena_tree.containing_point(35) == TreeType::SetType({IntervalType(20,36), IntervalType(29,99)}));
+   ASSERT(arena_tree.size() == 4);
+   ASSERT(arena_tree.count_overlapping_interval(IntervalType(0,25)) == 3);
+   ASSERT(arena_tree.select(3) == IntervalType(29,99) && arena_tree.rank(IntervalType(29,99)) == 3);
+
+   IntervalTree<IntervalType, ArenaStorage> arena_copy(arena_tree);
+   arena_tree.clear();
+   ASSERT(arena_tree.empty() && arena_tree.begin() == arena_tree.end());
+   ASSERT(arena_copy.to_vec() == std::vector<IntervalType>({IntervalType(0,1), IntervalType(10,15), IntervalType(20,36), IntervalType(29,99)}));
+
+   IntervalTree<IntervalType, HeapStorage> heap_tree(wiki_nodes);
+   ASSERT(heap_tree.containing_interval(IntervalType(11,14)) == wiki_tree.containing_interval(IntervalType(11,14)));
+   ASSERT_SUCCESS(heap_tree.remove(IntervalType(3,41)));
+   ASSERT(heap_tree.to_vec() == arena_copy.to_vec());
+   heap_tree.clear();
+   ASSERT(heap_tree.empty());
+
    TreeType fuzz_tree(std::vector<IntervalType>({
             IntervalType(8,12),
             IntervalType(8,11),
@@ -112,9 +278,90 @@ test_intervaltree
 
    ASSERT(fuzz_tree.containing_interval(IntervalType(9,11)) == TreeType::SetType({IntervalType(8,12),IntervalType(8,11),IntervalType(9,12),IntervalType(4,24)}));
 
+   std::vector<IntervalType> sorted_nodes = fuzz_tree.to_vec();
+   IntervalTree<IntervalType, ArenaStorage> trusted_tree(sorted_nodes.begin(), sorted_nodes.end(), BulkOrder::Trusted);
+   IntervalTree<IntervalType, ArenaStorage> checked_tree(std::vector<IntervalType>(sorted_nodes.rbegin(), sorted_nodes.rend()), BulkOrder::Checked);
+   ASSERT(trusted_tree.to_vec() == sorted_nodes);
+   ASSERT(checked_tree.to_vec() == sorted_nodes);
+   ASSERT(trusted_tree.containing_interval(IntervalType(9,11)) == fuzz_tree.containing_interval(IntervalType(9,11)));
+   ASSERT(TreeType(sorted_nodes.begin(), sorted_nodes.end(), BulkOrder::Checked).to_vec() == sorted_nodes);
+
    auto deoverlapped = fuzz_tree.deoverlap();
    ASSERT(deoverlapped.to_vec() == std::vector<IntervalType>({IntervalType(0,24)}));
-   
+   ASSERT(fuzz_tree.deoverlap(Parallel(4)).to_vec() == deoverlapped.to_vec());
+
+   std::vector<IntervalType> many_nodes;
+   for (std::size_t i=0; i<20000; ++i)
+      many_nodes.push_back(IntervalType((i*7919) % 100000, (i*7919) % 100000 + i % 50));
+
+   IntervalTree<IntervalType, ArenaStorage> serial_tree(many_nodes.begin(), many_nodes.end());
+   IntervalTree<IntervalType, ArenaStorage> parallel_tree(many_nodes.begin(), many_nodes.end(), BulkOrder::Unsorted, Parallel(4));
+   ASSERT(parallel_tree.to_vec() == serial_tree.to_vec());
+   ASSERT(parallel_tree.overlapping_interval(IntervalType(1000,90000), Parallel(4)) == serial_tree.overlapping_interval(IntervalType(1000,90000)));
+   ASSERT(parallel_tree.contained_by_interval(IntervalType(1000,90000), Parallel(4)) == serial_tree.contained_by_interval(IntervalType(1000,90000)));
+   ASSERT(parallel_tree.containing_point(5000, Parallel(4)) == serial_tree.containing_point(5000));
+   ASSERT(parallel_tree.deoverlap(Parallel(4)).to_vec() == serial_tree.deoverlap().to_vec());
+
+   ASSERT(spanned_tree.overlapping_interval(IntervalType(5,10), Parallel(4)) == spanned_tree.overlapping_interval(IntervalType(5,10)));
+   ASSERT(arena_spanned.overlapping_interval(IntervalType(5,10), Parallel(4)).size() == 3);
+
+   auto serial_nodes = serial_tree.to_vec();
+   auto split_key = serial_nodes[serial_nodes.size() / 3];
+   IntervalTree<IntervalType, ArenaStorage> upper_tree;
+   serial_tree.split(split_key, upper_tree);
+   ASSERT(serial_tree.size() == serial_nodes.size() / 3 && upper_tree.select(0) == split_key);
+   ASSERT(serial_tree.size() + upper_tree.size() == serial_nodes.size());
+   ASSERT_THROWS(upper_tree.join(std::move(serial_tree)), exception::JoinOutOfOrder);
+   serial_tree.join(std::move(upper_tree));
+   ASSERT(upper_tree.empty() && serial_tree.to_vec() == serial_nodes);
+
+   IntervalTree<IntervalType, HeapStorage> heap_lower(many_nodes.begin(), many_nodes.end()), heap_upper;
+   heap_lower.split(split_key, heap_upper);
+   ASSERT(heap_upper.to_vec() == std::vector<IntervalType>(serial_nodes.begin() + serial_nodes.size() / 3, serial_nodes.end()));
+
+   auto doomed = serial_tree.overlapping_interval(IntervalType(1000,2000)).size();
+   ASSERT(serial_tree.erase_overlapping(IntervalType(1000,2000)) == doomed);
+
+   IntervalTree<IntervalType, ArenaStorage> arena_erased(spanned_keys);
+   TreeType shared_erased(spanned_keys);
+   ASSERT(arena_erased.erase_overlapping(IntervalType(5,10)) == 3 && arena_erased.empty());
+   ASSERT(shared_erased.erase_overlapping(IntervalType(5,10)) == 3);
+   ASSERT(!serial_tree.any_overlapping_interval(IntervalType(1000,2000)) && serial_tree.size() == serial_nodes.size() - doomed);
+   ASSERT(fuzz_tree.erase_contained_by(IntervalType(0,8)) == 5 && fuzz_tree.to_vec().size() == 7);
+
+   auto churned = serial_tree.memory_usage();
+   serial_tree.shrink_to_fit();
+   auto compacted = serial_tree.memory_usage();
+   ASSERT(compacted.nodes == serial_tree.size() && compacted.key_bytes == compacted.nodes * sizeof(IntervalType) && compacted.value_bytes == 0);
+   ASSERT(compacted.node_bytes() == churned.node_bytes() && compacted.slack_bytes < churned.slack_bytes);
+   ASSERT(serial_tree.to_vec().size() == compacted.nodes && !serial_tree.any_overlapping_interval(IntervalType(1000,2000)));
+
+   auto fuzz_nodes = fuzz_tree.to_vec();
+   fuzz_tree.shrink_to_fit();
+   ASSERT(fuzz_tree.to_vec() == fuzz_nodes && fuzz_tree.memory_usage().nodes == 7);
+   ASSERT(fuzz_tree.stats().height == 3);
+
+   ASSERT(trusted_tree.stats().height == 4);
+
+#if defined(INTERVALTREE_STATS)
+   std::vector<QueryStats> traced;
+   wiki_tree.reset_stats();
+   wiki_tree.set_query_trace([&traced](const QueryStats &stats) { traced.push_back(stats); });
+   wiki_tree.containing_point(35);
+   wiki_tree.containing_point(100);
+   ASSERT(traced.size() == 2 && std::string(traced[0].query) == "containing_point");
+   ASSERT(traced[0].hits == 3 && traced[1].hits == 0);
+   ASSERT(wiki_tree.stats().queries == 2 && wiki_tree.stats().hits == 3);
+   ASSERT(wiki_tree.stats().nodes_visited == traced[0].nodes_visited + traced[1].nodes_visited);
+   ASSERT(trusted_tree.stats().allocations == sorted_nodes.size() && trusted_tree.stats().rotations == 0);
+   fuzz_tree.reset_stats();
+   fuzz_tree.shrink_to_fit();
+   // the rebuild allocates once per node, and once more where avltree copies the tree in rather
+   // than moving it; that depends on the avltree release, so only more than both is an error
+   ASSERT(fuzz_tree.stats().allocations <= 2 * fuzz_tree.size() && fuzz_tree.stats().rotations == 0);
+   ASSERT(fuzz_tree.to_vec() == fuzz_nodes);
+#endif
+
    COMPLETE();
 }
 
@@ -151,10 +398,625 @@ test_intervalmap
 
    ASSERT(map[IntervalType(0x400000,0x406000)] == memory_regions.size());
    ASSERT(map[IntervalType(0x400000,0x401000)] == 5);
+
+   auto reset = [](auto &entry) { entry.second = 42; };
+   map.for_each_containing_point(0x400150, reset);
+   ASSERT(map[IntervalType(0x400000,0x406000)] == 42);
+   ASSERT(map[IntervalType(0x400100,0x400200)] == 42);
+   ASSERT(map[IntervalType(0x400200,0x400300)] == 1);
+
+   for (auto &entry : map.containing_interval_range(IntervalType(0x402000,0x403000)))
+      entry.second = 7;
+
+   ASSERT(map[IntervalType(0x402000,0x404000)] == 7);
+   ASSERT(map[IntervalType(0x401000,0x402000)] == 1);
+
+   IntervalMap<IntervalType, std::size_t, ArenaStorage> arena_map;
+
+   for (auto region : memory_regions)
+   {
+      arena_map.insert(region, 0);
+
+      for (auto contained : arena_map.containing_interval(region))
+         ++arena_map[contained];
+   }
+
+   ASSERT(arena_map[IntervalType(0x400000,0x406000)] == memory_regions.size());
+   ASSERT(arena_map[IntervalType(0x400000,0x401000)] == 5);
+   ASSERT(arena_map.size() == memory_regions.size());
+
+   IntervalMap<IntervalType, std::size_t, ArenaStorage> painted;
+   painted.assign(IntervalType(0x1000,0x5000), 1);
+   painted.assign(IntervalType(0x2000,0x3000), 2);
+   ASSERT(painted.size() == 3 && painted.get(IntervalType(0x1000,0x2000)) == 1);
+   ASSERT(painted.get(IntervalType(0x2000,0x3000)) == 2 && painted.get(IntervalType(0x3000,0x5000)) == 1);
+   painted.assign(IntervalType(0x2000,0x3000), 1, Coalesce::Adjacent);
+   ASSERT(painted.size() == 1 && painted.get(IntervalType(0x1000,0x5000)) == 1);
+   ASSERT(painted.erase_range(IntervalType(0x0,0x1800)) == true);
+   ASSERT(painted.erase_range(IntervalType(0x5000,0x6000)) == false);
+   ASSERT(painted.has_interval(IntervalType(0x1800,0x5000)));
+
+   // trims and rewrites keep the entry's node rather than unlinking and reinserting it
+   static_assert(std::is_nothrow_move_constructible<std::pair<const IntervalType, std::size_t>>::value, "Map entries must move without throwing.");
+   IntervalMap<IntervalType, std::size_t, ArenaStorage> trimmed;
+   for (std::size_t i=0; i<7; ++i)
+      trimmed.insert(IntervalType(i*20, i*20+10), i);
+
+   auto trimmed_root = trimmed.root_node();
+   ASSERT(trimmed_root->key() == IntervalType(60,70));
+   ASSERT(trimmed.erase_range(IntervalType(65,70)) == true);
+   ASSERT(trimmed.root_node() == trimmed_root && trimmed_root->key() == IntervalType(60,65));
+   trimmed.assign(IntervalType(60,65), 42);
+   ASSERT(trimmed.root_node() == trimmed_root && trimmed_root->value().second == 42);
+   trimmed.assign(IntervalType(50,62), 7);
+   ASSERT(trimmed.root_node() == trimmed_root && trimmed_root->key() == IntervalType(62,65));
+   ASSERT(trimmed.get(IntervalType(50,62)) == 7 && trimmed.size() == 8);
+
+   // the entries inside an assigned range go as one run, and the first of them takes the new entry
+   IntervalMap<IntervalType, std::size_t, ArenaStorage> striped;
+   for (std::size_t i=0; i<64; ++i)
+      striped.assign(IntervalType(i*10, i*10+10), i);
+
+   auto first_inside = striped.find(IntervalType(100,110));
+   striped.assign(IntervalType(95,505), 99);
+   ASSERT(striped.size() == 25 && striped.find(IntervalType(95,505)) == first_inside && *first_inside == 99);
+   ASSERT(striped.get(IntervalType(90,95)) == 9 && striped.get(IntervalType(505,510)) == 50);
+   ASSERT(striped.erase_range(IntervalType(0,95)) == true && striped.size() == 15);
+   ASSERT(striped.count_overlapping_interval(IntervalType(0,1000)) == 15 && striped.to_vec().front().first == IntervalType(95,505));
+
+   IntervalMap<IntervalType, std::size_t, ArenaStorage> edged;
+   edged.insert(IntervalType(5,5), 1);
+   edged.insert(IntervalType(5,10), 2);
+   edged.assign(IntervalType(5,10), 3);
+   ASSERT(edged.size() == 2 && edged.get(IntervalType(5,5)) == 1 && edged.get(IntervalType(5,10)) == 3);
+
+   MapType shared_painted;
+   shared_painted.assign(IntervalType(0x1000,0x5000), 1);
+   shared_painted.erase_range(IntervalType(0x2000,0x3000));
+   ASSERT(shared_painted.has_interval(IntervalType(0x1000,0x2000)) && shared_painted.has_interval(IntervalType(0x3000,0x5000)));
+
+   ASSERT(shared_painted.first_fit(0x800, IntervalType(0x1000,0x8000)) == IntervalType(0x2000,0x2800));
+   ASSERT(shared_painted.first_fit(0x1800, IntervalType(0x1000,0x8000)) == IntervalType(0x5000,0x6800));
+   ASSERT(!shared_painted.first_fit(0x1000, IntervalType(0x1000,0x2000)));
+   ASSERT(shared_painted.best_fit(0x800, IntervalType(0x0,0x8000)) == IntervalType(0x0,0x800));
+   ASSERT(shared_painted.aligned_fit(0x100, 0x4000, IntervalType(0x1000,0x9000)) == IntervalType(0x8000,0x8100));
+
+   using SignedType = Interval<long, true>;
+   IntervalTree<SignedType> signed_empty;
+   IntervalTree<SignedType, ArenaStorage> signed_arena(std::vector<SignedType>({SignedType(-12,-7)}));
+   ASSERT(signed_empty.aligned_fit(1, 4, SignedType(-5,10)) == SignedType(-4,-4));
+   ASSERT(signed_arena.aligned_fit(2, 4, SignedType(-12,10)) == SignedType(-4,-3));
+   ASSERT(painted.first_fit(0x100, IntervalType(0x0,0x6000)) == IntervalType(0x0,0x100));
+   ASSERT(painted.best_fit(0x1000, IntervalType(0x0,0x6000)) == IntervalType(0x5000,0x6000));
+
+   ASSERT(shared_painted.find_containing(0x3800)->first == IntervalType(0x3000,0x5000));
+   ASSERT(shared_painted.find_containing(0x2800) == nullptr);
+
+   MapType::Finger finger;
+   ASSERT(shared_painted.find_containing(0x1000, finger)->first == IntervalType(0x1000,0x2000));
+   ASSERT(shared_painted.find_containing(0x1fff, finger)->first == IntervalType(0x1000,0x2000));
+   ASSERT(shared_painted.find_containing(0x2000, finger) == nullptr);
+   ASSERT(shared_painted.find_containing(0x4fff, finger)->second == 1);
+   ASSERT(painted.find_containing(0x1800)->first == IntervalType(0x1800,0x5000));
+
+   ASSERT(map.find(IntervalType(0x400000,0x401000)) != nullptr && *map.find(IntervalType(0x400000,0x401000)) == 42);
+   ASSERT(map.find(IntervalType(0x500000,0x501000)) == nullptr);
+   ASSERT(map.try_emplace(IntervalType(0x400000,0x401000), 99).second == false);
+   ASSERT(map.insert_or_assign(IntervalType(0x400000,0x401000), 99).second == false && map.get(IntervalType(0x400000,0x401000)) == 99);
+   ASSERT(map.emplace(IntervalType(0x500000,0x501000), 3).second == true && map[IntervalType(0x500000,0x501000)] == 3);
+   ASSERT(map.emplace(IntervalType(0x500000,0x501000), 4).second == false && map.get(IntervalType(0x500000,0x501000)) == 3);
+
+   std::size_t seven = 7;
+   ASSERT(map.try_emplace(IntervalType(0x600000,0x601000), seven).second == true);
+   ASSERT(map.try_emplace(IntervalType(0x600000,0x601000), seven).second == false && map.get(IntervalType(0x600000,0x601000)) == 7);
+   ASSERT(map[IntervalType(0x700000,0x701000)] == 0 && map.has_interval(IntervalType(0x700000,0x701000)));
+
+   IntervalMap<IntervalType, std::unique_ptr<std::size_t>, ArenaStorage> owned;
+   ASSERT(owned.try_emplace(IntervalType(0x1000,0x2000), new std::size_t(1)).second == true);
+   owned[IntervalType(0x2000,0x3000)] = std::make_unique<std::size_t>(2);
+   owned.insert_or_assign(IntervalType(0x1000,0x2000), std::make_unique<std::size_t>(3));
+   ASSERT(**owned.find(IntervalType(0x1000,0x2000)) == 3 && *owned.get(IntervalType(0x2000,0x3000)) == 2);
+   ASSERT(owned.size() == 2);
+
+   // a rebuild that throws halfway leaves the map as it was
+   IntervalMap<IntervalType, Fragile, ArenaStorage> fragile;
+   for (std::size_t i=0; i<3000; ++i)
+      fragile.insert(IntervalType(i*0x10,i*0x10+0x10), Fragile(i));
+
+   auto fragile_entries = fragile.to_vec();
+   auto shrink_threw = false;
+   Fragile::budget = 1500;
+
+   try { fragile.shrink_to_fit(); }
+   catch (std::runtime_error &) { shrink_threw = true; }
+
+   Fragile::budget = SIZE_MAX;
+   ASSERT(shrink_threw && fragile.to_vec() == fragile_entries);
+   ASSERT(fragile.containing_point(0x5008).size() == 1 && fragile.get(IntervalType(0x5000,0x5010)).value == 0x500);
+
+   // a painted value is moved into its node; only the shared node copies it, once
+   IntervalMap<IntervalType, Fragile> shared_fragile;
+   Fragile::copies = 0;
+   fragile.assign(IntervalType(0x100,0x200), Fragile(1));
+   fragile.assign(IntervalType(0x1000000,0x1000010), Fragile(2));
+   shared_fragile.assign(IntervalType(0x100,0x200), Fragile(1));
+   ASSERT(Fragile::copies == 1 && fragile.get(IntervalType(0x100,0x200)).value == 1 && fragile.get(IntervalType(0x1000000,0x1000010)).value == 2);
    
    COMPLETE();
 }
 
+int
+test_frozenintervalindex
+()
+{
+   INIT();
+
+   using IntervalType = Interval<std::size_t>;
+   using InclusiveType = Interval<std::size_t, true>;
+   using TreeType = IntervalTree<IntervalType>;
+
+   std::vector<IntervalType> wiki_nodes = {
+      IntervalType(20,36),
+      IntervalType(29,99),
+      IntervalType(3,41),
+      IntervalType(0,1),
+      IntervalType(10,15)
+   };
+   TreeType wiki_tree(wiki_nodes);
+   auto frozen = freeze(wiki_tree);
+
+   ASSERT(frozen.size() == 5);
+   ASSERT(frozen.containing_point(35) == wiki_tree.containing_point(35));
+   ASSERT(frozen.containing_interval(IntervalType(11,14)) == wiki_tree.containing_interval(IntervalType(11,14)));
+   ASSERT(frozen.overlapping_interval(IntervalType(0,25)) == wiki_tree.overlapping_interval(IntervalType(0,25)));
+   ASSERT(frozen.contained_by_interval(IntervalType(0,41)) == wiki_tree.contained_by_interval(IntervalType(0,41)));
+   ASSERT(frozen.containing_point(99).empty());
+
+   FrozenIntervalIndex<InclusiveType> inclusive(std::vector<InclusiveType>({InclusiveType(20,36), InclusiveType(29,99), InclusiveType(3,41)}));
+   ASSERT(inclusive.containing_point(99) == IntervalTree<InclusiveType>::SetType({InclusiveType(29,99)}));
+   ASSERT(inclusive.overlapping_interval(InclusiveType(0,3)) == IntervalTree<InclusiveType>::SetType({InclusiveType(3,41)}));
+
+   IntervalMap<IntervalType, std::size_t> map;
+   for (std::size_t i=0; i<100; ++i)
+      map.insert(IntervalType(i*0x1000, i*0x1000+0x2000), i);
+
+   auto frozen_map = freeze(map);
+   std::size_t total = 0;
+   auto sum = [&total](const IntervalType &, const std::size_t &value) { total += value; };
+   ASSERT(frozen_map.for_each_containing_point(0x5800, sum) == true);
+   ASSERT(total == 4 + 5);
+   ASSERT(frozen_map.overlapping_interval(IntervalType(0x10000,0x20000)) == map.overlapping_interval(IntervalType(0x10000,0x20000)));
+
+   auto compact_map = freeze<CompactKeys>(map);
+   ASSERT(compact_map.overlapping_interval(IntervalType(0x10000,0x20000)) == frozen_map.overlapping_interval(IntervalType(0x10000,0x20000)));
+   ASSERT(compact_map.containing_point(0x5800) == frozen_map.containing_point(0x5800));
+   ASSERT(compact_map.value(7) == frozen_map.value(7));
+
+   std::vector<IntervalType> sparse_keys;
+   for (std::size_t i=0; i<1000; ++i)
+      sparse_keys.push_back(IntervalType(i << 24, (i << 24) + ((i % 97 == 0) ? (std::size_t(1) << 40) : i)));
+
+   FrozenIntervalIndex<IntervalType> wide_sparse(sparse_keys);
+   FrozenIntervalIndex<IntervalType, void, CompactKeys> compact_sparse(sparse_keys);
+   ASSERT(compact_sparse.columns().escaped_count() > 0);
+   ASSERT(compact_sparse.key(582) == wide_sparse.key(582));
+   ASSERT(wide_sparse.lows().size() == 1000 && wide_sparse.lows()[582] == compact_sparse.key(582).low);
+   ASSERT(compact_sparse.containing_point(std::size_t(500) << 24) == wide_sparse.containing_point(std::size_t(500) << 24));
+   auto sparse_query = IntervalType(std::size_t(3) << 24, std::size_t(900) << 24);
+   ASSERT(wide_sparse.overlapping_interval(sparse_query).size() == 898);
+   ASSERT(compact_sparse.overlapping_interval(sparse_query) == wide_sparse.overlapping_interval(sparse_query));
+
+   ASSERT(overlaps_as_tree<IntervalType>(FrozenIntervalIndex<IntervalType>(spanned_fixture<IntervalType>())));
+   ASSERT(overlaps_as_tree<IntervalType>(FrozenIntervalIndex<IntervalType, void, CompactKeys>(spanned_fixture<IntervalType>())));
+
+   COMPLETE();
+}
+
+int
+test_wideintervaltree
+()
+{
+   INIT();
+
+   using IntervalType = Interval<std::size_t>;
+   using TreeType = IntervalTree<IntervalType>;
+
+   std::vector<IntervalType> wiki_nodes = {
+      IntervalType(20,36),
+      IntervalType(29,99),
+      IntervalType(3,41),
+      IntervalType(0,1),
+      IntervalType(10,15)
+   };
+   TreeType wiki_tree(wiki_nodes);
+   WideIntervalTree<IntervalType> wide_tree(wiki_nodes);
+
+   ASSERT(wide_tree.size() == 5);
+   ASSERT(wide_tree.insert(IntervalType(0,1)) == false);
+   ASSERT(wide_tree.containing_point(35) == wiki_tree.containing_point(35));
+   ASSERT(wide_tree.containing_interval(IntervalType(11,14)) == wiki_tree.containing_interval(IntervalType(11,14)));
+   ASSERT(wide_tree.overlapping_interval(IntervalType(0,25)) == wiki_tree.overlapping_interval(IntervalType(0,25)));
+   ASSERT(wide_tree.contained_by_interval(IntervalType(0,41)) == wiki_tree.contained_by_interval(IntervalType(0,41)));
+   ASSERT(overlaps_as_tree<IntervalType>(WideIntervalTree<IntervalType>(spanned_fixture<IntervalType>())));
+
+   wide_tree.remove(IntervalType(3,41));
+   ASSERT(wide_tree.containing_point(35) == TreeType::SetType({IntervalType(20,36), IntervalType(29,99)}));
+   ASSERT_THROWS(wide_tree.remove(IntervalType(3,41)), exception::IntervalNotFound);
+   ASSERT_THROWS(wide_tree.remove(IntervalType(3,41)), exception::KeyNotFound);
+
+   // small fanout forces splits, merges and multi-level descents
+   WideIntervalMap<IntervalType, std::size_t, 8> map;
+   IntervalMap<IntervalType, std::size_t> reference;
+
+   for (std::size_t i=0; i<1000; ++i)
+   {
+      map.insert(IntervalType(i*0x1000, i*0x1000+0x2000), i);
+      reference.insert(IntervalType(i*0x1000, i*0x1000+0x2000), i);
+   }
+
+   for (std::size_t i=0; i<1000; i+=3)
+   {
+      map.remove(IntervalType(i*0x1000, i*0x1000+0x2000));
+      reference.remove(IntervalType(i*0x1000, i*0x1000+0x2000));
+   }
+
+   ASSERT(map.size() == 666);
+   ASSERT(map.overlapping_interval(IntervalType(0x10000,0x80000)) == reference.overlapping_interval(IntervalType(0x10000,0x80000)));
+   ASSERT(map.contained_by_interval(IntervalType(0x100000,0x180000)) == reference.contained_by_interval(IntervalType(0x100000,0x180000)));
+
+   std::size_t total = 0;
+   auto sum = [&total](const IntervalType &, std::size_t &value) { total += value; };
+   ASSERT(map.for_each_containing_point(0x5800, sum) == true);
+   ASSERT(total == 4 + 5);
+
+   map[IntervalType(0x4000,0x6000)] = 42;
+   ASSERT(map.get(IntervalType(0x4000,0x6000)) == 42);
+   ASSERT(map[IntervalType(0x3000,0x5000)] == 0);
+
+   COMPLETE();
+}
+
+int
+test_persistentintervaltree
+()
+{
+   INIT();
+
+   using IntervalType = Interval<std::size_t>;
+   using TreeType = IntervalTree<IntervalType>;
+
+   std::vector<IntervalType> wiki_nodes = {
+      IntervalType(20,36),
+      IntervalType(29,99),
+      IntervalType(3,41),
+      IntervalType(0,1),
+      IntervalType(10,15)
+   };
+   TreeType wiki_tree(wiki_nodes);
+   PersistentIntervalTree<IntervalType> persistent_tree(wiki_nodes);
+
+   auto before = persistent_tree.snapshot();
+   ASSERT(before.size() == 5);
+   ASSERT(before.containing_point(35) == wiki_tree.containing_point(35));
+   ASSERT(before.overlapping_interval(IntervalType(0,25)) == wiki_tree.overlapping_interval(IntervalType(0,25)));
+   ASSERT(before.contained_by_interval(IntervalType(0,41)) == wiki_tree.contained_by_interval(IntervalType(0,41)));
+
+   persistent_tree.remove(IntervalType(3,41));
+   ASSERT(persistent_tree.insert(IntervalType(30,40)) == true);
+   ASSERT(persistent_tree.insert(IntervalType(30,40)) == false);
+   ASSERT_THROWS(persistent_tree.remove(IntervalType(3,41)), exception::IntervalNotFound);
+   ASSERT_THROWS(persistent_tree.remove(IntervalType(3,41)), exception::KeyNotFound);
+
+   // the earlier snapshot is unaffected by later writes
+   ASSERT(before.containing_point(35) == wiki_tree.containing_point(35));
+   ASSERT(persistent_tree.containing_point(35) == TreeType::SetType({IntervalType(20,36), IntervalType(29,99), IntervalType(30,40)}));
+   ASSERT(persistent_tree.snapshot().size() == 5);
+
+   persistent_tree.restore(before);
+   ASSERT(persistent_tree.contains(IntervalType(3,41)));
+
+   PersistentIntervalTree<IntervalType> persistent_spanned(spanned_fixture<IntervalType>());
+   std::size_t spanned_hits = 0;
+   ASSERT(overlaps_as_tree<IntervalType>(persistent_spanned));
+   persistent_spanned.snapshot().for_each_overlapping_interval(IntervalType(5,10), [&spanned_hits](const IntervalType &) { ++spanned_hits; });
+   ASSERT(spanned_hits == 3);
+
+   PersistentIntervalMap<IntervalType, std::size_t> map;
+   for (std::size_t i=0; i<100; ++i)
+      map.insert(IntervalType(i*0x1000, i*0x1000+0x2000), i);
+
+   auto version = map.snapshot();
+   ASSERT(map.insert_or_assign(IntervalType(0x4000,0x6000), 42) == false);
+   ASSERT(map.get(IntervalType(0x4000,0x6000)) == 42);
+   ASSERT(version.get(IntervalType(0x4000,0x6000)).second == 4);
+
+   std::size_t total = 0;
+   auto sum = [&total](const std::pair<const IntervalType, std::size_t> &entry) { total += entry.second; };
+   ASSERT(map.snapshot().for_each_containing_point(0x5800, sum) == true);
+   ASSERT(total == 42 + 5);
+
+   COMPLETE();
+}
+
+int
+test_intervalset
+()
+{
+   INIT();
+
+   using IntervalType = Interval<std::size_t>;
+   using InclusiveType = Interval<std::size_t, true>;
+
+   IntervalSet<IntervalType> set(std::vector<IntervalType>({IntervalType(0,4), IntervalType(2,6), IntervalType(10,12), IntervalType(5,8)}));
+   ASSERT(set.to_vec() == std::vector<IntervalType>({IntervalType(0,8), IntervalType(10,12)}));
+
+   ASSERT(set.insert(IntervalType(7,11))->key() == IntervalType(0,12));
+   ASSERT(set.size() == 1);
+   ASSERT(set.erase(IntervalType(3,5)) == true);
+   ASSERT(set.to_vec() == std::vector<IntervalType>({IntervalType(0,3), IntervalType(5,12)}));
+   ASSERT(set.erase(IntervalType(3,5)) == false);
+   ASSERT(set.contains_point(4) == false && *set.find(5) == IntervalType(5,12));
+   ASSERT(set.overlapping_interval(IntervalType(2,6)) == IntervalTree<IntervalType>::SetType({IntervalType(0,3), IntervalType(5,12)}));
+   ASSERT(set.insert(IntervalType(3,3)) == nullptr);
+
+   // trims and merges that keep a node's order rewrite its key without unlinking it
+   static_assert(std::is_nothrow_move_constructible<IntervalType>::value, "Interval must move without throwing.");
+   std::vector<IntervalType> spaced;
+   for (std::size_t i=0; i<7; ++i)
+      spaced.push_back(IntervalType(i*20, i*20+10));
+
+   IntervalSet<IntervalType> trimmed(spaced);
+   auto trimmed_root = trimmed.root_node();
+   ASSERT(trimmed_root->key() == IntervalType(60,70));
+   ASSERT(trimmed.erase(IntervalType(65,70)) == true);
+   ASSERT(trimmed.root_node() == trimmed_root && trimmed_root->key() == IntervalType(60,65));
+   ASSERT(trimmed.insert(IntervalType(58,62)) == trimmed_root && trimmed.root_node() == trimmed_root);
+
+   // a wide insert absorbs, and a wide erase cuts, thousands of intervals as one run
+   std::vector<IntervalType> striped;
+   for (std::size_t i=0; i<10000; ++i)
+      striped.push_back(IntervalType(i*10,i*10+5));
+
+   IntervalSet<IntervalType> absorbing(striped);
+   auto absorbed_into = absorbing.insert(IntervalType(17,99000));
+   ASSERT(absorbed_into != nullptr && absorbed_into->key() == IntervalType(17,99000) && absorbing.size() == 103);
+   ASSERT(absorbing.to_vec()[1] == IntervalType(10,15) && absorbing.to_vec()[3] == IntervalType(99000,99005));
+   ASSERT(absorbing.stats().height <= 8 && absorbing.find(50000) == &absorbed_into->key());
+
+   IntervalSet<IntervalType> cutting(striped);
+   ASSERT(cutting.erase(IntervalType(3,99993)) == true);
+   ASSERT(cutting.to_vec() == std::vector<IntervalType>({IntervalType(0,3), IntervalType(99993,99995)}));
+   ASSERT(cutting.erase(IntervalType(0,99995)) == true && cutting.empty());
+
+   IntervalSet<IntervalType> adjacent(Coalesce::Adjacent);
+   adjacent.insert(IntervalType(0,5));
+   adjacent.insert(IntervalType(10,15));
+   adjacent.insert(IntervalType(5,10));
+   ASSERT(adjacent.to_vec() == std::vector<IntervalType>({IntervalType(0,15)}));
+
+   IntervalSet<InclusiveType> inclusive(Coalesce::Adjacent);
+   inclusive.insert(InclusiveType(0,4));
+   inclusive.insert(InclusiveType(5,9));
+   ASSERT(inclusive.to_vec() == std::vector<InclusiveType>({InclusiveType(0,9)}));
+   inclusive.erase(InclusiveType(3,3));
+   ASSERT(inclusive.to_vec() == std::vector<InclusiveType>({InclusiveType(0,2), InclusiveType(4,9)}));
+
+   IntervalSet<IntervalType> upper;
+   set.split(IntervalType(4,4), upper);
+   ASSERT(set.to_vec() == std::vector<IntervalType>({IntervalType(0,3)}) && upper.to_vec() == std::vector<IntervalType>({IntervalType(5,12)}));
+   upper.insert(IntervalType(20,30));
+   set.insert(IntervalType(2,6));
+   set.join(std::move(upper));
+   ASSERT(set.to_vec() == std::vector<IntervalType>({IntervalType(0,12), IntervalType(20,30)}));
+
+   IntervalTree<IntervalType> tree(std::vector<IntervalType>({IntervalType(8,12), IntervalType(0,4), IntervalType(2,6), IntervalType(20,24)}));
+   ASSERT(normalize(tree).to_vec() == std::vector<IntervalType>({IntervalType(0,6), IntervalType(8,12), IntervalType(20,24)}));
+   ASSERT(tree.deoverlap().to_vec() == normalize(tree).to_vec());
+
+   COMPLETE();
+}
+
+int
+test_concurrentintervalmap
+()
+{
+   INIT();
+
+   using IntervalType = Interval<std::size_t>;
+   using MapType = ConcurrentIntervalMap<IntervalType, std::size_t>;
+
+   MapType map(4, 0, 4000);
+   ASSERT(map.bounds() == std::vector<std::size_t>({1000, 2000, 3000}));
+
+   std::vector<std::thread> writers;
+   for (std::size_t thread=0; thread<4; ++thread)
+      writers.emplace_back([&map, thread]() {
+         for (std::size_t i=thread; i<4000; i+=4)
+            map.insert(IntervalType(i, i+10), i);
+      });
+
+   for (auto &writer : writers)
+      writer.join();
+
+   ASSERT(map.size() == 4000 && map.shard_sizes() == std::vector<std::size_t>({1000, 1000, 1000, 1000}));
+   ASSERT(map.containing_point(1005).size() == 10);
+   ASSERT(map.overlapping_interval(IntervalType(995,1001)).size() == 15);
+   ASSERT(*map.find(IntervalType(1999,2009)) == 1999 && !map.find(IntervalType(1999,2000)));
+   ASSERT(map.insert(IntervalType(0,10), 7) == false && map.insert_or_assign(IntervalType(0,10), 7) == false);
+   ASSERT(*map.find(IntervalType(0,10)) == 7);
+
+   ASSERT(map.erase_overlapping(IntervalType(0,2500)) == 2500);
+   ASSERT(map.remove(IntervalType(2500,2510)) && !map.remove(IntervalType(2500,2510)));
+   map.rebalance();
+   ASSERT(map.size() == 1499 && map.bounds().front() > 2500);
+   ASSERT(map.containing_point(3000).size() == 10);
+
+   std::vector<std::size_t> bounds = {2000, 3000, 3500};
+   ASSERT_SUCCESS(map.rebalance(bounds));
+   ASSERT(map.shard_sizes() == std::vector<std::size_t>({0, 499, 500, 500}));
+   ASSERT_THROWS(map.rebalance(std::vector<std::size_t>({3000, 2000, 3500})), exception::BadShardBounds);
+
+   map.shrink_to_fit();
+   ASSERT(map.memory_usage().nodes == 1499 && map.containing_point(3000).size() == 10);
+
+   // the whole-tree overlap rule is decided over every shard, not per shard
+   MapType spanned(std::vector<std::size_t>({10, 20}));
+   IntervalMap<IntervalType, std::size_t> reference;
+   for (auto &key : std::vector<IntervalType>({IntervalType(5,5), IntervalType(5,10), IntervalType(6,8), IntervalType(20,20), IntervalType(20,30)}))
+   {
+      spanned.insert(key, key.low);
+      reference.insert(key, key.low);
+   }
+
+   std::size_t spanned_hits = 0;
+   spanned.for_each_overlapping_interval(IntervalType(5,30), [&spanned_hits](const std::pair<const IntervalType, std::size_t> &) { ++spanned_hits; });
+   ASSERT(spanned_hits == 5 && spanned.overlapping_interval(IntervalType(5,30)) == reference.overlapping_interval(IntervalType(5,30)));
+   ASSERT(spanned.overlapping_interval(IntervalType(5,10)) == reference.overlapping_interval(IntervalType(5,10)));
+   ASSERT(spanned.erase_overlapping(IntervalType(5,10)) == 2 && spanned.contains(IntervalType(5,5)));
+   ASSERT(spanned.erase_overlapping(IntervalType(5,30)) == 3 && spanned.empty());
+
+   COMPLETE();
+}
+
+int
+test_lsmintervalindex
+()
+{
+   INIT();
+
+   using IntervalType = Interval<std::size_t>;
+
+   LsmIntervalIndex<IntervalType, std::size_t> index(16);
+   IntervalMap<IntervalType, std::size_t, ArenaStorage> map;
+
+   for (std::size_t i=0; i<1000; ++i)
+   {
+      auto key = IntervalType((i*7919) % 1000, (i*7919) % 1000 + i % 20 + 1);
+
+      index.insert(key, i);
+      map.insert_or_assign(key, i);
+
+      if (i % 3 == 0)
+      {
+         index.remove(IntervalType(i, i+1));
+         if (map.contains(IntervalType(i, i+1))) { map.remove(IntervalType(i, i+1)); }
+      }
+   }
+
+   ASSERT(index.run_count() > 1 && index.buffered() > 0);
+   ASSERT(index.containing_point(500) == map.containing_point(500));
+   ASSERT(index.overlapping_interval(IntervalType(100,150)) == map.overlapping_interval(IntervalType(100,150)));
+   ASSERT(index.contained_by_interval(IntervalType(0,400)) == map.contained_by_interval(IntervalType(0,400)));
+   ASSERT(index.containing_interval(IntervalType(300,302)) == map.containing_interval(IntervalType(300,302)));
+
+   index.insert(IntervalType(5,9), 1);
+   index.insert(IntervalType(5,9), 2);
+   ASSERT(*index.find(IntervalType(5,9)) == 2);
+   index.remove(IntervalType(5,9));
+   ASSERT(!index.contains(IntervalType(5,9)) && index.find(IntervalType(5,9)) == nullptr);
+
+   std::size_t sum = 0;
+   index.for_each_overlapping_interval(IntervalType(100,150), [&sum](const IntervalType &, std::size_t value) { sum += value; });
+   std::size_t expected = 0;
+   map.for_each_overlapping_interval(IntervalType(100,150), [&expected](const std::pair<const IntervalType, std::size_t> &entry) { expected += entry.second; });
+   ASSERT(sum == expected);
+
+   index.compact();
+   ASSERT(index.run_count() == 1 && index.buffered() == 0 && index.stored() == map.size());
+   ASSERT(index.containing_point(500) == map.containing_point(500));
+
+   LsmIntervalIndex<IntervalType> set;
+   set.insert(IntervalType(0,10));
+   set.insert(IntervalType(5,15));
+   set.remove(IntervalType(0,10));
+   ASSERT(set.containing_point(7) == IntervalTree<IntervalType>::SetType({IntervalType(5,15)}));
+   set.flush();
+   ASSERT(set.stored() == 1 && set.contains(IntervalType(5,15)));
+
+   LsmIntervalIndex<IntervalType> spanned(2);
+   for (auto &key : spanned_fixture<IntervalType>())
+      spanned.insert(key);
+   ASSERT(spanned.run_count() == 1 && spanned.buffered() == 1);
+   ASSERT(overlaps_as_tree<IntervalType>(spanned));
+
+   // the removed key spans every live one, but only live keys decide the span
+   spanned.insert(IntervalType(0,20));
+   spanned.remove(IntervalType(0,20));
+   ASSERT(overlaps_as_tree<IntervalType>(spanned));
+   spanned.flush();
+   ASSERT(spanned.buffered() == 0 && spanned.stored() > 3);
+   ASSERT(overlaps_as_tree<IntervalType>(spanned));
+   std::size_t spanned_hits = 0;
+   spanned.for_each_overlapping_interval(IntervalType(5,10), [&spanned_hits](const IntervalType &) { ++spanned_hits; });
+   ASSERT(spanned_hits == 3);
+
+   COMPLETE();
+}
+
+int
+test_mappedintervalindex
+()
+{
+   INIT();
+
+   using IntervalType = Interval<std::uintptr_t>;
+
+   IntervalMap<IntervalType, std::size_t> map;
+   for (std::size_t i=0; i<100; ++i)
+      map.insert(IntervalType(i*0x1000, i*0x1000+0x2000), i);
+
+   write_index(map, "testintervaltree.idx");
+
+   {
+      MappedIntervalIndex<IntervalType, std::size_t> mapped("testintervaltree.idx");
+      std::size_t total = 0;
+      auto sum = [&total](const IntervalType &, const std::size_t &value) { total += value; };
+
+      ASSERT(mapped.size() == 100);
+      ASSERT(mapped.for_each_containing_point(0x5800, sum) == true);
+      ASSERT(total == 4 + 5);
+      ASSERT(mapped.overlapping_interval(IntervalType(0x10000,0x20000)) == map.overlapping_interval(IntervalType(0x10000,0x20000)));
+      ASSERT(mapped.key(7) == IntervalType(0x7000,0x9000) && mapped.value(7) == 7);
+      ASSERT_THROWS(MappedIntervalIndex<IntervalType>("testintervaltree.idx"), exception::BadIndexFile);
+   }
+
+   {
+      IntervalIndexWriter<IntervalType> writer("testintervaltree.idx");
+      writer.append(IntervalType(0,10));
+      writer.append(IntervalType(5,6));
+      ASSERT_THROWS(writer.append(IntervalType(1,2)), exception::IndexOutOfOrder);
+      writer.finish();
+
+      MappedIntervalIndex<IntervalType> mapped("testintervaltree.idx");
+      ASSERT(mapped.containing_point(5) == IntervalTree<IntervalType>::SetType({IntervalType(0,10), IntervalType(5,6)}));
+   }
+
+   {
+      IntervalIndexWriter<IntervalType> writer("testintervaltree.idx");
+      for (auto &key : spanned_fixture<IntervalType>())
+         writer.append(key);
+      writer.finish();
+
+      ASSERT(overlaps_as_tree<IntervalType>(MappedIntervalIndex<IntervalType>("testintervaltree.idx")));
+   }
+
+   {
+      // a header whose max_level disagrees with its count would send queries out of range
+      std::int64_t max_level = 40;
+      auto file = std::fopen("testintervaltree.idx", "r+b");
+      ASSERT(file != nullptr);
+      std::fseek(file, offsetof(IndexFileHeader, max_level), SEEK_SET);
+      std::fwrite(&max_level, sizeof(max_level), 1, file);
+      std::fclose(file);
+
+      ASSERT_THROWS(MappedIntervalIndex<IntervalType>("testintervaltree.idx"), exception::BadIndexFile);
+   }
+
+   std::remove("testintervaltree.idx");
+
+   COMPLETE();
+}
+
 int
 main
 (int argc, char *argv[])
@@ -169,6 +1031,27 @@ main
 
    LOG_INFO("Testing IntervalMap.");
    PROCESS_RESULT(test_intervalmap);
+
+   LOG_INFO("Testing FrozenIntervalIndex.");
+   PROCESS_RESULT(test_frozenintervalindex);
+
+   LOG_INFO("Testing WideIntervalTree.");
+   PROCESS_RESULT(test_wideintervaltree);
+
+   LOG_INFO("Testing PersistentIntervalTree.");
+   PROCESS_RESULT(test_persistentintervaltree);
+
+   LOG_INFO("Testing IntervalSet.");
+   PROCESS_RESULT(test_intervalset);
+
+   LOG_INFO("Testing MappedIntervalIndex.");
+   PROCESS_RESULT(test_mappedintervalindex);
+
+   LOG_INFO("Testing ConcurrentIntervalMap.");
+   PROCESS_RESULT(test_concurrentintervalmap);
+
+   LOG_INFO("Testing LsmIntervalIndex.");
+   PROCESS_RESULT(test_lsmintervalindex);
       
    COMPLETE();
 }